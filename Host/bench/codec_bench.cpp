@@ -0,0 +1,140 @@
+/*******************************************************************//**
+ *  \file codec_bench.cpp
+ *  \author René Richard
+ *  \brief Round trips ROM images through the block codec and reports the
+ *         compression ratio and the speed of both sides.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   usage: codec_bench [rom files...]
+ *   without files a few synthetic images are used
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "Codec/Codec.h"
+#include "cycles.h"
+
+// every chunk of a compressed read costs a length word and a crc32 on the wire
+#define CHUNK_OVERHEAD		8
+
+struct Image{
+	std::string name;
+	std::vector<uint8_t> data;
+};
+
+static uint32_t lcg = 12345;
+static uint8_t next_random(void){
+	lcg = lcg * 1103515245U + 12345U;
+	return (uint8_t)(lcg >> 16);
+}
+
+/*******************************************************************//**
+ * code-like data, a small set of opcodes with repeated short sequences
+ **********************************************************************/
+static void fill_code(uint8_t *p, size_t len){
+	for( size_t i = 0; i < len; ){
+		if( i >= 64 && (next_random() & 3) == 0 ){
+			size_t back = 1 + next_random() % 48;
+			size_t n = 4 + next_random() % 12;
+			for( ; n != 0 && i < len; n-- ){
+				p[i] = p[i - back];
+				i++;
+			}
+		}else{
+			p[i++] = next_random() & 0x3F;
+		}
+	}
+}
+
+static std::vector<Image> synthetic_images(void){
+	std::vector<Image> images;
+
+	// a 4MB cartridge with 1.5MB of content, the rest erased
+	Image padded{"padded 4MB", std::vector<uint8_t>(4 << 20, 0xFF)};
+	fill_code(padded.data.data(), 1536 << 10);
+	images.push_back(padded);
+
+	// 1MB of code and graphics with no padding
+	Image code{"code 1MB", std::vector<uint8_t>(1 << 20)};
+	fill_code(code.data.data(), code.data.size());
+	images.push_back(code);
+
+	// already compressed data, the codec must not make it bigger than raw + headers
+	Image noise{"random 1MB", std::vector<uint8_t>(1 << 20)};
+	for( auto &b : noise.data ){
+		b = next_random();
+	}
+	images.push_back(noise);
+	return images;
+}
+
+int main(int argc, char *argv[]){
+
+	static Codec codec;
+	static uint8_t block[CODEC_MAX_BLOCK] __attribute__((aligned(4)));
+	static uint8_t decoded[CODEC_BLOCK_SIZE];
+	std::vector<Image> images;
+
+	for( int i = 1; i < argc; i++ ){
+		std::ifstream f(argv[i], std::ios::binary);
+		if( !f ){
+			std::fprintf(stderr, "can't open %s\n", argv[i]);
+			return 1;
+		}
+		images.push_back({argv[i], std::vector<uint8_t>(std::istreambuf_iterator<char>(f), {})});
+	}
+	if( images.empty() ){
+		images = synthetic_images();
+	}
+
+	std::printf("%-20s %10s %10s %8s %12s %12s\n", "image", "raw", "wire", "ratio",
+		"enc B/" BENCH_UNIT, "dec B/" BENCH_UNIT);
+
+	for( auto &image : images ){
+		uint64_t wire = 0, enc_cycles = 0, dec_cycles = 0, t;
+		const uint8_t *src = image.data.data();
+		size_t size = image.data.size();
+
+		for( size_t pos = 0; pos < size; pos += CODEC_BLOCK_SIZE ){
+			uint16_t len = (uint16_t)((size - pos > CODEC_BLOCK_SIZE) ? CODEC_BLOCK_SIZE : size - pos);
+
+			t = bench_cycles();
+			uint16_t n = codec.encode(src + pos, len, block);
+			enc_cycles += bench_cycles() - t;
+
+			t = bench_cycles();
+			int32_t out = Codec::decode(block, n, decoded, sizeof(decoded));
+			dec_cycles += bench_cycles() - t;
+
+			if( out != len || std::memcmp(decoded, src + pos, len) != 0 ){
+				std::printf("%s: block at 0x%zX doesn't round trip\n", image.name.c_str(), pos);
+				return 1;
+			}
+			wire += n + CHUNK_OVERHEAD;
+		}
+
+		std::printf("%-20s %10zu %10llu %7.2fx %12.3f %12.3f\n", image.name.c_str(), size,
+			(unsigned long long)wire, (double)size / wire,
+			(double)size / (enc_cycles ? enc_cycles : 1), (double)size / (dec_cycles ? dec_cycles : 1));
+	}
+	return 0;
+}
@@ -0,0 +1,47 @@
+/*******************************************************************//**
+ *  \file cycles.h
+ *  \author René Richard
+ *  \brief Cycle counter for the host micro-benchmarks, falls back to
+ *         nanoseconds on hosts without a time stamp counter.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCH_CYCLES_H_
+#define BENCH_CYCLES_H_
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycle"
+static inline uint64_t bench_cycles(void){ return __rdtsc(); }
+#else
+#define BENCH_UNIT "ns"
+static inline uint64_t bench_cycles(void){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+// keep the optimizer from discarding benchmark results
+template<typename T>
+static inline void bench_keep(T const &value){
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif /* BENCH_CYCLES_H_ */
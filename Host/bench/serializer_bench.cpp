@@ -0,0 +1,173 @@
+/*******************************************************************//**
+ *  \file serializer_bench.cpp
+ *  \author René Richard
+ *  \brief Compares the word aligned Serializer used by USB::put against the
+ *         original byte at a time put family, in bytes per cycle.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+#include "Serializer.h"
+#include "cycles.h"
+
+#define BUFFER_SIZE		8192
+#define REPS			2000
+
+/*******************************************************************//**
+ * the put family as it was in USB.cpp, one byte at a time
+ **********************************************************************/
+struct LegacyPut{
+	union{
+		uint8_t		bytes[BUFFER_SIZE];
+		uint32_t	lwords[BUFFER_SIZE/4];
+	}data;
+	uint16_t size;
+
+	bool enough_room(uint16_t len){ return BUFFER_SIZE - (size + len + 4) >= 0; }
+
+	uint16_t put(uint8_t byte){
+		if( size % 4 != 0 ) return -1;
+		if( !enough_room(4) ) return 0;
+		data.bytes[size++] = byte;
+		data.bytes[size++] = 0;
+		data.bytes[size++] = 0;
+		data.bytes[size++] = 0;
+		return 4;
+	}
+
+	uint16_t put(uint16_t word){
+		if( size % 4 != 0 ) return -1;
+		if( !enough_room(4) ) return 0;
+		data.bytes[size++] = (uint8_t)word;
+		data.bytes[size++] = (uint8_t)(word>>8);
+		data.bytes[size++] = 0;
+		data.bytes[size++] = 0;
+		return 4;
+	}
+
+	uint16_t put(uint32_t lword){
+		if( size % 4 != 0 ) return -1;
+		if( !enough_room(4) ) return 0;
+		data.bytes[size++] = (uint8_t)lword;
+		data.bytes[size++] = (uint8_t)(lword>>8);
+		data.bytes[size++] = (uint8_t)(lword>>16);
+		data.bytes[size++] = (uint8_t)(lword>>24);
+		return 4;
+	}
+
+	uint16_t put(const uint8_t *src, uint16_t len){
+		uint16_t room_left = BUFFER_SIZE - size;
+		if( size % 4 != 0 ) return -1;
+		if( len > room_left ) return 0;
+		for( int i = 0; i < len; i++ ) data.bytes[size++] = *(src++);
+		while( len % 4 != 0 ){ data.bytes[size++] = 0; len++; }
+		return len;
+	}
+
+	// note: the original only copies half of the words, kept as is for timing
+	uint16_t put(const uint16_t *src, uint16_t len){
+		uint16_t room_left = BUFFER_SIZE - size;
+		if( size % 4 != 0 ) return -1;
+		if( len > room_left ) return 0;
+		for( int i = 0; i < (len>>2); i++ ){
+			data.bytes[size++] = (uint8_t)(*src);
+			data.bytes[size++] = (uint8_t)((*(src++)>>8));
+		}
+		while( len % 4 != 0 ){ data.bytes[size++] = 0; len++; }
+		return len;
+	}
+};
+
+/*******************************************************************//**
+ * the Serializer on the same kind of buffer USB uses
+ **********************************************************************/
+struct AlignedPut{
+	union{
+		uint8_t		bytes[BUFFER_SIZE];
+		uint32_t	lwords[BUFFER_SIZE/4];
+	}data;
+	uint16_t size = 0;
+	Serializer out{data.lwords, BUFFER_SIZE - 4, size};
+};
+
+static uint8_t  src8[4096] __attribute__((aligned(4)));
+static uint16_t src16[2048] __attribute__((aligned(4)));
+
+/*******************************************************************//**
+ * run a workload REPS times and return the payload bytes per cycle
+ **********************************************************************/
+static double measure(uint16_t &size, uint32_t payload, const std::function<void(void)> &work){
+	uint64_t best = ~0ULL;
+
+	for( int rep = 0; rep < REPS; rep++ ){
+		size = 4;
+		uint64_t start = bench_cycles();
+		work();
+		uint64_t elapsed = bench_cycles() - start;
+		if( elapsed < best ){
+			best = elapsed;
+		}
+	}
+	return (double)payload / (double)(best ? best : 1);
+}
+
+int main(void){
+	static LegacyPut legacy;
+	static AlignedPut aligned;
+
+	for( unsigned i = 0; i < sizeof(src8); i++ ) src8[i] = (uint8_t)(i * 7);
+	for( unsigned i = 0; i < 2048; i++ ) src16[i] = (uint16_t)(i * 0x0101 + 3);
+
+	struct{
+		const char *name;
+		uint32_t payload;
+		std::function<void(void)> legacy_work;
+		std::function<void(void)> aligned_work;
+	} workloads[] = {
+		{ "bulk 8-bit 4KB", sizeof(src8),
+			[&]{ legacy.put(src8, sizeof(src8)); bench_keep(legacy.data.lwords[4]); },
+			[&]{ aligned.out.put(src8, sizeof(src8)); bench_keep(aligned.data.lwords[4]); } },
+		{ "bulk 16-bit 4KB", sizeof(src16),
+			[&]{ legacy.put(src16, sizeof(src16)); bench_keep(legacy.data.lwords[4]); },
+			[&]{ aligned.out.put(src16, sizeof(src16)); bench_keep(aligned.data.lwords[4]); } },
+		{ "fields u8/u16/u32 x512", 512 * 7,
+			[&]{ for( int i = 0; i < 512; i++ ){ legacy.put((uint8_t)i); legacy.put((uint16_t)i); legacy.put((uint32_t)i); } bench_keep(legacy.data.lwords[4]); },
+			[&]{ for( int i = 0; i < 512; i++ ){ aligned.out.put((uint8_t)i); aligned.out.put((uint16_t)i); aligned.out.put((uint32_t)i); } bench_keep(aligned.data.lwords[4]); } },
+		{ "reserve u32 x1024", 4096,
+			[&]{ for( uint32_t i = 0; i < 1024; i++ ){ legacy.put(i); } bench_keep(legacy.data.lwords[4]); },
+			[&]{ Span<uint32_t> s = aligned.out.reserve<uint32_t>(1024); for( uint32_t i = 0; i < 1024; i++ ){ s[i] = i; } bench_keep(aligned.data.lwords[4]); } },
+	};
+
+	// the aligned output must match what the protocol expects
+	aligned.size = 4;
+	aligned.out.put(src16, sizeof(src16));
+	if( std::memcmp(&aligned.data.bytes[4], src16, sizeof(src16)) != 0 ){
+		std::printf("serializer output mismatch\n");
+		return 1;
+	}
+
+	std::printf("%-24s %14s %14s %8s\n", "workload", "legacy B/" BENCH_UNIT, "aligned B/" BENCH_UNIT, "speedup");
+	for( auto &w : workloads ){
+		double l = measure(legacy.size, w.payload, w.legacy_work);
+		double a = measure(aligned.size, w.payload, w.aligned_work);
+		std::printf("%-24s %14.3f %14.3f %7.1fx\n", w.name, l, a, a / l);
+	}
+	return 0;
+}
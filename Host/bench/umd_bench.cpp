@@ -0,0 +1,538 @@
+/*******************************************************************//**
+ *  \file umd_bench.cpp
+ *  \author René Richard
+ *  \brief End to end benchmarks of the UMDv2 protocol, against a real
+ *         device or the simulated one. Every workload reports throughput,
+ *         request latency percentiles and the bytes that crossed the link.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   usage: umd_bench [--sim | --port <tty>] [--allow-write] [-o results.json] [workload...]
+ *   the simulated device is used by default, its timing is a model and runs
+ *   are reproducible; against hardware the time is the wall clock. Workloads
+ *   that write the flash only run on hardware with --allow-write.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Codec/Codec.h"
+#include "Client.h"
+#include "Crc32.h"
+#include "Loopback.h"
+#include "SerialTransport.h"
+#include "SimDevice.h"
+
+#define REQUEST_SIZE		0x10000		///< bytes per read or program request
+#define PIPELINE_DEPTH		4			///< requests in flight when pipelining
+#define SECTOR_SIZE			0x10000		///< granularity of sync image
+#define PIPELINE_SECTORS	16			///< sectors per erase and program request
+#define SYNC_ERASE			0x0001
+
+#define GENESIS_SIZE		(4 << 20)
+#define SMS_SIZE			(512 << 10)
+
+/*******************************************************************//**
+ * results of one workload
+ **********************************************************************/
+struct Result{
+	std::string				name;
+	uint64_t				ops = 0;			///< requests sent
+	uint64_t				payload = 0;		///< useful bytes moved, rom data read or programmed
+	uint64_t				tx = 0;
+	uint64_t				rx = 0;
+	double					seconds = 0;
+	std::vector<double>		latency_us;
+	std::string				skipped;			///< why the workload didn't run
+	std::string				error;
+};
+
+/*******************************************************************//**
+ * a workload, the image is what the flash holds (or must hold once done)
+ **********************************************************************/
+struct Workload{
+	const char				*name;
+	SimDevice::e_cart		cart;
+	bool					writes;
+	std::function<void(Client &, Transport &, Result &)> run;
+};
+
+static bool simulated;				///< the flash contents are known
+
+static uint32_t lcg = 12345;
+static uint8_t next_random(void){
+	lcg = lcg * 1103515245U + 12345U;
+	return (uint8_t)(lcg >> 16);
+}
+
+/*******************************************************************//**
+ * code-like data up to used, erased flash after it
+ **********************************************************************/
+static std::vector<uint8_t> make_image(size_t size, size_t used, uint32_t seed){
+	std::vector<uint8_t> image(size, 0xFF);
+
+	lcg = seed;
+	for( size_t i = 0; i < used; ){
+		if( i >= 64 && (next_random() & 3) == 0 ){
+			size_t back = 1 + next_random() % 48;
+			for( size_t n = 4 + next_random() % 12; n != 0 && i < used; n-- ){
+				image[i] = image[i - back];
+				i++;
+			}
+		}else{
+			image[i++] = next_random() & 0x3F;
+		}
+	}
+	return image;
+}
+
+static const std::vector<uint8_t> &genesis_image(void){
+	static const std::vector<uint8_t> image = make_image(GENESIS_SIZE, 3 << 20, 1);
+	return image;
+}
+
+static const std::vector<uint8_t> &sms_image(void){
+	static const std::vector<uint8_t> image = make_image(SMS_SIZE, SMS_SIZE, 2);
+	return image;
+}
+
+/*******************************************************************//**
+ * time one request and add it to the result
+ **********************************************************************/
+template<typename F>
+static Client::Reply timed(Transport &transport, Result &result, F request){
+	uint64_t start = transport.now_ns();
+	Client::Reply reply = request();
+	result.latency_us.push_back((transport.now_ns() - start) / 1e3);
+	result.ops++;
+	return reply;
+}
+
+static void expect(const Client::Reply &reply, uint16_t cmd){
+	if( !reply.ok(cmd) ){
+		char msg[64];
+		std::snprintf(msg, sizeof(msg), "0x%04X failed, ack 0x%04X status %u", cmd, reply.ack, reply.status);
+		throw LinkError(msg);
+	}
+}
+
+/*******************************************************************//**
+ * 0x000B in REQUEST_SIZE pieces
+ **********************************************************************/
+static void dump(Client &link, Transport &transport, Result &result, const std::vector<uint8_t> &image){
+	for( uint32_t address = 0; address < image.size(); address += REQUEST_SIZE ){
+		uint32_t request[2] = { address, REQUEST_SIZE };
+		Client::Reply reply = timed(transport, result, [&]{ return link.command(0x000B, request, sizeof(request)); });
+		expect(reply, 0x000B);
+		if( reply.payload.size() != REQUEST_SIZE ){
+			throw LinkError("short read");
+		}
+		// the simulated flash is known, hardware holds whatever is plugged in
+		if( simulated && std::memcmp(reply.payload.data(), &image[address], REQUEST_SIZE) != 0 ){
+			throw LinkError("read data doesn't match the flash");
+		}
+		result.payload += REQUEST_SIZE;
+	}
+}
+
+/*******************************************************************//**
+ * 0x000B with PIPELINE_DEPTH requests in flight, each reply lands in
+ * its place in the dump
+ **********************************************************************/
+static void dump_pipelined(Client &link, Transport &transport, Result &result, const std::vector<uint8_t> &image){
+	std::vector<uint8_t> dump(image.size());
+	std::deque<std::pair<uint64_t, std::future<Client::Reply>>> in_flight;
+
+	auto retire = [&]{
+		Client::Reply reply = in_flight.front().second.get();
+		result.latency_us.push_back((transport.now_ns() - in_flight.front().first) / 1e3);
+		in_flight.pop_front();
+		expect(reply, 0x000B);
+		if( reply.length != REQUEST_SIZE ){
+			throw LinkError("short read");
+		}
+		result.payload += REQUEST_SIZE;
+	};
+
+	for( uint32_t address = 0; address < image.size(); address += REQUEST_SIZE ){
+		uint32_t request[2] = { address, REQUEST_SIZE };
+		Client::Sink sink(&dump[address], REQUEST_SIZE);
+		in_flight.emplace_back(transport.now_ns(), link.submit(0x000B, request, sizeof(request), sink));
+		result.ops++;
+		if( in_flight.size() == PIPELINE_DEPTH ){
+			retire();
+		}
+	}
+	while( !in_flight.empty() ){
+		retire();
+	}
+	if( simulated && dump != image ){
+		throw LinkError("read data doesn't match the flash");
+	}
+}
+
+/*******************************************************************//**
+ * 0x000E in REQUEST_SIZE pieces, every chunk is a codec block
+ **********************************************************************/
+static void dump_compressed(Client &link, Transport &transport, Result &result, const std::vector<uint8_t> &image){
+	static uint8_t raw[CODEC_BLOCK_SIZE];
+
+	for( uint32_t address = 0; address < image.size(); address += REQUEST_SIZE ){
+		uint32_t request[2] = { address, REQUEST_SIZE };
+		Client::Reply reply = timed(transport, result, [&]{ return link.command(0x000E, request, sizeof(request)); });
+		expect(reply, 0x000E);
+
+		size_t pos = 0;
+		uint32_t offset = address;
+		for( size_t len : reply.chunks ){
+			int32_t n = Codec::decode(&reply.payload[pos], (uint32_t)len, raw, sizeof(raw));
+			if( n < 0 ){
+				throw LinkError("corrupt codec block");
+			}
+			if( simulated && std::memcmp(raw, &image[offset], n) != 0 ){
+				throw LinkError("decoded data doesn't match the flash");
+			}
+			pos += len;
+			offset += n;
+		}
+		if( offset != address + REQUEST_SIZE ){
+			throw LinkError("short compressed read");
+		}
+		result.payload += REQUEST_SIZE;
+	}
+}
+
+/*******************************************************************//**
+ * 0x0010 over the whole image
+ * \return the sectors that don't match
+ **********************************************************************/
+static std::vector<uint32_t> sync(Client &link, Transport &transport, Result &result,
+		const std::vector<uint8_t> &image, uint16_t flags, uint16_t &mismatched){
+	uint16_t count = (uint16_t)(image.size() / SECTOR_SIZE);
+	std::vector<uint32_t> request = { 0, SECTOR_SIZE, (uint32_t)count | ((uint32_t)flags << 16) };
+
+	for( uint16_t i = 0; i < count; i++ ){
+		request.push_back(crc32_mpeg2(&image[i * SECTOR_SIZE], SECTOR_SIZE));
+	}
+	Client::Reply reply = timed(transport, result, [&]{ return link.command(0x0010, request.data(), request.size() * 4); });
+	expect(reply, 0x0010);
+
+	std::memcpy(&mismatched, reply.payload.data(), sizeof(mismatched));
+	std::vector<uint32_t> bitmap((count + 31) / 32);
+	std::memcpy(bitmap.data(), &reply.payload[4], bitmap.size() * 4);
+	return bitmap;
+}
+
+/*******************************************************************//**
+ * erase the sectors that differ and program them back with 0x000F, on
+ * a board with several chips each request holds a sector of every chip
+ * with their blocks in turn so the chips program at once. Pipelined,
+ * 0x0018 erases the sectors while the previous ones are programmed.
+ **********************************************************************/
+static void burn(Client &link, Transport &transport, Result &result, const std::vector<uint8_t> &image, bool pipelined = false){
+	static Codec codec;
+	static uint32_t block[CODEC_MAX_BLOCK / 4];
+	uint16_t mismatched;
+
+	uint32_t chip_size = 0;
+	Client::Reply geometry = link.command(0x0017);
+	if( geometry.ok(0x0017) && geometry.payload.size() >= sizeof(FlashGeometry) ){
+		FlashGeometry g;
+		std::memcpy(&g, geometry.payload.data(), sizeof(g));
+		chip_size = (g.chips > 1) ? g.size : 0;
+	}
+
+	std::vector<uint32_t> bitmap = sync(link, transport, result, image, pipelined ? 0 : SYNC_ERASE, mismatched);
+	std::map<uint32_t, std::deque<uint32_t>> per_chip;
+	for( uint32_t sector = 0; sector < image.size() / SECTOR_SIZE; sector++ ){
+		if( bitmap[sector >> 5] & (1U << (sector & 31)) ){
+			per_chip[chip_size ? sector * SECTOR_SIZE / chip_size : 0].push_back(sector);
+		}
+	}
+	while( !per_chip.empty() ){
+		// 0x0018 takes a run of sectors, the erase of the first isn't hidden
+		std::vector<uint32_t> sectors;
+		do{
+			for( auto it = per_chip.begin(); it != per_chip.end(); ){
+				sectors.push_back(it->second.front());
+				it->second.pop_front();
+				it = it->second.empty() ? per_chip.erase(it) : std::next(it);
+			}
+		}while( pipelined && sectors.size() < PIPELINE_SECTORS && !per_chip.empty() );
+
+		std::vector<std::vector<uint8_t>> chunks;
+		if( pipelined ){
+			// consecutive sectors go in one range, the device pipelines the erases within it
+			std::vector<uint32_t> ranges;
+			for( uint32_t sector : sectors ){
+				if( !ranges.empty() && ranges[ranges.size() - 2] + ranges.back() == sector * SECTOR_SIZE ){
+					ranges.back() += SECTOR_SIZE;
+				}else{
+					ranges.push_back(sector * SECTOR_SIZE);
+					ranges.push_back(SECTOR_SIZE);
+				}
+			}
+			std::vector<uint8_t> list(4 + 4 * ranges.size());
+			uint32_t n = (uint32_t)ranges.size() / 2;
+			std::memcpy(&list[0], &n, 4);
+			std::memcpy(&list[4], ranges.data(), 4 * ranges.size());
+			chunks.push_back(std::move(list));
+		}
+		// 0x0018 wants the blocks in the order of the list, 0x000F alternates the chips
+		const size_t per_sector = SECTOR_SIZE / CODEC_BLOCK_SIZE;
+		for( size_t i = 0; i < sectors.size() * per_sector; i++ ){
+			uint32_t sector = pipelined ? sectors[i / per_sector] : sectors[i % sectors.size()];
+			uint32_t pos = (uint32_t)(pipelined ? i % per_sector : i / sectors.size()) * CODEC_BLOCK_SIZE;
+			uint32_t block_address = sector * SECTOR_SIZE + pos;
+			uint16_t n = codec.encode(&image[block_address], CODEC_BLOCK_SIZE, reinterpret_cast<uint8_t *>(block));
+			std::vector<uint8_t> chunk(4 + n);
+			std::memcpy(&chunk[0], &block_address, 4);
+			std::memcpy(&chunk[4], block, n);
+			chunks.push_back(std::move(chunk));
+		}
+		uint16_t cmd = pipelined ? 0x0018 : 0x000F;
+		Client::Reply reply = timed(transport, result, [&]{ return link.command_chunked(cmd, chunks); });
+		expect(reply, cmd);
+		result.payload += sectors.size() * SECTOR_SIZE;
+	}
+
+	// what was programmed must read back
+	sync(link, transport, result, image, 0, mismatched);
+	if( mismatched != 0 ){
+		throw LinkError("flash doesn't match the image after programming");
+	}
+}
+
+/*******************************************************************//**
+ * the flash image each workload starts from on the simulated device
+ **********************************************************************/
+static std::vector<uint8_t> initial_flash(const std::string &name){
+	if( name.compare(0, 9, "full_burn") == 0 ){
+		// an unrelated game was on the cartridge
+		return make_image(GENESIS_SIZE, 2 << 20, 99);
+	}
+	if( name == "sector_patch" ){
+		// a couple of sectors changed since the last burn
+		std::vector<uint8_t> flash = genesis_image();
+		flash[0x000200] ^= 0x01;
+		flash[0x2A0010] ^= 0x80;
+		return flash;
+	}
+	return (name.compare(0, 3, "sms") == 0) ? sms_image() : genesis_image();
+}
+
+static std::vector<Workload> workloads(void){
+	return {
+		{ "latency", SimDevice::cart_genesis, false, [](Client &link, Transport &transport, Result &result){
+			for( int i = 0; i < 1000; i++ ){
+				expect(timed(transport, result, [&]{ return link.command(0x0004); }), 0x0004);
+			}
+		}},
+		{ "genesis_dump_4m", SimDevice::cart_genesis, false, [](Client &link, Transport &transport, Result &result){
+			dump(link, transport, result, genesis_image());
+		}},
+		{ "genesis_dump_4m_pipelined", SimDevice::cart_genesis, false, [](Client &link, Transport &transport, Result &result){
+			dump_pipelined(link, transport, result, genesis_image());
+		}},
+		{ "genesis_dump_4m_lz", SimDevice::cart_genesis, false, [](Client &link, Transport &transport, Result &result){
+			dump_compressed(link, transport, result, genesis_image());
+		}},
+		{ "sms_dump_512k", SimDevice::cart_master_system, false, [](Client &link, Transport &transport, Result &result){
+			dump(link, transport, result, sms_image());
+		}},
+		{ "full_burn", SimDevice::cart_genesis, true, [](Client &link, Transport &transport, Result &result){
+			burn(link, transport, result, genesis_image());
+		}},
+		{ "full_burn_2chip", SimDevice::cart_genesis, true, [](Client &link, Transport &transport, Result &result){
+			burn(link, transport, result, genesis_image());
+		}},
+		{ "full_burn_pipelined", SimDevice::cart_genesis, true, [](Client &link, Transport &transport, Result &result){
+			burn(link, transport, result, genesis_image(), true);
+		}},
+		{ "full_burn_2chip_pipelined", SimDevice::cart_genesis, true, [](Client &link, Transport &transport, Result &result){
+			burn(link, transport, result, genesis_image(), true);
+		}},
+		{ "sector_patch", SimDevice::cart_genesis, true, [](Client &link, Transport &transport, Result &result){
+			burn(link, transport, result, genesis_image());
+		}},
+		{ "crc_verify", SimDevice::cart_genesis, false, [](Client &link, Transport &transport, Result &result){
+			uint16_t mismatched;
+			sync(link, transport, result, genesis_image(), 0, mismatched);
+			result.payload += genesis_image().size();
+			if( simulated && mismatched != 0 ){
+				throw LinkError("crc verify found mismatches");
+			}
+		}},
+	};
+}
+
+/*******************************************************************//**
+ * nearest rank percentile
+ **********************************************************************/
+static double percentile(std::vector<double> v, double p){
+	if( v.empty() ){
+		return 0;
+	}
+	std::sort(v.begin(), v.end());
+	size_t rank = (size_t)(p / 100.0 * v.size() + 0.999999);
+	return v[std::min(v.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+static void write_json(FILE *f, const std::string &device, const std::vector<Result> &results){
+	std::fprintf(f, "{\n  \"device\": \"%s\",\n  \"workloads\": [\n", device.c_str());
+	for( size_t i = 0; i < results.size(); i++ ){
+		const Result &r = results[i];
+		std::fprintf(f, "    { \"name\": \"%s\"", r.name.c_str());
+		if( !r.skipped.empty() ){
+			std::fprintf(f, ", \"skipped\": \"%s\"", r.skipped.c_str());
+		}else if( !r.error.empty() ){
+			std::fprintf(f, ", \"error\": \"%s\"", r.error.c_str());
+		}else{
+			std::fprintf(f, ", \"ops\": %llu, \"payload_bytes\": %llu, \"tx_bytes\": %llu, \"rx_bytes\": %llu",
+				(unsigned long long)r.ops, (unsigned long long)r.payload, (unsigned long long)r.tx, (unsigned long long)r.rx);
+			std::fprintf(f, ", \"seconds\": %.6f, \"bytes_per_s\": %.0f, \"p50_us\": %.1f, \"p99_us\": %.1f",
+				r.seconds, r.seconds > 0 ? r.payload / r.seconds : 0.0, percentile(r.latency_us, 50), percentile(r.latency_us, 99));
+		}
+		std::fprintf(f, " }%s\n", (i + 1 < results.size()) ? "," : "");
+	}
+	std::fprintf(f, "  ]\n}\n");
+}
+
+static uint8_t query_bus_size(Client &link){
+	Client::Reply reply = link.command(0x000D);
+	expect(reply, 0x000D);
+	return (reply.payload.size() >= 22) ? reply.payload[21] : 0;
+}
+
+int main(int argc, char *argv[]){
+
+	std::string port, output;
+	bool allow_write = false;
+	std::vector<std::string> selected;
+	std::vector<Result> results;
+
+	for( int i = 1; i < argc; i++ ){
+		std::string arg = argv[i];
+		if( arg == "--sim" ){
+			port.clear();
+		}else if( arg == "--port" && i + 1 < argc ){
+			port = argv[++i];
+		}else if( arg == "--allow-write" ){
+			allow_write = true;
+		}else if( arg == "-o" && i + 1 < argc ){
+			output = argv[++i];
+		}else if( arg[0] == '-' ){
+			std::fprintf(stderr, "usage: %s [--sim | --port <tty>] [--allow-write] [-o results.json] [workload...]\n", argv[0]);
+			return 1;
+		}else{
+			selected.push_back(arg);
+		}
+	}
+
+	simulated = port.empty();
+	std::unique_ptr<Transport> hardware;
+	if( !port.empty() ){
+		try{
+			hardware.reset(new SerialTransport(port));
+		}catch( const LinkError &e ){
+			std::fprintf(stderr, "%s\n", e.what());
+			return 1;
+		}
+	}
+
+	for( const Workload &w : workloads() ){
+		if( !selected.empty() && std::find(selected.begin(), selected.end(), w.name) == selected.end() ){
+			continue;
+		}
+		Result result;
+		result.name = w.name;
+
+		// every simulated workload starts from a fresh device
+		std::unique_ptr<SimDevice> sim;
+		std::unique_ptr<Transport> loopback;
+		Transport *transport = hardware.get();
+		if( !transport ){
+			sim.reset(new SimDevice(w.cart, initial_flash(w.name)));
+			// two 2MB chips on the halves of the address space
+			if( std::string(w.name).find("2chip") != std::string::npos ){
+				sim->chips = 2;
+			}
+			loopback.reset(new LoopbackTransport(*sim));
+			transport = loopback.get();
+		}
+		Client link(*transport, PIPELINE_DEPTH);
+
+		try{
+			if( hardware ){
+				uint8_t bus = query_bus_size(link);
+				if( bus != ((w.cart == SimDevice::cart_genesis) ? 16 : 8) ){
+					result.skipped = "cartridge bus size doesn't match";
+				}else if( w.writes && !allow_write ){
+					result.skipped = "writes the flash, needs --allow-write";
+				}
+			}
+			if( result.skipped.empty() ){
+				uint64_t tx = link.tx_bytes, rx = link.rx_bytes;
+				uint64_t start = transport->now_ns();
+				w.run(link, *transport, result);
+				result.seconds = (transport->now_ns() - start) / 1e9;
+				result.tx = link.tx_bytes - tx;
+				result.rx = link.rx_bytes - rx;
+			}
+		}catch( const LinkError &e ){
+			result.error = e.what();
+		}
+
+		if( !result.skipped.empty() ){
+			std::fprintf(stderr, "%-26s skipped, %s\n", w.name, result.skipped.c_str());
+		}else if( !result.error.empty() ){
+			std::fprintf(stderr, "%-26s error, %s\n", w.name, result.error.c_str());
+		}else{
+			std::fprintf(stderr, "%-26s %6llu ops %10.3f s %10.0f B/s  p50 %8.1f us  p99 %8.1f us  wire %llu/%llu\n",
+				w.name, (unsigned long long)result.ops, result.seconds,
+				result.seconds > 0 ? result.payload / result.seconds : 0.0,
+				percentile(result.latency_us, 50), percentile(result.latency_us, 99),
+				(unsigned long long)result.tx, (unsigned long long)result.rx);
+		}
+		results.push_back(std::move(result));
+	}
+
+	FILE *f = output.empty() ? stdout : std::fopen(output.c_str(), "w");
+	if( !f ){
+		std::fprintf(stderr, "can't open %s\n", output.c_str());
+		return 1;
+	}
+	write_json(f, hardware ? port : "sim", results);
+	if( f != stdout ){
+		std::fclose(f);
+	}
+
+	for( const Result &r : results ){
+		if( !r.error.empty() ){
+			return 1;
+		}
+	}
+	return 0;
+}
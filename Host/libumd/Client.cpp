@@ -0,0 +1,421 @@
+/*******************************************************************//**
+ *  \file Client.cpp
+ *  \author René Richard
+ *  \brief Asynchronous UMDv2 client.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "Client.h"
+#include "Crc32.h"
+
+#define POLL_MS			50			///< the receive thread checks for shutdown this often
+
+static void put(std::vector<uint8_t> &frame, const void *data, size_t len){
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	frame.insert(frame.end(), p, p + len);
+}
+
+static void put32(std::vector<uint8_t> &frame, uint32_t v){
+	put(frame, &v, sizeof(v));
+}
+
+static uint32_t load32(const uint8_t *p){
+	uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+Client::Client(Transport &transport, unsigned max_in_flight, unsigned timeout_ms) :
+	tx_bytes(0), rx_bytes(0), transport(transport), max_in_flight(std::max(1U, max_in_flight)),
+	timeout_ms(timeout_ms), stop(false), current(nullptr), to_sink(false) {
+
+	begin_field(st_header, 4);
+	reader = std::thread(&Client::receive_loop, this);
+}
+
+Client::~Client(){
+	stop = true;
+	reader.join();
+	fail_all("client closed");
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+std::future<Client::Reply> Client::submit(uint16_t cmd, const void *payload, size_t len, Sink sink){
+	std::vector<uint8_t> frame;
+	uint16_t header[2] = { cmd, (uint16_t)(4 + len + 4) };
+
+	if( len % 4 != 0 || len > UINT16_MAX - 8 ){
+		throw LinkError("regular payloads are a multiple of 4 bytes");
+	}
+	put(frame, header, sizeof(header));
+	put(frame, payload, len);
+	put32(frame, crc32_mpeg2(frame.data(), frame.size()));
+	return send(frame, sink);
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+std::future<Client::Reply> Client::submit_ext(uint16_t cmd, const void *payload, size_t len, Sink sink){
+	const uint8_t *p = static_cast<const uint8_t *>(payload);
+	std::vector<uint8_t> frame;
+	uint16_t header[2] = { (uint16_t)(cmd | USB_EXT_FRAME), USB_EXT_HEADER_SIZE };
+
+	if( len % 4 != 0 ){
+		throw LinkError("extended payloads are a multiple of 4 bytes");
+	}
+	frame.reserve(USB_EXT_HEADER_SIZE + len + 4 * (len / USB_EXT_SEGMENT_SIZE + 1));
+	put(frame, header, sizeof(header));
+	put32(frame, (uint32_t)len);
+	put32(frame, crc32_mpeg2(frame.data(), 8));
+	for( size_t pos = 0; pos < len; pos += USB_EXT_SEGMENT_SIZE ){
+		size_t n = std::min<size_t>(USB_EXT_SEGMENT_SIZE, len - pos);
+		put(frame, p + pos, n);
+		put32(frame, crc32_mpeg2(p + pos, n));
+	}
+	return send(frame, sink);
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+std::future<Client::Reply> Client::submit_chunked(uint16_t cmd, const std::vector<std::vector<uint8_t>> &chunks, Sink sink){
+	std::vector<uint8_t> frame;
+	uint16_t header[2] = { (uint16_t)(cmd | USB_EXT_FRAME), USB_EXT_HEADER_SIZE };
+
+	put(frame, header, sizeof(header));
+	put32(frame, USB_EXT_CHUNKED);
+	put32(frame, crc32_mpeg2(frame.data(), 8));
+	for( const std::vector<uint8_t> &chunk : chunks ){
+		uint32_t len = (uint32_t)chunk.size();
+		if( len == 0 || len % 4 != 0 || len > USB_EXT_CHUNK_MAX ){
+			throw LinkError("bad chunk length");
+		}
+		put32(frame, len);
+		put(frame, chunk.data(), len);
+		put32(frame, crc32_mpeg2(chunk.data(), len, crc32_mpeg2(&len, sizeof(len))));
+	}
+	put32(frame, 0);
+	return send(frame, sink);
+}
+
+/*******************************************************************//**
+ * the request is queued before it is written so its reply always finds it.
+ * A failed write only records the failure, the receive thread fails the
+ * queued requests since it may be writing a reply into one of them.
+ **********************************************************************/
+std::future<Client::Reply> Client::send(std::vector<uint8_t> &frame, Sink sink){
+	std::lock_guard<std::mutex> wire(write_lock);
+	std::unique_ptr<Pending> pending(new Pending);
+	std::future<Reply> future = pending->promise.get_future();
+
+	pending->sink = sink;
+	{
+		std::unique_lock<std::mutex> guard(queue_lock);
+		slot_free.wait(guard, [this]{ return queue.size() < max_in_flight || !failure.empty(); });
+		if( !failure.empty() ){
+			pending->promise.set_exception(std::make_exception_ptr(LinkError(failure)));
+			return future;
+		}
+		queue.push_back(std::move(pending));
+	}
+
+	try{
+		transport.write(frame.data(), frame.size());
+	}catch( const LinkError &e ){
+		std::lock_guard<std::mutex> guard(queue_lock);
+		if( failure.empty() ){
+			failure = e.what();
+		}
+		slot_free.notify_all();
+		return future;
+	}
+	tx_bytes += frame.size();
+	return future;
+}
+
+/*******************************************************************//**
+ * only called by the receive thread, or once it's stopped
+ **********************************************************************/
+void Client::fail_all(const std::string &what){
+	std::deque<std::unique_ptr<Pending>> failed;
+	{
+		std::lock_guard<std::mutex> guard(queue_lock);
+		if( failure.empty() ){
+			failure = what;
+		}
+		failed.swap(queue);
+		slot_free.notify_all();
+	}
+	for( std::unique_ptr<Pending> &pending : failed ){
+		pending->promise.set_exception(std::make_exception_ptr(LinkError(what)));
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void Client::receive_loop(void){
+	static const size_t BUFFER_SIZE = 16384;
+	std::unique_ptr<uint8_t[]> buffer(new uint8_t[BUFFER_SIZE]);
+	unsigned idle_ms = 0;
+
+	while( !stop ){
+		size_t n;
+		try{
+			n = transport.read_some(buffer.get(), BUFFER_SIZE, POLL_MS);
+		}catch( const LinkError &e ){
+			fail_all(e.what());
+			return;
+		}
+
+		bool waiting, lost;
+		std::string what;
+		{
+			std::lock_guard<std::mutex> guard(queue_lock);
+			waiting = !queue.empty();
+			lost = !failure.empty();
+			what = failure;
+		}
+
+		// past a framing error or a failed write the stream can't be trusted, bytes are dropped
+		if( lost ){
+			rx_bytes += n;
+			if( waiting ){
+				fail_all(what);
+			}
+			continue;
+		}
+
+		if( n == 0 ){
+			idle_ms = waiting ? idle_ms + POLL_MS : 0;
+			if( idle_ms >= timeout_ms ){
+				fail_all("timeout waiting for the reply");
+			}
+			continue;
+		}
+		idle_ms = 0;
+		rx_bytes += n;
+
+		try{
+			feed(buffer.get(), n);
+		}catch( const LinkError &e ){
+			fail_all(e.what());
+		}
+	}
+}
+
+/*******************************************************************//**
+ * the fixed size fields are gathered in field, payload bytes go straight
+ * to their destination
+ **********************************************************************/
+void Client::feed(const uint8_t *data, size_t len){
+	while( len != 0 ){
+		if( in_data ){
+			size_t n = std::min(len, data_left);
+			deliver(data, n);
+			crc = crc32_mpeg2(data, n, crc);
+			data += n;
+			len -= n;
+			data_left -= n;
+			if( data_left == 0 ){
+				begin_field(after_data, 4);
+			}
+		}else{
+			size_t n = std::min(len, field_need - field_len);
+			std::memcpy(&field[field_len], data, n);
+			data += n;
+			len -= n;
+			field_len += n;
+			if( field_len == field_need ){
+				field_done();
+			}
+		}
+	}
+}
+
+void Client::begin_field(e_state next, size_t need){
+	state = next;
+	in_data = false;
+	field_len = 0;
+	field_need = need;
+}
+
+/*******************************************************************//**
+ * \param next field after the data, always a 4 byte crc
+ **********************************************************************/
+void Client::begin_data(size_t len, e_state next){
+	after_data = next;
+	data_left = len;
+	in_data = true;
+	if( len == 0 ){
+		begin_field(next, 4);
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void Client::field_done(void){
+	uint16_t header[2];
+
+	switch(state){
+	case st_header:
+		std::memcpy(header, field, sizeof(header));
+		{
+			std::lock_guard<std::mutex> guard(queue_lock);
+			if( queue.empty() ){
+				throw LinkError("reply without a request");
+			}
+			current = queue.front().get();
+		}
+		reply = Reply();
+		reply.ack = header[0];
+		reply.status = 0;
+		reply.length = 0;
+		to_sink = current->sink.data != nullptr && reply.ack < UMD_REPLY_ERRORS;
+
+		if( reply.ack >= UMD_REPLY_ERRORS || !(reply.ack & USB_EXT_FRAME) ){
+			// {ack, size} payload crc, the crc covers the header and payload
+			if( header[1] < 8 ){
+				throw LinkError("reply shorter than its header");
+			}
+			crc = crc32_mpeg2(field, 4);
+			begin_data(header[1] - 8, st_crc);
+		}else{
+			reply.ack &= ~USB_EXT_FRAME;
+			begin_field(st_ext_header, 8);
+			std::memcpy(&field[0], header, 4);
+			field_len = 4;
+			field_need = 12;
+		}
+		break;
+
+	case st_ext_header:
+		// field holds the whole 12 byte header
+		if( load32(&field[8]) != crc32_mpeg2(field, 8) ){
+			throw LinkError("extended reply header crc error");
+		}
+		ext_remaining = load32(&field[4]);
+		if( ext_remaining == USB_EXT_CHUNKED ){
+			begin_field(st_chunk_len, 4);
+		}else{
+			next_segment();
+		}
+		break;
+
+	case st_crc:
+		if( load32(field) != crc ){
+			throw LinkError("reply crc error");
+		}
+		if( reply.ack == UMD_REPLY_CMD_FAILED && reply.payload.size() >= 4 ){
+			reply.status = load32(reply.payload.data());
+		}
+		complete();
+		break;
+
+	case st_segment_crc:
+		if( load32(field) != crc ){
+			throw LinkError("extended reply segment crc error");
+		}
+		ext_remaining -= segment;
+		next_segment();
+		break;
+
+	case st_chunk_len:
+		segment = load32(field);
+		if( segment == 0 ){
+			begin_field(st_trailer, 8);
+			break;
+		}
+		if( segment > USB_EXT_CHUNK_MAX ){
+			throw LinkError("extended reply chunk too long");
+		}
+		reply.chunks.push_back(segment);
+		crc = crc32_mpeg2(field, 4);
+		begin_data(segment, st_chunk_crc);
+		break;
+
+	case st_chunk_crc:
+		if( load32(field) != crc ){
+			throw LinkError("extended reply chunk crc error");
+		}
+		begin_field(st_chunk_len, 4);
+		break;
+
+	case st_trailer:
+		if( load32(&field[4]) != crc32_mpeg2(field, 4) ){
+			throw LinkError("extended reply status crc error");
+		}
+		reply.status = load32(field);
+		complete();
+		break;
+	}
+}
+
+void Client::next_segment(void){
+	if( ext_remaining == 0 ){
+		begin_field(st_trailer, 8);
+		return;
+	}
+	segment = std::min<uint32_t>(USB_EXT_SEGMENT_SIZE, ext_remaining);
+	crc = 0xFFFFFFFF;
+	begin_data(segment, st_segment_crc);
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void Client::deliver(const uint8_t *data, size_t len){
+	if( to_sink ){
+		if( reply.length + len > current->sink.capacity ){
+			throw LinkError("reply larger than its buffer");
+		}
+		std::memcpy(current->sink.data + reply.length, data, len);
+	}else{
+		reply.payload.insert(reply.payload.end(), data, data + len);
+	}
+	reply.length += len;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void Client::complete(void){
+	std::unique_ptr<Pending> done;
+	{
+		std::lock_guard<std::mutex> guard(queue_lock);
+		// requests are only failed by this thread, current is still queued
+		if( queue.empty() || queue.front().get() != current ){
+			return;
+		}
+		done = std::move(queue.front());
+		queue.pop_front();
+		slot_free.notify_all();
+	}
+	current = nullptr;
+	begin_field(st_header, 4);
+	done->promise.set_value(std::move(reply));
+}
@@ -0,0 +1,150 @@
+/*******************************************************************//**
+ *  \file Client.h
+ *  \author René Richard
+ *  \brief Asynchronous UMDv2 client. Requests are queued to the device as
+ *         soon as they're submitted, up to a number in flight, and their
+ *         replies are parsed incrementally by a receive thread as bytes
+ *         arrive. The device answers in order so the replies are matched
+ *         to the requests by position.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBUMD_CLIENT_H_
+#define LIBUMD_CLIENT_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Protocol.h"
+#include "Transport.h"
+
+/*******************************************************************//**
+ * \class Client
+ * \brief the firmware's receive buffer holds pipelined requests, see
+ *        CAP_RX_BACKPRESSURE, a few in flight hide the USB turnaround
+ **********************************************************************/
+class Client{
+public:
+
+	struct Reply{
+		uint16_t				ack;
+		uint32_t				status;				///< command return code, 0 on success
+		std::vector<uint8_t>	payload;			///< empty when the reply went to a Sink, chunked replies are concatenated
+		std::vector<size_t>		chunks;				///< length of each chunk of a chunked reply
+		size_t					length;				///< payload bytes received
+		bool ok(uint16_t cmd) const { return ack == (cmd | UMD_ACK) && status == 0; }
+	};
+
+	/*******************************************************************//**
+	 * \brief caller provided destination of a reply payload, a memory
+	 *        mapped file for instance. Error replies never go there.
+	 **********************************************************************/
+	struct Sink{
+		uint8_t					*data;
+		size_t					capacity;
+		Sink(uint8_t *data = nullptr, size_t capacity = 0) : data(data), capacity(capacity) {}
+	};
+
+	/*******************************************************************//**
+	 * \param max_in_flight requests sent before their replies arrived
+	 * \param timeout_ms longest silence while replies are expected
+	 **********************************************************************/
+	explicit Client(Transport &transport, unsigned max_in_flight = 4, unsigned timeout_ms = 5000);
+	~Client();
+
+	Client(const Client &) = delete;
+	Client &operator=(const Client &) = delete;
+
+	/*******************************************************************//**
+	 * \brief regular request, payload up to the device's buffer size
+	 **********************************************************************/
+	std::future<Reply> submit(uint16_t cmd, const void *payload = nullptr, size_t len = 0, Sink sink = Sink());
+
+	/*******************************************************************//**
+	 * \brief extended request with a payload of known size
+	 **********************************************************************/
+	std::future<Reply> submit_ext(uint16_t cmd, const void *payload, size_t len, Sink sink = Sink());
+
+	/*******************************************************************//**
+	 * \brief chunked extended request, every chunk a multiple of 4 bytes
+	 **********************************************************************/
+	std::future<Reply> submit_chunked(uint16_t cmd, const std::vector<std::vector<uint8_t>> &chunks, Sink sink = Sink());
+
+	// one request, one reply
+	Reply command(uint16_t cmd, const void *payload = nullptr, size_t len = 0){ return submit(cmd, payload, len).get(); }
+	Reply command_ext(uint16_t cmd, const void *payload, size_t len){ return submit_ext(cmd, payload, len).get(); }
+	Reply command_chunked(uint16_t cmd, const std::vector<std::vector<uint8_t>> &chunks){ return submit_chunked(cmd, chunks).get(); }
+
+	std::atomic<uint64_t> tx_bytes;
+	std::atomic<uint64_t> rx_bytes;
+
+private:
+
+	struct Pending{
+		std::promise<Reply>		promise;
+		Sink					sink;
+	};
+
+	Transport &transport;
+	unsigned max_in_flight;
+	unsigned timeout_ms;
+
+	std::mutex write_lock;					///< the queue order is the order on the wire
+	std::mutex queue_lock;
+	std::condition_variable slot_free;
+	std::deque<std::unique_ptr<Pending>> queue;
+	std::string failure;					///< once the stream is lost every request fails with this
+
+	std::thread reader;
+	std::atomic<bool> stop;
+
+	// reply parser, only touched by the receive thread
+	enum e_state {
+		st_header, st_ext_header, st_crc, st_segment_crc, st_chunk_len, st_chunk_crc, st_trailer
+	};
+	e_state state;
+	bool in_data;
+	uint8_t field[8];
+	size_t field_len, field_need;
+	size_t data_left;
+	e_state after_data;
+	uint32_t crc;
+	uint32_t ext_remaining, segment;
+	Reply reply;
+	Pending *current;
+	bool to_sink;
+
+	std::future<Reply> send(std::vector<uint8_t> &frame, Sink sink);
+	void receive_loop(void);
+	void fail_all(const std::string &what);
+
+	void feed(const uint8_t *data, size_t len);
+	void begin_field(e_state next, size_t need);
+	void begin_data(size_t len, e_state next);
+	void field_done(void);
+	void next_segment(void);
+	void deliver(const uint8_t *data, size_t len);
+	void complete(void);
+};
+
+#endif /* LIBUMD_CLIENT_H_ */
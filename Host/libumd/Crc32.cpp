@@ -0,0 +1,68 @@
+/*******************************************************************//**
+ *  \file Crc32.cpp
+ *  \author René Richard
+ *  \brief CRC32/MPEG-2, slicing-by-8.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Crc32.h"
+
+#define CRC32_POLY		0x04C11DB7U
+
+/*******************************************************************//**
+ * table[0] is the usual byte table, table[k] advances a byte through k
+ * more zero bytes so eight bytes can be folded in with independent lookups
+ **********************************************************************/
+struct CrcTables{
+	uint32_t t[8][256];
+
+	CrcTables(){
+		for( uint32_t i = 0; i < 256; i++ ){
+			uint32_t c = i << 24;
+			for( int bit = 0; bit < 8; bit++ ){
+				c = (c & 0x80000000U) ? (c << 1) ^ CRC32_POLY : (c << 1);
+			}
+			t[0][i] = c;
+		}
+		for( int k = 1; k < 8; k++ ){
+			for( uint32_t i = 0; i < 256; i++ ){
+				t[k][i] = (t[k - 1][i] << 8) ^ t[0][t[k - 1][i] >> 24];
+			}
+		}
+	}
+};
+
+static const CrcTables tables;
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint32_t crc32_mpeg2(const void *data, size_t len, uint32_t crc){
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	const uint32_t (*t)[256] = tables.t;
+
+	// the crc isn't reflected, the stream is consumed most significant byte first
+	for(; len >= 8; len -= 8, p += 8){
+		crc ^= ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+		crc = t[7][crc >> 24] ^ t[6][(crc >> 16) & 0xFF] ^ t[5][(crc >> 8) & 0xFF] ^ t[4][crc & 0xFF]
+			^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+	}
+	for(; len != 0; len--){
+		crc = (crc << 8) ^ t[0][(crc >> 24) ^ *(p++)];
+	}
+	return crc;
+}
@@ -0,0 +1,35 @@
+/*******************************************************************//**
+ *  \file Crc32.h
+ *  \author René Richard
+ *  \brief CRC32/MPEG-2 of a byte stream, what the STM32 CRC unit computes
+ *         when it is fed byte reversed words.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBUMD_CRC32_H_
+#define LIBUMD_CRC32_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/*******************************************************************//**
+ * \brief slicing-by-8, eight bytes per step through eight 1KB tables
+ * \param crc result of the previous part of the stream, to continue it
+ **********************************************************************/
+uint32_t crc32_mpeg2(const void *data, size_t len, uint32_t crc = 0xFFFFFFFF);
+
+#endif /* LIBUMD_CRC32_H_ */
@@ -0,0 +1,376 @@
+/*******************************************************************//**
+ *  \file Farm.cpp
+ *  \author René Richard
+ *  \brief Runs jobs across several UMDv2 units.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <iterator>
+#include <map>
+
+#include "Codec/Codec.h"
+#include "Crc32.h"
+#include "Farm.h"
+#include "MappedFile.h"
+
+#define FARM_REQUEST_SIZE	0x10000		///< bytes per read or program request
+#define FARM_SECTOR_SIZE	0x10000		///< granularity of sync image
+#define FARM_IN_FLIGHT		4
+#define SYNC_ERASE			0x0001
+
+static void expect(const Client::Reply &reply, uint16_t cmd){
+	if( !reply.ok(cmd) ){
+		char msg[64];
+		std::snprintf(msg, sizeof(msg), "0x%04X failed, ack 0x%04X status %u", cmd, reply.ack, reply.status);
+		throw LinkError(msg);
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+Farm::~Farm(){
+	finish();
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint32_t Farm::attach(std::unique_ptr<Transport> transport){
+	std::unique_ptr<Worker> w(new Worker);
+	uint32_t id = 0;
+
+	w->client.reset(new Client(*transport, FARM_IN_FLIGHT));
+	w->unit.name = transport->name();
+	w->transport = std::move(transport);
+
+	Client::Reply reply = w->client->command(0x000D);
+	expect(reply, 0x000D);
+	if( reply.payload.size() < 22 ){
+		throw LinkError(w->unit.name + ": short capabilities reply");
+	}
+	w->unit.bus_size = reply.payload[21];
+
+	// firmware without 0x0016 answers NO_ACK, it gets an id like a fresh unit
+	reply = w->client->command(0x0016);
+	if( reply.ok(0x0016) && reply.payload.size() >= 4 ){
+		std::memcpy(&id, reply.payload.data(), 4);
+	}
+	bool taken = std::any_of(workers.begin(), workers.end(), [id](const std::unique_ptr<Worker> &other){ return other->unit.id == id; });
+	if( id == 0 || taken ){
+		id = next_id;
+		expect(w->client->command(0x0003, &id, sizeof(id)), 0x0003);
+	}
+	next_id = std::max(next_id, id + 1);
+
+	w->unit.id = id;
+	w->unit.jobs = w->unit.stolen = w->unit.bytes = w->unit.busy_ns = w->unit.elapsed_ns = 0;
+	w->first_ns = w->last_ns = 0;
+	workers.push_back(std::move(w));
+	return id;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+bool Farm::submit(const Job &job){
+	Worker *target = nullptr;
+	size_t least = SIZE_MAX;
+
+	for( std::unique_ptr<Worker> &w : workers ){
+		if( !fits(w->unit, job) ){
+			continue;
+		}
+		std::lock_guard<std::mutex> guard(w->lock);
+		if( w->jobs.size() < least ){
+			least = w->jobs.size();
+			target = w.get();
+		}
+	}
+	if( !target ){
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> guard(target->lock);
+		target->jobs.push_back(job);
+	}
+	{
+		std::lock_guard<std::mutex> guard(idle_lock);
+		queued++;
+	}
+	work_ready.notify_all();
+	return true;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void Farm::start(void){
+	for( std::unique_ptr<Worker> &w : workers ){
+		Worker *self = w.get();
+		w->thread = std::thread([this, self]{ run(*self); });
+	}
+}
+
+void Farm::finish(void){
+	{
+		std::lock_guard<std::mutex> guard(idle_lock);
+		closed = true;
+	}
+	work_ready.notify_all();
+	for( std::unique_ptr<Worker> &w : workers ){
+		if( w->thread.joinable() ){
+			w->thread.join();
+		}
+	}
+}
+
+/*******************************************************************//**
+ * own queue first, oldest job first, then the newest job another unit
+ * queued that this one can run
+ **********************************************************************/
+bool Farm::take(Worker &self, Job &job, bool &stolen){
+	bool found = false;
+	{
+		std::lock_guard<std::mutex> guard(self.lock);
+		if( !self.jobs.empty() ){
+			job = std::move(self.jobs.front());
+			self.jobs.pop_front();
+			stolen = false;
+			found = true;
+		}
+	}
+
+	size_t start = std::find_if(workers.begin(), workers.end(), [&self](const std::unique_ptr<Worker> &w){ return w.get() == &self; }) - workers.begin();
+	for( size_t i = 1; !found && i < workers.size(); i++ ){
+		Worker &victim = *workers[(start + i) % workers.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		for( auto it = victim.jobs.rbegin(); it != victim.jobs.rend(); ++it ){
+			if( fits(self.unit, *it) ){
+				job = std::move(*it);
+				victim.jobs.erase(std::next(it).base());
+				stolen = true;
+				found = true;
+				break;
+			}
+		}
+	}
+
+	if( found ){
+		std::lock_guard<std::mutex> guard(idle_lock);
+		queued--;
+	}
+	return found;
+}
+
+/*******************************************************************//**
+ * I/O thread of a unit
+ **********************************************************************/
+void Farm::run(Worker &self){
+	for(;;){
+		Job job;
+		bool stolen;
+
+		if( !take(self, job, stolen) ){
+			std::unique_lock<std::mutex> guard(idle_lock);
+			if( closed && queued == 0 ){
+				return;
+			}
+			// a job this unit can't run may stay queued, recheck now and then
+			work_ready.wait_for(guard, std::chrono::milliseconds(100));
+			continue;
+		}
+
+		Outcome outcome;
+		outcome.label = job.label;
+		outcome.kind = job.kind;
+		outcome.unit = self.unit.id;
+		outcome.stolen = stolen;
+		outcome.bytes = 0;
+
+		uint64_t start = self.transport->now_ns();
+		try{
+			outcome.bytes = execute(self, job);
+		}catch( const std::exception &e ){
+			outcome.error = e.what();
+		}
+		uint64_t end = self.transport->now_ns();
+		outcome.seconds = (end - start) / 1e9;
+
+		if( self.unit.jobs == 0 ){
+			self.first_ns = start;
+		}
+		self.last_ns = end;
+		self.unit.jobs++;
+		self.unit.stolen += stolen;
+		self.unit.bytes += outcome.bytes;
+		self.unit.busy_ns += end - start;
+		self.unit.elapsed_ns = self.last_ns - self.first_ns;
+
+		std::lock_guard<std::mutex> guard(results_lock);
+		results.push_back(outcome);
+	}
+}
+
+/*******************************************************************//**
+ * \return bytes dumped, or of the image burnt or verified
+ **********************************************************************/
+uint64_t Farm::execute(Worker &self, const Job &job){
+	Client &umd = *self.client;
+
+	if( job.kind == job_dump ){
+		std::unique_ptr<MappedFile> file;
+		std::vector<uint8_t> scratch;
+		uint8_t *dst;
+		if( job.size % 4 != 0 ){
+			throw LinkError("dump size must be a multiple of 4");
+		}
+		if( !job.output.empty() ){
+			file.reset(new MappedFile(job.output, job.size));
+			dst = file->data();
+		}else{
+			scratch.resize(job.size);
+			dst = scratch.data();
+		}
+
+		// the client keeps FARM_IN_FLIGHT requests queued on the unit
+		std::deque<std::future<Client::Reply>> in_flight;
+		for( uint32_t address = 0; address < job.size; address += FARM_REQUEST_SIZE ){
+			uint32_t request[2] = { address, std::min<uint32_t>(FARM_REQUEST_SIZE, job.size - address) };
+			in_flight.push_back(umd.submit(0x000B, request, sizeof(request), Client::Sink(dst + address, request[1])));
+			if( in_flight.size() == FARM_IN_FLIGHT ){
+				expect(in_flight.front().get(), 0x000B);
+				in_flight.pop_front();
+			}
+		}
+		for( ; !in_flight.empty(); in_flight.pop_front() ){
+			expect(in_flight.front().get(), 0x000B);
+		}
+		return job.size;
+	}
+
+	// burn and verify start from the sectors that don't match the image
+	const std::vector<uint8_t> &image = *job.image;
+	uint16_t count = (uint16_t)((image.size() + FARM_SECTOR_SIZE - 1) / FARM_SECTOR_SIZE);
+	auto sync = [&](uint16_t flags, std::vector<uint32_t> &bitmap){
+		std::vector<uint32_t> request = { 0, FARM_SECTOR_SIZE, (uint32_t)count | ((uint32_t)flags << 16) };
+		for( uint32_t i = 0; i < count; i++ ){
+			size_t len = std::min<size_t>(FARM_SECTOR_SIZE, image.size() - i * FARM_SECTOR_SIZE);
+			std::vector<uint8_t> sector(FARM_SECTOR_SIZE, 0xFF);
+			std::memcpy(sector.data(), &image[i * FARM_SECTOR_SIZE], len);
+			request.push_back(crc32_mpeg2(sector.data(), sector.size()));
+		}
+		Client::Reply reply = umd.command(0x0010, request.data(), request.size() * 4);
+		expect(reply, 0x0010);
+		uint16_t mismatched;
+		std::memcpy(&mismatched, reply.payload.data(), sizeof(mismatched));
+		bitmap.assign((count + 31) / 32, 0);
+		std::memcpy(bitmap.data(), &reply.payload[4], bitmap.size() * 4);
+		return mismatched;
+	};
+
+	std::vector<uint32_t> bitmap;
+	if( job.kind == job_verify ){
+		if( sync(0, bitmap) != 0 ){
+			throw LinkError("flash doesn't match the image");
+		}
+		return image.size();
+	}
+
+	std::unique_ptr<Codec> codec(new Codec);
+	uint32_t block[CODEC_MAX_BLOCK / 4];
+	uint8_t raw[CODEC_BLOCK_SIZE];
+	std::deque<std::future<Client::Reply>> in_flight;
+	auto chunk = [&](uint32_t address){
+		std::fill(raw, raw + sizeof(raw), 0xFF);
+		if( address < image.size() ){
+			std::memcpy(raw, &image[address], std::min<size_t>(CODEC_BLOCK_SIZE, image.size() - address));
+		}
+		uint16_t n = codec->encode(raw, CODEC_BLOCK_SIZE, reinterpret_cast<uint8_t *>(block));
+		std::vector<uint8_t> bytes(4 + n);
+		std::memcpy(&bytes[0], &address, 4);
+		std::memcpy(&bytes[4], block, n);
+		return bytes;
+	};
+
+	// a board with several chips programs them at once when a request alternates between them,
+	// firmware without 0x0017 is taken for a single chip
+	uint32_t chip_size = 0;
+	Client::Reply geometry = umd.command(0x0017);
+	if( geometry.ok(0x0017) && geometry.payload.size() >= sizeof(FlashGeometry) ){
+		FlashGeometry g;
+		std::memcpy(&g, geometry.payload.data(), sizeof(g));
+		if( g.chips > 1 && g.size != 0 ){
+			chip_size = g.size;
+		}
+	}
+
+	sync(SYNC_ERASE, bitmap);
+	std::map<uint32_t, std::deque<uint32_t>> per_chip;
+	for( uint32_t sector = 0; sector < count; sector++ ){
+		if( bitmap[sector >> 5] & (1U << (sector & 31)) ){
+			per_chip[chip_size ? sector * FARM_SECTOR_SIZE / chip_size : 0].push_back(sector);
+		}
+	}
+	while( !per_chip.empty() ){
+		// a sector from each chip, their blocks in turn
+		std::vector<uint32_t> sectors;
+		for( auto it = per_chip.begin(); it != per_chip.end(); ){
+			sectors.push_back(it->second.front());
+			it->second.pop_front();
+			it = it->second.empty() ? per_chip.erase(it) : std::next(it);
+		}
+		std::vector<std::vector<uint8_t>> chunks;
+		for( uint32_t offset = 0; offset < FARM_SECTOR_SIZE; offset += CODEC_BLOCK_SIZE ){
+			for( uint32_t sector : sectors ){
+				chunks.push_back(chunk(sector * FARM_SECTOR_SIZE + offset));
+			}
+		}
+		in_flight.push_back(umd.submit_chunked(0x000F, chunks));
+		if( in_flight.size() == FARM_IN_FLIGHT ){
+			expect(in_flight.front().get(), 0x000F);
+			in_flight.pop_front();
+		}
+	}
+	for( ; !in_flight.empty(); in_flight.pop_front() ){
+		expect(in_flight.front().get(), 0x000F);
+	}
+	if( sync(0, bitmap) != 0 ){
+		throw LinkError("flash doesn't match the image after programming");
+	}
+	return image.size();
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+std::vector<Farm::Outcome> Farm::outcomes(void){
+	std::lock_guard<std::mutex> guard(results_lock);
+	return results;
+}
+
+std::vector<Farm::Unit> Farm::units(void) const {
+	std::vector<Farm::Unit> list;
+	for( const std::unique_ptr<Worker> &w : workers ){
+		list.push_back(w->unit);
+	}
+	return list;
+}
@@ -0,0 +1,136 @@
+/*******************************************************************//**
+ *  \file Farm.h
+ *  \author René Richard
+ *  \brief Runs dump, burn and verify jobs across several UMDv2 units. Every
+ *         unit is driven by its own I/O thread with its own queue of jobs,
+ *         an idle unit steals jobs it can run from the back of the others'.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBUMD_FARM_H_
+#define LIBUMD_FARM_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Client.h"
+
+/*******************************************************************//**
+ * \class Farm
+ * \brief units are told apart by the id the host assigns them with
+ *        command 0x0003, it survives until the unit is reset
+ **********************************************************************/
+class Farm{
+public:
+
+	enum e_job : uint8_t {
+		job_dump, job_burn, job_verify
+	};
+
+	struct Job{
+		e_job					kind;
+		uint8_t					bus_size;		///< adapter the job needs, 8 or 16 bits, 0 for any
+		uint32_t				size;			///< dump size in bytes
+		std::string				output;			///< dump destination, discarded if empty
+		std::shared_ptr<const std::vector<uint8_t>>	image;	///< burn and verify
+		std::string				label;
+	};
+
+	struct Outcome{
+		std::string				label;
+		e_job					kind;
+		uint32_t				unit;			///< id of the unit that ran it
+		bool					stolen;
+		uint64_t				bytes;
+		double					seconds;
+		std::string				error;			///< empty on success
+	};
+
+	struct Unit{
+		uint32_t				id;
+		std::string				name;
+		uint8_t					bus_size;
+		uint64_t				jobs;
+		uint64_t				stolen;
+		uint64_t				bytes;
+		uint64_t				busy_ns;
+		uint64_t				elapsed_ns;		///< first job start to last job end, on the unit's clock
+	};
+
+	Farm() {}
+	~Farm();
+
+	/*******************************************************************//**
+	 * \brief add a unit, it keeps its id unless it has none or another
+	 *        unit has it
+	 * \return the unit's id
+	 **********************************************************************/
+	uint32_t attach(std::unique_ptr<Transport> transport);
+
+	/*******************************************************************//**
+	 * \brief queue a job on the least loaded unit that can run it
+	 * \return false if no unit has the adapter the job needs
+	 **********************************************************************/
+	bool submit(const Job &job);
+
+	void start(void);
+
+	/*******************************************************************//**
+	 * \brief no more jobs, wait for the queued ones
+	 **********************************************************************/
+	void finish(void);
+
+	std::vector<Outcome> outcomes(void);
+	std::vector<Unit> units(void) const;
+
+private:
+
+	struct Worker{
+		Unit					unit;
+		std::unique_ptr<Transport>	transport;
+		std::unique_ptr<Client>		client;
+		std::mutex				lock;
+		std::deque<Job>			jobs;
+		std::thread				thread;
+		uint64_t				first_ns, last_ns;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	uint32_t next_id = 1;
+
+	std::mutex idle_lock;
+	std::condition_variable work_ready;
+	size_t queued = 0;						///< jobs in all the queues, under idle_lock
+	bool closed = false;
+
+	std::mutex results_lock;
+	std::vector<Outcome> results;
+
+	bool take(Worker &self, Job &job, bool &stolen);
+	void run(Worker &self);
+	uint64_t execute(Worker &self, const Job &job);
+
+	static bool fits(const Unit &unit, const Job &job){ return job.bus_size == 0 || job.bus_size == unit.bus_size; }
+};
+
+#endif /* LIBUMD_FARM_H_ */
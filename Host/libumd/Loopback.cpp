@@ -0,0 +1,58 @@
+/*******************************************************************//**
+ *  \file Loopback.cpp
+ *  \author René Richard
+ *  \brief In-process transport to a device model.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "Loopback.h"
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void LoopbackTransport::write(const uint8_t *data, size_t len){
+	std::lock_guard<std::mutex> guard(lock);
+
+	reply.clear();
+	device.receive(data, len, reply);
+	if( !reply.empty() ){
+		pending.insert(pending.end(), reply.begin(), reply.end());
+		ready.notify_all();
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+size_t LoopbackTransport::read_some(uint8_t *data, size_t max, unsigned timeout_ms){
+	std::unique_lock<std::mutex> guard(lock);
+
+	if( !ready.wait_for(guard, std::chrono::milliseconds(timeout_ms), [this]{ return !pending.empty(); }) ){
+		return 0;
+	}
+	size_t n = std::min(max, pending.size());
+	std::copy(pending.begin(), pending.begin() + n, data);
+	pending.erase(pending.begin(), pending.begin() + n);
+	return n;
+}
+
+uint64_t LoopbackTransport::now_ns(void){
+	std::lock_guard<std::mutex> guard(lock);
+	return device.now_ns();
+}
@@ -0,0 +1,84 @@
+/*******************************************************************//**
+ *  \file Loopback.h
+ *  \author René Richard
+ *  \brief In-process transport to a device model, for testing the host side
+ *         without hardware.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBUMD_LOOPBACK_H_
+#define LIBUMD_LOOPBACK_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Transport.h"
+
+/*******************************************************************//**
+ * \class LoopbackDevice
+ * \brief device side of a LoopbackTransport, single threaded, the
+ *        transport serializes the calls
+ **********************************************************************/
+class LoopbackDevice{
+public:
+	virtual ~LoopbackDevice() {}
+
+	/*******************************************************************//**
+	 * \brief request bytes from the host, in pieces of any size
+	 * \param reply bytes to send back are appended here
+	 **********************************************************************/
+	virtual void receive(const uint8_t *data, size_t len, std::vector<uint8_t> &reply) = 0;
+
+	virtual uint64_t now_ns(void){
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+};
+
+/*******************************************************************//**
+ * \class LoopbackTransport
+ * \brief replies are queued as the device produces them, read_some()
+ *        blocks on them like it would on a tty
+ **********************************************************************/
+class LoopbackTransport : public Transport{
+public:
+	explicit LoopbackTransport(LoopbackDevice &device) : device(device) {}
+
+	/*******************************************************************//**
+	 * \brief the transport owns the device, for farms of simulated units
+	 **********************************************************************/
+	explicit LoopbackTransport(std::unique_ptr<LoopbackDevice> device) : owned(std::move(device)), device(*owned) {}
+
+	void write(const uint8_t *data, size_t len) override;
+	size_t read_some(uint8_t *data, size_t max, unsigned timeout_ms) override;
+	uint64_t now_ns(void) override;
+	std::string name(void) const override { return "loopback"; }
+
+private:
+	std::unique_ptr<LoopbackDevice> owned;
+	LoopbackDevice &device;
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<uint8_t> pending;
+	std::vector<uint8_t> reply;
+};
+
+#endif /* LIBUMD_LOOPBACK_H_ */
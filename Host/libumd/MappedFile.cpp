@@ -0,0 +1,68 @@
+/*******************************************************************//**
+ *  \file MappedFile.cpp
+ *  \author René Richard
+ *  \brief Output file mapped in memory.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "MappedFile.h"
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+MappedFile::MappedFile(const std::string &path, size_t size) : base(nullptr), length(size) {
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if( fd < 0 ){
+		throw LinkError(path + ": " + std::strerror(errno));
+	}
+	if( ::ftruncate(fd, size) != 0 ){
+		::close(fd);
+		throw LinkError(path + ": " + std::strerror(errno));
+	}
+	if( size != 0 ){
+		void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if( p == MAP_FAILED ){
+			::close(fd);
+			throw LinkError(path + ": " + std::strerror(errno));
+		}
+		base = static_cast<uint8_t *>(p);
+	}
+}
+
+MappedFile::~MappedFile(){
+	if( base ){
+		::munmap(base, length);
+	}
+	::close(fd);
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+Client::Sink MappedFile::sink(size_t offset, size_t len){
+	if( offset > length || len > length - offset ){
+		throw LinkError("sink outside of the mapped file");
+	}
+	return Client::Sink(base + offset, len);
+}
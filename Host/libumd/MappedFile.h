@@ -0,0 +1,55 @@
+/*******************************************************************//**
+ *  \file MappedFile.h
+ *  \author René Richard
+ *  \brief Output file mapped in memory, dumps are received straight into it.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBUMD_MAPPEDFILE_H_
+#define LIBUMD_MAPPEDFILE_H_
+
+#include <string>
+
+#include "Client.h"
+
+/*******************************************************************//**
+ * \class MappedFile
+ * \brief creates or truncates the file to its final size and maps it
+ **********************************************************************/
+class MappedFile{
+public:
+	MappedFile(const std::string &path, size_t size);
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	uint8_t *data(void){ return base; }
+	size_t size(void) const { return length; }
+
+	/*******************************************************************//**
+	 * \brief destination of a reply holding bytes [offset, offset + len)
+	 **********************************************************************/
+	Client::Sink sink(size_t offset, size_t len);
+
+private:
+	int fd;
+	uint8_t *base;
+	size_t length;
+};
+
+#endif /* LIBUMD_MAPPEDFILE_H_ */
@@ -0,0 +1,60 @@
+/*******************************************************************//**
+ *  \file Protocol.h
+ *  \author René Richard
+ *  \brief Framing constants of the UMDv2 protocol the firmware doesn't export.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBUMD_PROTOCOL_H_
+#define LIBUMD_PROTOCOL_H_
+
+#include <cstdint>
+
+#include "USB.h"		// USB_EXT_xxx, shared with the firmware
+
+#define UMD_ACK						0x4000		///< added to the command word of a successful reply
+#define UMD_REPLY_ERRORS			0xFFF0		///< acks from here up are error replies
+#define UMD_REPLY_NO_ACK			0xFFFF
+#define UMD_REPLY_CMD_FAILED		0xFFFE		///< followed by the command's return code
+#define UMD_REPLY_CRC_ERROR			0xFFFC
+#define UMD_REPLY_PAYLOAD_SIZE_ERROR	0xFFFB
+
+/*******************************************************************//**
+ * \brief reply of command 0x0017, laid out like the firmware's
+ *        Cartridge::s_flash_geometry. Sizes are of one chip.
+ **********************************************************************/
+struct FlashGeometry{
+	uint32_t	size;
+	uint16_t	write_buffer;
+	uint8_t		source;
+	uint8_t		region_count;
+	struct{
+		uint32_t	sector_size;
+		uint32_t	sectors;
+	} region[4];
+	uint32_t	program_typ_us, program_max_us;
+	uint32_t	buffer_typ_us, buffer_max_us;
+	uint32_t	erase_typ_ms, erase_max_ms;
+	uint32_t	chip_erase_typ_ms, chip_erase_max_ms;
+	uint8_t		chips;
+	uint8_t		flags;			///< 0x01 erase suspend
+	uint8_t		page_words;		///< bus words of a page mode read, 0 without page mode
+	uint8_t		reserved[1];
+};
+static_assert(sizeof(FlashGeometry) == 76, "the geometry reply is 76 bytes");
+
+#endif /* LIBUMD_PROTOCOL_H_ */
@@ -0,0 +1,106 @@
+/*******************************************************************//**
+ *  \file SerialTransport.cpp
+ *  \author René Richard
+ *  \brief Transport over the CDC tty of a real UMDv2.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "SerialTransport.h"
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+SerialTransport::SerialTransport(const std::string &port) : port(port) {
+	struct termios tio;
+
+	fd = ::open(port.c_str(), O_RDWR | O_NOCTTY);
+	if( fd < 0 ){
+		throw LinkError(port + ": " + std::strerror(errno));
+	}
+	if( tcgetattr(fd, &tio) != 0 ){
+		::close(fd);
+		throw LinkError(port + ": not a tty");
+	}
+	cfmakeraw(&tio);
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	tcsetattr(fd, TCSANOW, &tio);
+	tcflush(fd, TCIOFLUSH);
+}
+
+SerialTransport::~SerialTransport(){
+	::close(fd);
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void SerialTransport::write(const uint8_t *data, size_t len){
+	while( len != 0 ){
+		ssize_t n = ::write(fd, data, len);
+		if( n < 0 ){
+			if( errno == EINTR || errno == EAGAIN ){
+				continue;
+			}
+			throw LinkError(port + ": " + std::strerror(errno));
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+size_t SerialTransport::read_some(uint8_t *data, size_t max, unsigned timeout_ms){
+	struct pollfd pfd = { fd, POLLIN, 0 };
+
+	for(;;){
+		int ready = ::poll(&pfd, 1, (int)timeout_ms);
+		if( ready < 0 && errno == EINTR ){
+			continue;
+		}
+		if( ready <= 0 ){
+			return 0;
+		}
+		ssize_t n = ::read(fd, data, max);
+		if( n < 0 ){
+			if( errno == EINTR || errno == EAGAIN ){
+				continue;
+			}
+			throw LinkError(port + ": " + std::strerror(errno));
+		}
+		return n;
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint64_t SerialTransport::now_ns(void){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
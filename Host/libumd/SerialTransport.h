@@ -0,0 +1,46 @@
+/*******************************************************************//**
+ *  \file SerialTransport.h
+ *  \author René Richard
+ *  \brief Transport over the CDC tty of a real UMDv2.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBUMD_SERIALTRANSPORT_H_
+#define LIBUMD_SERIALTRANSPORT_H_
+
+#include "Transport.h"
+
+/*******************************************************************//**
+ * \class SerialTransport
+ * \brief raw POSIX tty, the baud rate means nothing to a CDC device
+ **********************************************************************/
+class SerialTransport : public Transport{
+public:
+	explicit SerialTransport(const std::string &port);
+	~SerialTransport() override;
+
+	void write(const uint8_t *data, size_t len) override;
+	size_t read_some(uint8_t *data, size_t max, unsigned timeout_ms) override;
+	uint64_t now_ns(void) override;
+	std::string name(void) const override { return port; }
+
+private:
+	std::string port;
+	int fd;
+};
+
+#endif /* LIBUMD_SERIALTRANSPORT_H_ */
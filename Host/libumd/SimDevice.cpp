@@ -0,0 +1,569 @@
+/*******************************************************************//**
+ *  \file SimDevice.cpp
+ *  \author René Richard
+ *  \brief Simulated UMDv2 with a flash cartridge.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "Crc32.h"
+#include "Protocol.h"
+#include "SimDevice.h"
+
+#define CMD_FAIL					1
+#define REQUEST_PAYLOAD_MAX			8192		///< UMD_BUFER_SIZE
+
+static uint32_t load32(const uint8_t *p){ uint32_t v; std::memcpy(&v, p, 4); return v; }
+static uint16_t load16(const uint8_t *p){ uint16_t v; std::memcpy(&v, p, 2); return v; }
+
+template<typename T>
+static void append(std::vector<uint8_t> &v, T value){
+	const uint8_t *p = reinterpret_cast<const uint8_t *>(&value);
+	v.insert(v.end(), p, p + sizeof(T));
+	// every field is padded to a uint32_t like the Serializer does
+	while( v.size() % 4 != 0 ){
+		v.push_back(0);
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+SimDevice::SimDevice(e_cart cart, const std::vector<uint8_t> &image, const Timing &timing) :
+	cart(cart), rom(image), timing(timing) {}
+
+SimDevice::SimDevice(e_cart cart, const std::vector<uint8_t> &image) :
+	SimDevice(cart, image, Timing()) {}
+
+/*******************************************************************//**
+ * every complete request is executed as soon as it is received
+ **********************************************************************/
+void SimDevice::receive(const uint8_t *data, size_t len, std::vector<uint8_t> &reply){
+	Request req;
+
+	reply_bytes = &reply;
+	in.insert(in.end(), data, data + len);
+	while( parse(req) ){
+		size_t queued = reply.size();
+		device_ns = 0;
+		overlapped = false;
+
+		execute(req);
+
+		double link_ns = (double)(req.wire_len + reply.size() - queued) * 1e9 / timing.link_bytes_per_s;
+		clock_ns += timing.turnaround_ns;
+		clock_ns += overlapped ? std::max<uint64_t>((uint64_t)link_ns, device_ns) : (uint64_t)link_ns + device_ns;
+	}
+}
+
+/*******************************************************************//**
+ * \return false until a whole request has been received
+ **********************************************************************/
+bool SimDevice::parse(Request &req){
+	size_t pos;
+	uint32_t len;
+
+	if( in.size() < 4 ){
+		return false;
+	}
+	req.cmd = load16(&in[0]);
+	req.ext = (req.cmd & USB_EXT_FRAME) != 0;
+	req.payload.clear();
+	req.chunks.clear();
+
+	if( !req.ext ){
+		// same steps as UMD::listen(), the size is checked before anything else
+		uint32_t data_size = (uint32_t)(uint16_t)(load16(&in[2]) - 8);
+		if( data_size > REQUEST_PAYLOAD_MAX ){
+			// the firmware flushes its rx buffer, pipelined requests go with it
+			req.cmd = UMD_REPLY_PAYLOAD_SIZE_ERROR;
+			req.wire_len = in.size();
+			in.clear();
+			return true;
+		}
+		// the payload is taken once at least data_size bytes follow the header,
+		// its crc and a pipelined request may already be buffered behind it
+		size_t available = in.size() - 4;
+		if( available < data_size ){
+			return false;
+		}
+		req.payload.assign(in.begin() + 4, in.begin() + 4 + data_size);
+		pos = 4 + data_size;
+		// then the crc on its own
+		if( in.size() - pos < 4 ){
+			return false;
+		}
+		if( crc32_mpeg2(in.data(), pos) != load32(&in[pos]) ){
+			req.cmd = UMD_REPLY_CRC_ERROR;
+		}
+		pos += 4;
+	}else{
+		if( in.size() < USB_EXT_HEADER_SIZE ){
+			return false;
+		}
+		len = load32(&in[4]);
+		bool crc_ok = crc32_mpeg2(in.data(), 8) == load32(&in[8]);
+		pos = USB_EXT_HEADER_SIZE;
+
+		if( len == USB_EXT_CHUNKED ){
+			for(;;){
+				if( in.size() < pos + 4 ){
+					return false;
+				}
+				uint32_t chunk_len = load32(&in[pos]);
+				if( chunk_len == 0 ){
+					pos += 4;
+					break;
+				}
+				if( in.size() < pos + 4 + chunk_len + 4 ){
+					return false;
+				}
+				crc_ok = crc_ok && crc32_mpeg2(&in[pos], 4 + chunk_len) == load32(&in[pos + 4 + chunk_len]);
+				req.chunks.emplace_back(in.begin() + pos + 4, in.begin() + pos + 4 + chunk_len);
+				pos += 4 + chunk_len + 4;
+			}
+		}else{
+			size_t total = pos + len + 4 * ((len + USB_EXT_SEGMENT_SIZE - 1) / USB_EXT_SEGMENT_SIZE);
+			if( in.size() < total ){
+				return false;
+			}
+			for( uint32_t done = 0; done < len; ){
+				uint32_t n = std::min<uint32_t>(USB_EXT_SEGMENT_SIZE, len - done);
+				crc_ok = crc_ok && crc32_mpeg2(&in[pos], n) == load32(&in[pos + n]);
+				req.payload.insert(req.payload.end(), in.begin() + pos, in.begin() + pos + n);
+				pos += n + 4;
+				done += n;
+			}
+		}
+		if( !crc_ok ){
+			req.cmd = UMD_REPLY_CRC_ERROR;
+		}
+	}
+
+	req.wire_len = pos;
+	in.erase(in.begin(), in.begin() + pos);
+	return true;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void SimDevice::emit(const void *data, size_t len){
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	reply_bytes->insert(reply_bytes->end(), p, p + len);
+}
+
+void SimDevice::reply(uint16_t ack, const std::vector<uint8_t> &payload){
+	std::vector<uint8_t> frame;
+	append<uint16_t>(frame, 0);
+	uint16_t header[2] = { ack, (uint16_t)(4 + payload.size() + 4) };
+	std::memcpy(frame.data(), header, 4);
+	frame.insert(frame.end(), payload.begin(), payload.end());
+	uint32_t crc = crc32_mpeg2(frame.data(), frame.size());
+	emit(frame.data(), frame.size());
+	emit32(crc);
+}
+
+void SimDevice::reply_ext(uint16_t ack, const std::vector<uint8_t> &payload, uint32_t status){
+	uint32_t header[2] = { (uint32_t)(ack | USB_EXT_FRAME) | ((uint32_t)USB_EXT_HEADER_SIZE << 16), (uint32_t)payload.size() };
+
+	emit(header, sizeof(header));
+	emit32(crc32_mpeg2(header, sizeof(header)));
+	for( size_t pos = 0; pos < payload.size(); pos += USB_EXT_SEGMENT_SIZE ){
+		size_t n = std::min<size_t>(USB_EXT_SEGMENT_SIZE, payload.size() - pos);
+		emit(&payload[pos], n);
+		emit32(crc32_mpeg2(&payload[pos], n));
+	}
+	emit32(status);
+	emit32(crc32_mpeg2(&status, sizeof(status)));
+}
+
+void SimDevice::reply_chunked(uint16_t ack, const std::vector<std::vector<uint8_t>> &chunks, uint32_t status){
+	uint32_t header[2] = { (uint32_t)(ack | USB_EXT_FRAME) | ((uint32_t)USB_EXT_HEADER_SIZE << 16), USB_EXT_CHUNKED };
+
+	emit(header, sizeof(header));
+	emit32(crc32_mpeg2(header, sizeof(header)));
+	for( const std::vector<uint8_t> &chunk : chunks ){
+		uint32_t len = (uint32_t)chunk.size();
+		emit32(len);
+		emit(chunk.data(), len);
+		emit32(crc32_mpeg2(chunk.data(), len, crc32_mpeg2(&len, sizeof(len))));
+	}
+	emit32(0);
+	emit32(status);
+	emit32(crc32_mpeg2(&status, sizeof(status)));
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint64_t SimDevice::read_ns(size_t len) const {
+	double rate = (cart == cart_genesis) ? timing.read_bytes_per_s_16 : timing.read_bytes_per_s_8;
+	return (uint64_t)((double)len * 1e9 / rate);
+}
+
+/*******************************************************************//**
+ * flash bits only go from 1 to 0, erased bus words are skipped like
+ * Cartridge::program_range() does. The caller accounts for the time.
+ * \return bytes programmed
+ **********************************************************************/
+uint32_t SimDevice::program(uint32_t address, const uint8_t *data, size_t len){
+	size_t unit = (cart == cart_genesis) ? 2 : 1;
+	uint32_t programmed = 0;
+
+	for( size_t i = 0; i + unit <= len && address + i + unit <= rom.size(); i += unit ){
+		bool erased = data[i] == 0xFF && (unit == 1 || data[i + 1] == 0xFF);
+		if( erased ){
+			continue;
+		}
+		for( size_t b = 0; b < unit; b++ ){
+			rom[address + i + b] &= data[i + b];
+		}
+		programmed += unit;
+	}
+	return programmed;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void SimDevice::execute(const Request &req){
+	uint16_t cmd = req.cmd & ~USB_EXT_FRAME;
+	uint16_t ack = cmd | UMD_ACK;
+	std::vector<uint8_t> out;
+	const std::vector<uint8_t> &p = req.payload;
+
+	if( req.cmd == UMD_REPLY_CRC_ERROR || req.cmd == UMD_REPLY_PAYLOAD_SIZE_ERROR ){
+		reply(req.cmd, out);
+		return;
+	}
+	// only loopback, program range and erase and program take extended requests
+	if( req.ext && cmd != 0x000C && cmd != 0x000F && cmd != 0x0018 ){
+		reply(UMD_REPLY_PAYLOAD_SIZE_ERROR, out);
+		return;
+	}
+
+	switch(cmd){
+	case 0x0003:
+		if( p.size() != 4 ){
+			reply(UMD_REPLY_PAYLOAD_SIZE_ERROR, out);
+			break;
+		}
+		pc_assigned_id = load32(&p[0]);
+		reply(ack, out);
+		break;
+
+	case 0x0004:{
+		const char version[] = "UMD v2.0.0.0 sim";
+		out.assign(version, version + sizeof(version));
+		while( out.size() % 4 != 0 ){
+			out.push_back(0);
+		}
+		reply(ack, out);
+		break;
+	}
+
+	case 0x0008:
+		append<uint8_t>(out, 0xC2);
+		append<uint8_t>(out, (cart == cart_genesis) ? 0xD6 : 0xA4);
+		append<uint32_t>(out, (uint32_t)rom.size());
+		reply(ack, out);
+		break;
+
+	case 0x000B:{
+		if( p.size() != 8 ){
+			reply(UMD_REPLY_PAYLOAD_SIZE_ERROR, out);
+			break;
+		}
+		uint32_t address = load32(&p[0]), size = load32(&p[4]);
+		out.assign((size + 3) & ~3U, 0);
+		for( uint32_t i = 0; i < size && address + i < rom.size(); i++ ){
+			out[i] = rom[address + i];
+		}
+		device_ns = read_ns(size);
+		overlapped = true;
+		reply_ext(ack, out, 0);
+		break;
+	}
+
+	case 0x000C:
+		if( req.chunks.empty() ){
+			reply_ext(ack, p, 0);
+		}else{
+			reply_chunked(ack, req.chunks, 0);
+		}
+		break;
+
+	case 0x000D:{
+		// same layout as UMD::s_capabilities
+		struct {
+			uint16_t protocol, features;
+			uint32_t request_payload, reply_size, rx_ring_size, ext_segment_size;
+			uint8_t cart_id, bus_size;
+			uint16_t cart_ops;
+			uint32_t pio_read_rate, dma_read_rate;
+		} caps = {
+			1, 0x0007, REQUEST_PAYLOAD_MAX, USB_BUFFER_SIZE, 4096, USB_EXT_SEGMENT_SIZE,
+			cart, (uint8_t)((cart == cart_genesis) ? 16 : 8), (uint16_t)((cart == cart_genesis) ? 0x1F : 0x0F),
+			(uint32_t)((cart == cart_genesis) ? timing.read_bytes_per_s_16 : timing.read_bytes_per_s_8),
+			(uint32_t)((cart == cart_genesis) ? timing.read_bytes_per_s_16 : 0)
+		};
+		static_assert(sizeof(caps) == 32, "capabilities layout");
+		out.assign(reinterpret_cast<uint8_t *>(&caps), reinterpret_cast<uint8_t *>(&caps) + sizeof(caps));
+		reply(ack, out);
+		break;
+	}
+
+	case 0x000E:{
+		if( p.size() != 8 ){
+			reply(UMD_REPLY_PAYLOAD_SIZE_ERROR, out);
+			break;
+		}
+		uint32_t address = load32(&p[0]), size = load32(&p[4]);
+		std::vector<std::vector<uint8_t>> chunks;
+		uint8_t raw[CODEC_BLOCK_SIZE];
+		uint32_t block[CODEC_MAX_BLOCK / 4];
+		for( uint32_t pos = 0; pos < size; pos += CODEC_BLOCK_SIZE ){
+			uint16_t len = (uint16_t)std::min<uint32_t>(CODEC_BLOCK_SIZE, size - pos);
+			for( uint16_t i = 0; i < len; i++ ){
+				raw[i] = (address + pos + i < rom.size()) ? rom[address + pos + i] : 0;
+			}
+			uint16_t n = codec.encode(raw, len, reinterpret_cast<uint8_t *>(block));
+			chunks.emplace_back(reinterpret_cast<uint8_t *>(block), reinterpret_cast<uint8_t *>(block) + n);
+		}
+		device_ns = read_ns(size);
+		overlapped = true;
+		reply_chunked(ack, chunks, 0);
+		break;
+	}
+
+	case 0x000F:{
+		uint32_t received = 0, programmed = 0, skipped = 0, status = 0;
+		uint8_t raw[CODEC_BLOCK_SIZE];
+		uint32_t unit = (cart == cart_genesis) ? 2 : 1, chip_size = (uint32_t)rom.size() / chips;
+		// like the firmware, every chip programs its lane while the next chunks arrive,
+		// a decoded block waits for its chip in one of three slots
+		std::vector<uint64_t> chip_done(chips, 0);
+		std::vector<uint64_t> slots;
+		uint64_t arrived = 0;
+		for( const std::vector<uint8_t> &chunk : req.chunks ){
+			arrived += (uint64_t)((double)chunk.size() * 1e9 / timing.link_bytes_per_s);
+			if( chunk.size() < 8 ){
+				status = CMD_FAIL;
+				break;
+			}
+			int32_t n = Codec::decode(&chunk[4], (uint32_t)chunk.size() - 4, raw, sizeof(raw));
+			if( n < 0 ){
+				status = CMD_FAIL;
+				break;
+			}
+			uint32_t address = load32(&chunk[0]);
+			uint32_t written = program(address, raw, n);
+			uint64_t ns = (uint64_t)(written / unit) * timing.program_ns;
+			received += n;
+			programmed += written;
+			skipped += n - written;
+			if( chips == 1 ){
+				device_ns += ns;
+			}else if( written != 0 ){
+				uint32_t chip = std::min<uint32_t>(address / chip_size, chips - 1);
+				slots.erase(std::remove_if(slots.begin(), slots.end(), [arrived](uint64_t done){ return done <= arrived; }), slots.end());
+				if( slots.size() == 3 ){
+					std::vector<uint64_t>::iterator first = std::min_element(slots.begin(), slots.end());
+					arrived = *first;
+					slots.erase(first);
+				}
+				chip_done[chip] = std::max(arrived, chip_done[chip]) + ns;
+				slots.push_back(chip_done[chip]);
+			}
+		}
+		if( chips > 1 ){
+			device_ns = std::max(arrived, *std::max_element(chip_done.begin(), chip_done.end()));
+		}
+		overlapped = true;
+		if( status != 0 ){
+			append<uint32_t>(out, status);
+			reply(UMD_REPLY_CMD_FAILED, out);
+			break;
+		}
+		append<uint32_t>(out, received);
+		append<uint32_t>(out, programmed);
+		append<uint32_t>(out, skipped);
+		reply(ack, out);
+		break;
+	}
+
+	case 0x0010:{
+		if( p.size() < 12 ){
+			reply(UMD_REPLY_PAYLOAD_SIZE_ERROR, out);
+			break;
+		}
+		uint32_t address = load32(&p[0]), sector = load32(&p[4]);
+		uint16_t count = load16(&p[8]), flags = load16(&p[10]), mismatched = 0;
+		if( sector == 0 || sector % 4 != 0 || p.size() < 12 + 4 * (size_t)count ){
+			append<uint32_t>(out, CMD_FAIL);
+			reply(UMD_REPLY_CMD_FAILED, out);
+			break;
+		}
+		std::vector<uint32_t> bitmap((count + 31) / 32, 0);
+		for( uint16_t i = 0; i < count; i++, address += sector ){
+			uint32_t len = (address < rom.size()) ? std::min<uint32_t>(sector, (uint32_t)rom.size() - address) : 0;
+			device_ns += read_ns(sector);
+			if( crc32_mpeg2(&rom[address], len) == load32(&p[12 + 4 * i]) ){
+				continue;
+			}
+			bitmap[i >> 5] |= 1U << (i & 31);
+			mismatched++;
+			if( flags & 0x0001 ){
+				std::fill(rom.begin() + address, rom.begin() + address + len, 0xFF);
+				device_ns += timing.erase_sector_ns;
+			}
+		}
+		append<uint16_t>(out, mismatched);
+		for( uint32_t lword : bitmap ){
+			append<uint32_t>(out, lword);
+		}
+		reply(ack, out);
+		break;
+	}
+
+	case 0x0016:
+		append<uint32_t>(out, pc_assigned_id);
+		reply(ack, out);
+		break;
+
+	case 0x0017:{
+		// uniform sectors, the times are those of the model
+		FlashGeometry geometry;
+		std::memset(&geometry, 0, sizeof(geometry));
+		geometry.size = (uint32_t)rom.size() / chips;
+		geometry.source = 2;
+		geometry.region_count = 1;
+		geometry.region[0].sector_size = sector_size;
+		geometry.region[0].sectors = geometry.size / sector_size;
+		geometry.program_typ_us = geometry.program_max_us = (uint32_t)(timing.program_ns / 1000);
+		geometry.erase_typ_ms = geometry.erase_max_ms = (uint32_t)(timing.erase_sector_ns / 1000000);
+		geometry.chip_erase_typ_ms = geometry.chip_erase_max_ms = geometry.erase_typ_ms * geometry.region[0].sectors;
+		geometry.chips = chips;
+		geometry.flags = 0x01;			// erase suspend
+		out.resize(sizeof(geometry));
+		std::memcpy(out.data(), &geometry, sizeof(geometry));
+		reply(ack, out);
+		break;
+	}
+
+	case 0x0018:{
+		// sectors are erased in the order of the ranges, the next one as soon as the previous one is done,
+		// it runs while another chip programs and on its own chip while the chip waits on the link
+		uint32_t received = 0, programmed = 0, skipped = 0, erased = 0, status = 0;
+		uint32_t unit = (cart == cart_genesis) ? 2 : 1, chip_size = (uint32_t)rom.size() / chips;
+		uint8_t raw[CODEC_BLOCK_SIZE];
+		std::vector<uint32_t> sectors;
+		size_t next = 0, pending = SIZE_MAX;
+		uint64_t pending_ns = 0;
+
+		if( req.chunks.empty() || req.chunks[0].size() < 4 || req.chunks[0].size() < 4 + 8 * (size_t)load32(&req.chunks[0][0]) ){
+			status = CMD_FAIL;
+		}else{
+			for( uint32_t i = 0; i < load32(&req.chunks[0][0]); i++ ){
+				uint32_t first = load32(&req.chunks[0][4 + 8 * i]), size = load32(&req.chunks[0][8 + 8 * i]);
+				for( uint32_t address = first; address < first + size; address += sector_size ){
+					sectors.push_back(address);
+				}
+			}
+		}
+		auto erase = [&](size_t i){
+			uint32_t address = std::min<uint32_t>(sectors[i], (uint32_t)rom.size());
+			uint32_t end = std::min<uint32_t>(sectors[i] + sector_size, (uint32_t)rom.size());
+			std::fill(rom.begin() + address, rom.begin() + end, 0xFF);
+			erased++;
+		};
+		auto erase_through = [&](size_t last){
+			if( pending != SIZE_MAX && pending <= last ){
+				device_ns += pending_ns;
+				pending = SIZE_MAX;
+			}
+			for( ; next < sectors.size() && next <= last; next++ ){
+				erase(next);
+				device_ns += timing.erase_sector_ns;
+			}
+		};
+		auto erase_advance = [&](void){
+			if( pending != SIZE_MAX && pending_ns == 0 ){
+				pending = SIZE_MAX;
+			}
+			if( pending == SIZE_MAX && next < sectors.size() ){
+				pending = next;
+				pending_ns = timing.erase_sector_ns;
+				erase(next++);
+			}
+		};
+
+		for( size_t c = 1; status == 0 && c < req.chunks.size(); c++ ){
+			const std::vector<uint8_t> &chunk = req.chunks[c];
+			int32_t n = (chunk.size() < 8) ? -1 : Codec::decode(&chunk[4], (uint32_t)chunk.size() - 4, raw, sizeof(raw));
+			if( n < 0 ){
+				status = CMD_FAIL;
+				break;
+			}
+			uint32_t address = load32(&chunk[0]);
+			uint32_t last = address + (n ? n - 1 : 0);
+			size_t sector = std::find_if(sectors.begin(), sectors.end(), [this, last](uint32_t first){
+				return last - first < sector_size; }) - sectors.begin();
+			if( sector == sectors.size() ){
+				status = CMD_FAIL;
+				break;
+			}
+			erase_through(sector);
+			erase_advance();
+			uint32_t written = program(address, raw, n);
+			uint64_t ns = (uint64_t)(written / unit) * timing.program_ns;
+			uint64_t link_ns = (uint64_t)((double)chunk.size() * 1e9 / timing.link_bytes_per_s);
+			received += n;
+			programmed += written;
+			skipped += n - written;
+			device_ns += ns;
+			if( pending != SIZE_MAX ){
+				uint64_t idle = (sectors[pending] / chip_size != address / chip_size) ? ns : ((link_ns > ns) ? link_ns - ns : 0);
+				pending_ns -= std::min(pending_ns, idle);
+			}
+			erase_advance();
+		}
+		if( status == 0 ){
+			erase_through(sectors.size() - 1);
+		}
+		overlapped = true;
+		if( status != 0 ){
+			append<uint32_t>(out, status);
+			reply(UMD_REPLY_CMD_FAILED, out);
+			break;
+		}
+		append<uint32_t>(out, received);
+		append<uint32_t>(out, programmed);
+		append<uint32_t>(out, skipped);
+		append<uint32_t>(out, erased);
+		reply(ack, out);
+		break;
+	}
+
+	default:
+		reply(UMD_REPLY_NO_ACK, out);
+		break;
+	}
+}
@@ -0,0 +1,111 @@
+/*******************************************************************//**
+ *  \file SimDevice.h
+ *  \author René Richard
+ *  \brief Simulated UMDv2 with a flash cartridge. It speaks the same frames
+ *         as the firmware and keeps a virtual clock from a simple model of
+ *         the USB link and the cartridge bus, so benchmark runs against it
+ *         are exactly reproducible.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBUMD_SIMDEVICE_H_
+#define LIBUMD_SIMDEVICE_H_
+
+#include <vector>
+
+#include "Codec/Codec.h"
+#include "Loopback.h"
+
+/*******************************************************************//**
+ * \class SimDevice
+ * \brief implements the commands the benchmarks use, anything else is
+ *        answered with NO_ACK like an unknown command
+ **********************************************************************/
+class SimDevice : public LoopbackDevice{
+public:
+
+	// cartridge adapters as reported by the capabilities command
+	enum e_cart : uint8_t {
+		cart_genesis = 0x01, cart_master_system = 0x02
+	};
+
+	/*******************************************************************//**
+	 * \brief time model, the defaults are in the range of a full speed
+	 *        CDC link and the parallel NOR flash found on cartridges
+	 **********************************************************************/
+	struct Timing{
+		double		link_bytes_per_s = 1.0e6;		///< USB full speed bulk, either direction
+		uint64_t	turnaround_ns = 250000;			///< request to first reply byte, USB scheduling
+		double		read_bytes_per_s_16 = 20.0e6;	///< 16 bit bus reads
+		double		read_bytes_per_s_8 = 10.0e6;	///< 8 bit bus reads
+		uint64_t	program_ns = 9000;				///< per bus word programmed
+		uint64_t	erase_sector_ns = 700000000;	///< per sector erased
+	};
+
+	/*******************************************************************//**
+	 * \param cart adapter to simulate
+	 * \param image initial flash contents, its size is the flash size
+	 **********************************************************************/
+	SimDevice(e_cart cart, const std::vector<uint8_t> &image);
+	SimDevice(e_cart cart, const std::vector<uint8_t> &image, const Timing &timing);
+
+	void receive(const uint8_t *data, size_t len, std::vector<uint8_t> &reply) override;
+	uint64_t now_ns(void) override { return clock_ns; }
+
+	const std::vector<uint8_t> &flash(void) const { return rom; }
+	uint32_t sector_size = 0x10000;
+	uint8_t chips = 1;						///< the flash is split evenly, they program at once like the firmware's lanes
+
+private:
+
+	e_cart cart;
+	std::vector<uint8_t> rom;
+	Timing timing;
+	Codec codec;
+	uint64_t clock_ns = 0;
+	uint32_t pc_assigned_id = 0;
+
+	std::vector<uint8_t> in;				///< request bytes not consumed yet
+	std::vector<uint8_t> *reply_bytes;		///< where the reply of the current request goes
+
+	// what the current request cost the device and the link
+	uint64_t device_ns;
+	bool overlapped;						///< the firmware pipelines the bus and the link for this command
+
+	struct Request{
+		uint16_t				cmd;
+		bool					ext;
+		std::vector<uint8_t>	payload;		///< chunked requests keep each chunk
+		std::vector<std::vector<uint8_t>> chunks;
+		size_t					wire_len;
+	};
+
+	bool parse(Request &req);
+	void execute(const Request &req);
+
+	// reply builders, the same byte layout the firmware sends
+	void reply(uint16_t ack, const std::vector<uint8_t> &payload);
+	void reply_ext(uint16_t ack, const std::vector<uint8_t> &payload, uint32_t status);
+	void reply_chunked(uint16_t ack, const std::vector<std::vector<uint8_t>> &chunks, uint32_t status);
+	void emit(const void *data, size_t len);
+	void emit32(uint32_t v){ emit(&v, sizeof(v)); }
+
+	uint64_t read_ns(size_t len) const;
+	uint32_t program(uint32_t address, const uint8_t *data, size_t len);
+};
+
+#endif /* LIBUMD_SIMDEVICE_H_ */
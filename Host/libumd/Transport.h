@@ -0,0 +1,58 @@
+/*******************************************************************//**
+ *  \file Transport.h
+ *  \author René Richard
+ *  \brief Byte pipe between the host library and a UMDv2.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBUMD_TRANSPORT_H_
+#define LIBUMD_TRANSPORT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+/*******************************************************************//**
+ * \class Transport
+ * \brief byte pipe to a device, real or simulated. write() and
+ *        read_some() are called from different threads.
+ **********************************************************************/
+class Transport{
+public:
+	virtual ~Transport() {}
+	virtual void write(const uint8_t *data, size_t len) = 0;
+
+	/*******************************************************************//**
+	 * \brief whatever is available, up to max bytes
+	 * \return bytes read, 0 if nothing arrived within timeout_ms
+	 **********************************************************************/
+	virtual size_t read_some(uint8_t *data, size_t max, unsigned timeout_ms) = 0;
+
+	/*******************************************************************//**
+	 * \brief time base of the benchmarks, a simulated device has its own
+	 **********************************************************************/
+	virtual uint64_t now_ns(void) = 0;
+	virtual std::string name(void) const = 0;
+};
+
+class LinkError : public std::runtime_error{
+public:
+	explicit LinkError(const std::string &what) : std::runtime_error(what) {}
+};
+
+#endif /* LIBUMD_TRANSPORT_H_ */
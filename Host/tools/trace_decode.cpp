@@ -0,0 +1,142 @@
+/*******************************************************************//**
+ *  \file trace_decode.cpp
+ *  \author René Richard
+ *  \brief Decodes the binary event trace the UMDv2 streams out of USART3.
+ *
+ *         stty -F /dev/ttyUSB0 2000000 raw && trace_decode /dev/ttyUSB0
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Trace.h"
+
+#define SYNC_RECORDS	4		///< consecutive records needed to trust an alignment
+
+static const char *event_names[TRACE_EVENT_COUNT] = {
+	"overflow", "usb rx", "usb rx paused", "cmd start", "cmd end", "dma done", "flash poll"
+};
+
+static const char *event_name(uint16_t event){
+	return (event < TRACE_EVENT_COUNT) ? event_names[event] : "unknown";
+}
+
+/*******************************************************************//**
+ * a window of SYNC_RECORDS records is aligned if their seq count up by one
+ **********************************************************************/
+static bool aligned(const uint8_t *window){
+	s_trace_record rec[SYNC_RECORDS];
+
+	std::memcpy(rec, window, sizeof(rec));
+	for( int i = 1; i < SYNC_RECORDS; i++ ){
+		if( rec[i].seq != (uint16_t)(rec[i - 1].seq + 1) || rec[i].event >= TRACE_EVENT_COUNT ){
+			return false;
+		}
+	}
+	return rec[0].event < TRACE_EVENT_COUNT;
+}
+
+/*******************************************************************//**
+ * print a record with its time since the first one
+ **********************************************************************/
+static void print_record(const uint8_t *data, uint16_t &next_seq, uint32_t &last_stamp, uint64_t &time, double clock){
+	s_trace_record rec;
+
+	std::memcpy(&rec, data, sizeof(rec));
+	next_seq++;
+
+	// the cycle counter wraps every 43s at 100MHz
+	time += (uint32_t)(rec.timestamp - last_stamp);
+	last_stamp = rec.timestamp;
+
+	std::printf("%14.3f us  %5u  %-14s 0x%08X 0x%08X\n", time * 1e6 / clock, rec.seq, event_name(rec.event), rec.arg0, rec.arg1);
+	if( rec.event == TRACE_OVERFLOW ){
+		std::printf("-- %u records dropped\n", rec.arg0);
+	}
+}
+
+int main(int argc, char *argv[]){
+	const char *path = nullptr;
+	double clock = 100e6;
+	FILE *in = stdin;
+
+	for( int i = 1; i < argc; i++ ){
+		if( std::strcmp(argv[i], "-c") == 0 && i + 1 < argc ){
+			clock = std::atof(argv[++i]);
+		}else if( argv[i][0] != '-' ){
+			path = argv[i];
+		}else{
+			std::fprintf(stderr, "usage: %s [-c core clock Hz] [trace file or tty]\n", argv[0]);
+			return 1;
+		}
+	}
+	if( path != nullptr && (in = std::fopen(path, "rb")) == nullptr ){
+		std::perror(path);
+		return 1;
+	}
+
+	static uint8_t window[SYNC_RECORDS * sizeof(s_trace_record)];
+	size_t fill = 0;
+	bool synced = false;
+	uint16_t next_seq = 0;
+	uint32_t last_stamp = 0;
+	uint64_t time = 0;
+	int c;
+
+	// slide a byte at a time until the records line up, then consume a record at a time
+	while( (c = std::fgetc(in)) != EOF ){
+		window[fill++] = (uint8_t)c;
+		if( fill < sizeof(window) ){
+			continue;
+		}
+
+		if( !synced ){
+			if( !aligned(window) ){
+				std::memmove(window, window + 1, --fill);
+				continue;
+			}
+			synced = true;
+			next_seq = ((s_trace_record *)window)->seq;
+			last_stamp = ((s_trace_record *)window)->timestamp;
+		}
+
+		if( ((s_trace_record *)window)->seq != next_seq ){
+			std::printf("-- lost sync at seq %u\n", next_seq);
+			synced = false;
+			std::memmove(window, window + 1, --fill);
+			continue;
+		}
+		print_record(window, next_seq, last_stamp, time, clock);
+		fill -= sizeof(s_trace_record);
+		std::memmove(window, window + sizeof(s_trace_record), fill);
+	}
+
+	// the records left in the window at the end of a capture
+	for( size_t pos = 0; synced && pos + sizeof(s_trace_record) <= fill; pos += sizeof(s_trace_record) ){
+		if( ((s_trace_record *)&window[pos])->seq != next_seq ){
+			break;
+		}
+		print_record(&window[pos], next_seq, last_stamp, time, clock);
+	}
+
+	if( in != stdin ){
+		std::fclose(in);
+	}
+	return 0;
+}
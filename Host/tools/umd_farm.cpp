@@ -0,0 +1,211 @@
+/*******************************************************************//**
+ *  \file umd_farm.cpp
+ *  \author René Richard
+ *  \brief Spreads dump, burn and verify jobs across every connected UMDv2.
+ *
+ *         umd_farm [--port <tty>]... [--sim <n>] [--sim-sms <n>] [jobs file]
+ *
+ *         Without --port or --sim the CDC ttys are scanned. Jobs are read
+ *         from the file, or stdin, one per line, and start as they arrive:
+ *           dump <8|16> <size> [output file]
+ *           burn <8|16> <image file>
+ *           verify <8|16> <image file>
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glob.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Farm.h"
+#include "Loopback.h"
+#include "SerialTransport.h"
+#include "SimDevice.h"
+
+#define SIM_GENESIS_SIZE	(4 << 20)
+#define SIM_SMS_SIZE		(512 << 10)
+
+static const char *kind_name[] = { "dump", "burn", "verify" };
+
+/*******************************************************************//**
+ * CDC ttys of Linux and macOS
+ **********************************************************************/
+static std::vector<std::string> scan(void){
+	std::vector<std::string> ports;
+	const char *patterns[] = { "/dev/ttyACM*", "/dev/cu.usbmodem*" };
+
+	for( const char *pattern : patterns ){
+		glob_t g;
+		if( glob(pattern, 0, nullptr, &g) == 0 ){
+			for( size_t i = 0; i < g.gl_pathc; i++ ){
+				ports.push_back(g.gl_pathv[i]);
+			}
+		}
+		globfree(&g);
+	}
+	return ports;
+}
+
+/*******************************************************************//**
+ * \return false if the line isn't a job
+ **********************************************************************/
+static bool parse_job(const std::string &line, Farm::Job &job, std::map<std::string, std::shared_ptr<const std::vector<uint8_t>>> &images){
+	std::istringstream in(line);
+	std::string kind, arg;
+	unsigned bus;
+
+	if( !(in >> kind >> bus) || (bus != 8 && bus != 16) ){
+		return false;
+	}
+	job.bus_size = bus;
+	job.label = line;
+
+	if( kind == "dump" ){
+		job.kind = Farm::job_dump;
+		if( !(in >> arg) ){
+			return false;
+		}
+		job.size = std::strtoul(arg.c_str(), nullptr, 0);
+		in >> job.output;
+		return job.size != 0;
+	}
+
+	if( kind == "burn" || kind == "verify" ){
+		job.kind = (kind == "burn") ? Farm::job_burn : Farm::job_verify;
+		if( !(in >> arg) ){
+			return false;
+		}
+		// every job of a batch shares the image
+		if( !images.count(arg) ){
+			std::ifstream f(arg, std::ios::binary);
+			if( !f ){
+				return false;
+			}
+			images[arg] = std::make_shared<const std::vector<uint8_t>>(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+		}
+		job.image = images[arg];
+		return !job.image->empty();
+	}
+	return false;
+}
+
+int main(int argc, char *argv[]){
+
+	std::vector<std::string> ports;
+	unsigned sim_genesis = 0, sim_sms = 0;
+	const char *jobs_file = nullptr;
+	Farm farm;
+
+	for( int i = 1; i < argc; i++ ){
+		std::string arg = argv[i];
+		if( arg == "--port" && i + 1 < argc ){
+			ports.push_back(argv[++i]);
+		}else if( arg == "--sim" && i + 1 < argc ){
+			sim_genesis = std::atoi(argv[++i]);
+		}else if( arg == "--sim-sms" && i + 1 < argc ){
+			sim_sms = std::atoi(argv[++i]);
+		}else if( arg[0] != '-' && !jobs_file ){
+			jobs_file = argv[i];
+		}else{
+			std::fprintf(stderr, "usage: %s [--port <tty>]... [--sim <n>] [--sim-sms <n>] [jobs file]\n", argv[0]);
+			return 1;
+		}
+	}
+	if( ports.empty() && sim_genesis == 0 && sim_sms == 0 ){
+		ports = scan();
+	}
+
+	// discovery, units keep the id they were given by an earlier run
+	for( const std::string &port : ports ){
+		try{
+			uint32_t id = farm.attach(std::unique_ptr<Transport>(new SerialTransport(port)));
+			std::fprintf(stderr, "unit %u on %s\n", id, port.c_str());
+		}catch( const LinkError &e ){
+			std::fprintf(stderr, "%s: not a UMDv2, %s\n", port.c_str(), e.what());
+		}
+	}
+	for( unsigned i = 0; i < sim_genesis + sim_sms; i++ ){
+		bool genesis = i < sim_genesis;
+		std::unique_ptr<LoopbackDevice> sim(new SimDevice(genesis ? SimDevice::cart_genesis : SimDevice::cart_master_system,
+			std::vector<uint8_t>(genesis ? SIM_GENESIS_SIZE : SIM_SMS_SIZE, 0xFF)));
+		uint32_t id = farm.attach(std::unique_ptr<Transport>(new LoopbackTransport(std::move(sim))));
+		std::fprintf(stderr, "unit %u simulated %s\n", id, genesis ? "Genesis" : "Master System");
+	}
+	if( farm.units().empty() ){
+		std::fprintf(stderr, "no units\n");
+		return 1;
+	}
+
+	std::ifstream file;
+	if( jobs_file ){
+		file.open(jobs_file);
+		if( !file ){
+			std::fprintf(stderr, "can't open %s\n", jobs_file);
+			return 1;
+		}
+	}
+	std::istream &jobs = jobs_file ? file : std::cin;
+
+	farm.start();
+	std::map<std::string, std::shared_ptr<const std::vector<uint8_t>>> images;
+	std::string line;
+	unsigned rejected = 0;
+	while( std::getline(jobs, line) ){
+		Farm::Job job;
+		if( line.empty() || line[0] == '#' ){
+			continue;
+		}
+		if( !parse_job(line, job, images) ){
+			std::fprintf(stderr, "bad job: %s\n", line.c_str());
+			rejected++;
+		}else if( !farm.submit(job) ){
+			std::fprintf(stderr, "no unit for: %s\n", line.c_str());
+			rejected++;
+		}
+	}
+	farm.finish();
+
+	// per job, then per unit, then the whole farm
+	unsigned failed = 0;
+	for( const Farm::Outcome &o : farm.outcomes() ){
+		std::printf("%-6s unit %-3u %8.3f s %s%s%s\n", kind_name[o.kind], o.unit, o.seconds,
+			o.label.c_str(), o.stolen ? " (stolen)" : "", o.error.empty() ? "" : (" FAILED: " + o.error).c_str());
+		failed += !o.error.empty();
+	}
+
+	uint64_t bytes = 0, elapsed_ns = 0;
+	for( const Farm::Unit &u : farm.units() ){
+		std::printf("unit %-3u %-16s %2u bit  %4llu jobs  %3llu stolen  %10llu bytes  %8.3f s busy  %10.0f B/s\n",
+			u.id, u.name.c_str(), u.bus_size, (unsigned long long)u.jobs, (unsigned long long)u.stolen,
+			(unsigned long long)u.bytes, u.busy_ns / 1e9, u.busy_ns ? u.bytes / (u.busy_ns / 1e9) : 0.0);
+		bytes += u.bytes;
+		elapsed_ns = std::max(elapsed_ns, u.elapsed_ns);
+	}
+	std::printf("farm     %zu units  %llu bytes  %.3f s  %.0f B/s  %u failed  %u rejected\n",
+		farm.units().size(), (unsigned long long)bytes, elapsed_ns / 1e9,
+		elapsed_ns ? bytes / (elapsed_ns / 1e9) : 0.0, failed, rejected);
+
+	return (failed || rejected) ? 1 : 0;
+}
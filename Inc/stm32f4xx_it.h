@@ -58,6 +58,7 @@ void PendSV_Handler(void);
 void SysTick_Handler(void);
 void OTG_FS_IRQHandler(void);
 /* USER CODE BEGIN EFP */
+void DMA1_Stream3_IRQHandler(void);
 
 /* USER CODE END EFP */
 
@@ -76,6 +76,8 @@ struct _CDC_BUFFER{
 	uint16_t	op;
 	uint8_t		status;
 	uint32_t	packets;
+	uint16_t	high_water;						///< highest fill level of the buffer so far
+	uint8_t		rx_paused;						///< OUT endpoint left NAKing until there is room again
 };
 /* USER CODE END EXPORTED_TYPES */
 
@@ -126,6 +128,8 @@ uint8_t CDC_ReadBuffer_Single(void);
 uint16_t CDC_ReadBuffer(uint8_t *buf, uint16_t len);
 uint16_t CDC_PeakBuffer(uint8_t *buf, uint16_t len);
 uint8_t CDC_PeakLast(void);
+uint16_t CDC_HighWater(void);
+uint8_t CDC_TransmitBusy(void);
 void CDC_InitBuffer(void);
 /* USER CODE END EXPORTED_FUNCTIONS */
 
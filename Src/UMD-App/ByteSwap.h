@@ -0,0 +1,84 @@
+/*******************************************************************//**
+ *  \file ByteSwap.h
+ *  \author René Richard
+ *  \brief Halfword byte swap kernels for big endian cartridge buses. They
+ *         work on pairs of halfwords in aligned 32-bit words, a single REV16
+ *         on the Cortex-M4. The portable version lets the host tools use it.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BYTESWAP_H_
+#define BYTESWAP_H_
+
+#include <cstdint>
+
+/*******************************************************************//**
+ * \brief swap the bytes of both halfwords of v
+ **********************************************************************/
+static inline uint32_t swap16x2(uint32_t v){
+#if defined(__ARM_ARCH) && (__ARM_ARCH >= 6)
+	uint32_t r;
+	__asm__ ("rev16 %0, %1" : "=r" (r) : "r" (v));
+	return r;
+#else
+	return ((v & 0x00FF00FFU) << 8) | ((v >> 8) & 0x00FF00FFU);
+#endif
+}
+
+/*******************************************************************//**
+ * \brief byte swap every halfword of buf in place
+ * \param words number of 32-bit words, each holds two halfwords
+ **********************************************************************/
+static inline void swap16_inplace(uint32_t *buf, uint32_t words){
+
+	// 4 words per iteration keeps the loop overhead off the load/store pipeline
+	for(; words >= 4; words -= 4){
+		buf[0] = swap16x2(buf[0]);
+		buf[1] = swap16x2(buf[1]);
+		buf[2] = swap16x2(buf[2]);
+		buf[3] = swap16x2(buf[3]);
+		buf += 4;
+	}
+	for(; words != 0; words--){
+		*buf = swap16x2(*buf);
+		buf++;
+	}
+}
+
+/*******************************************************************//**
+ * \brief copy from a 16-bit bus and swap on the way, the data is only
+ *        touched once. A 32-bit read of a 16-bit FSMC bank is split into
+ *        two halfword accesses by the controller.
+ * \param words number of 32-bit words to copy
+ **********************************************************************/
+static inline void swap16_copy(uint32_t *dst, const volatile uint32_t *src, uint32_t words){
+
+	for(; words >= 4; words -= 4){
+		uint32_t a = src[0], b = src[1], c = src[2], d = src[3];
+		dst[0] = swap16x2(a);
+		dst[1] = swap16x2(b);
+		dst[2] = swap16x2(c);
+		dst[3] = swap16x2(d);
+		src += 4;
+		dst += 4;
+	}
+	for(; words != 0; words--){
+		*(dst++) = swap16x2(*(src++));
+	}
+}
+
+#endif /* BYTESWAP_H_ */
@@ -23,27 +23,24 @@
 #include <stdint.h>
 #include "CartFactory.h"
 #include "Cartridges/Cartridge.h"
-#include "Cartridges/NoCart.h"
-#include "Cartridges/Genesis.h"
-#include "Cartridges/MasterSystem.h"
 
 /*******************************************************************//**
  *
  **********************************************************************/
 CartFactory::CartFactory(){
-    carts[CartFactory::UNDEFINED] = new NoCart();
-	carts[CartFactory::GENESIS] = new Genesis();
-    carts[CartFactory::SMS] = new MasterSystem();
-
+    carts[CartFactory::UNDEFINED] = &nocart;
+    carts[CartFactory::GENESIS] = &genesis;
+    carts[CartFactory::SMS] = &sms;
+    carts[CartFactory::GBA] = &gba;
+    carts[CartFactory::NES] = &nes;
+    carts[CartFactory::SNES] = &snes;
 }
 
 /*******************************************************************//**
  *
  **********************************************************************/
 CartFactory::~CartFactory(){
-    for (int i=0; i < CARTS_LEN; i++){
-    	delete carts[i];
-    }
+	// carts are members of the factory, nothing to free
 }
 
 /*******************************************************************//**
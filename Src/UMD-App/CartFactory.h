@@ -25,6 +25,12 @@
 
 #include <stdint.h>
 #include "Cartridges/Cartridge.h"
+#include "Cartridges/NoCart.h"
+#include "Cartridges/Genesis.h"
+#include "Cartridges/MasterSystem.h"
+#include "Cartridges/GameBoyAdvance.h"
+#include "Cartridges/Nes.h"
+#include "Cartridges/SuperNes.h"
 
 
 /*******************************************************************//**
@@ -39,11 +45,14 @@ public:
     ~CartFactory();
 
     // The mode value must match the MCP23008 value on the cartridge adapter board
-	#define CARTS_LEN  3
+	#define CARTS_LEN  6
     enum Mode : uint8_t {
     	UNDEFINED	= 0x00,
 		GENESIS		= 0x01,
-		SMS			= 0x02
+		SMS			= 0x02,
+		GBA			= 0x03,
+		NES			= 0x04,
+		SNES		= 0x05
     }; 	//!< The MCP23008 ID value on the adapter
 
     Cartridge* getCart(Mode mode);
@@ -52,9 +61,16 @@ public:
 private:
     CartFactory(const CartFactory&) = delete;
 
+    // Storage pool for the carts, statically allocated with the factory
+    NoCart nocart;
+    Genesis genesis;
+    MasterSystem sms;
+    GameBoyAdvance gba;
+    Nes nes;
+    SuperNes snes;
+
     // Array of carts indexed by Mode
     Cartridge* carts[CARTS_LEN+1];
-    Cartridge* noop;
 };
 
 #endif
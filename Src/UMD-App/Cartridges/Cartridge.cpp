@@ -25,10 +25,21 @@
 #include "fsmc.h"
 #include "i2c.h"
 
+// the access MX_FSMC_Init() gives every bank, back to back reads of the same chip need little turnaround
+const Cartridge::s_bus_timing Cartridge::BUS_TIMING_DEFAULT = { 2, 12, 1, 2, 12, 2, 0 };
+
 /*******************************************************************//**
  *
  **********************************************************************/
-Cartridge::Cartridge() {}
+Cartridge::Cartridge() {
+	param.ops = op_none;
+	param.save_size = 0;
+	reset_geometry();
+	rom_info = {};
+	for( s_bus_timing &t : bus_timing ){
+		t = BUS_TIMING_DEFAULT;
+	}
+}
 
 /*******************************************************************//**
  *
@@ -46,7 +57,15 @@ void Cartridge::init(void){
 
 	param.id = 0;
 	param.bus_size = 8;
+	param.ops = op_none;
+	param.save_size = 0;
 	param.dma_channel = &hdma_memtomem_dma2_stream0; // default to 8bit dma channel
+	reset_geometry();
+
+	set_bus_timing(UMD_CE0, BUS_TIMING_DEFAULT);
+	set_bus_timing(UMD_CE1, BUS_TIMING_DEFAULT);
+	set_bus_timing(UMD_CE2, BUS_TIMING_DEFAULT);
+	set_bus_timing(UMD_CE3, BUS_TIMING_DEFAULT);
 
 	// turn off the voltage to the cart
 	set_voltage(vcart_off);
@@ -74,24 +93,50 @@ void Cartridge::init(void){
 /*******************************************************************//**
  *
  **********************************************************************/
-void Cartridge::erase_flash(bool wait){
-
-	// first write goes through mapper to ensure page gets reset to 0
-	this->write_byte((uint32_t)0x0AAA, (uint8_t)0xAA, mem_prg);
-	this->write_byte((uint16_t)0x0555, (uint8_t)0x55, mem_prg);
-	this->write_byte((uint16_t)0x0AAA, (uint8_t)0x80, mem_prg);
-	this->write_byte((uint16_t)0x0AAA, (uint8_t)0xAA, mem_prg);
-	this->write_byte((uint16_t)0x0555, (uint8_t)0x55, mem_prg);
-	this->write_byte((uint16_t)0x0AAA, (uint8_t)0x10, mem_prg);
+bool Cartridge::erase_flash(bool wait){
+
+	bool ok = true;
+
+	// every chip erases at once
+	for( uint8_t i = 0; i < geometry.chips; i++ ){
+		uint32_t chip = geometry.size * i;
+		// first write goes through mapper to ensure page gets reset to 0
+		this->write_byte(chip + (uint32_t)0x0AAA, (uint8_t)0xAA, mem_prg);
+		flash_command(chip, 0x0555, 0x55);
+		flash_command(chip, 0x0AAA, 0x80);
+		flash_command(chip, 0x0AAA, 0xAA);
+		flash_command(chip, 0x0555, 0x55);
+		flash_command(chip, 0x0AAA, 0x10);
+	}
 
 	if(wait){
-		uint32_t umd_millis = HAL_GetTick();
-		while( this->toggle_bit(4) != 4 ){
-			if( (HAL_GetTick() - umd_millis) > 250 ){
-				umd_millis = HAL_GetTick();
+		for( uint8_t i = 0; i < geometry.chips; i++ ){
+			if( !wait_erase(geometry.size * i, true) ){
+				ok = false;
 			}
 		}
 	}
+	return ok;
+}
+
+/*******************************************************************//**
+ * the last write goes through the mapper to select the sector's page
+ **********************************************************************/
+bool Cartridge::erase_sector(uint32_t address, bool wait){
+
+	uint32_t chip = chip_base(address);
+
+	flash_command(chip, 0x0AAA, 0xAA);
+	flash_command(chip, 0x0555, 0x55);
+	flash_command(chip, 0x0AAA, 0x80);
+	flash_command(chip, 0x0AAA, 0xAA);
+	flash_command(chip, 0x0555, 0x55);
+	this->write_byte(address, (uint8_t)0x30, mem_prg);
+
+	if(wait){
+		return wait_erase(address, false);
+	}
+	return true;
 }
 
 /*******************************************************************//**
@@ -109,6 +154,7 @@ void Cartridge::get_flash_id(void){
 	this->flash_info.device = read_byte((uint16_t)0x0001, mem_prg);
 	// exit software ID mode
 	this->write_byte((uint16_t)0x0000, (uint8_t)0xF0, mem_prg);
+	this->find_flash_geometry();
 }
 
 /*******************************************************************//**
@@ -134,75 +180,16 @@ uint16_t Cartridge::toggle_bit(uint16_t attempts){
 }
 
 /*******************************************************************//**
- * The get_flash_size() function returns the flash size
+ * cartridges without a header leave the layout unknown
  **********************************************************************/
-void Cartridge::find_flash_size(void)
-{
-    switch( this->flash_info.manufacturer ){
-        // microchip
-        case 0xBF:
-            switch( this->flash_info.device )
-            {
-                case 0x6D: // SST39VF6401B
-                case 0x6C: // SST39VF6402B
-                	this->flash_info.size = 0x800000;
-                    break;
-                case 0x5D: // SST39VF3201B
-                case 0x5C: // SST39VF3202B
-                case 0x5B: // SST39VF3201
-                case 0x5A: // SST39VF3202
-                	this->flash_info.size = 0x400000;
-                    break;
-                case 0x4F: // SST39VF1601C
-                case 0x4E: // SST39VF1602C
-                case 0x4B: // SST39VF1601
-                case 0x4A: // SST39VF1602
-                	this->flash_info.size = 0x200000;
-                    break;
-                default:
-                    break;
-            }
-            break;
-
-        // macronix
-        case 0xC2:
-            switch( this->flash_info.device )
-            {
-                // chips which will be single per board
-                // 3.3V
-                case 0xC9: // MX29LV640ET
-                case 0xCB: // MX29LV640EB
-                	this->flash_info.size = 0x800000;
-                    break;
-                case 0xA7: // MX29LV320ET
-                case 0xA8: // MX29LV320EB
-                	this->flash_info.size = 0x400000;
-                    break;
-                case 0xC4: // MX29LV160DT
-                case 0x49: // MX29LV160DB
-                	this->flash_info.size = 0x400000;
-                    break;
-                // 5V
-                case 0x58: // MX29F800CT
-                case 0xD6: // MX29F800CB
-                	this->flash_info.size = 0x100000;
-                    break;
-                case 0x23: // MX29F400CT
-                case 0xAB: // MX29F400CB
-                	this->flash_info.size = 0x80000;
-                    break;
-                case 0x51: // MX29F200CT
-                case 0x57: // MX29F200CB
-                	this->flash_info.size = 0x80000;
-                    break;
-                default:
-                    break;
-            }
-            break;
-
-        default:
-            break;
-    }
+void Cartridge::find_rom_info(void){
+}
+
+/*******************************************************************//**
+ * cartridges without a mapper only have the fixed layout
+ **********************************************************************/
+bool Cartridge::set_mapper(uint16_t number, uint32_t prg_size){
+	return false;
 }
 
 /*******************************************************************//**
@@ -242,6 +229,123 @@ void Cartridge::set_level_translators(bool enable){
 	}
 }
 
+/*******************************************************************//**
+ * the read timing goes in BTR and the write timing in BWTR, the address
+ * hold, clock and latency aren't used by mode A
+ **********************************************************************/
+void Cartridge::set_bus_timing(uint32_t ce, const s_bus_timing &timing){
+
+	FSMC_NORSRAM_TimingTypeDef t = {0};
+	uint8_t bank = fsmc_bank(ce);
+
+	t.AddressHoldTime = 1;
+	t.CLKDivision = 16;
+	t.DataLatency = 17;
+	t.AccessMode = FSMC_ACCESS_MODE_A;
+
+	t.AddressSetupTime = timing.read_setup;
+	t.DataSetupTime = timing.read_data;
+	t.BusTurnAroundDuration = timing.read_turnaround;
+	FSMC_NORSRAM_Timing_Init(FSMC_NORSRAM_DEVICE, &t, bank << 1);
+
+	t.AddressSetupTime = timing.write_setup;
+	t.DataSetupTime = timing.write_data;
+	t.BusTurnAroundDuration = timing.write_turnaround;
+	FSMC_NORSRAM_Extended_Timing_Init(FSMC_NORSRAM_EXTENDED_DEVICE, &t, bank << 1, FSMC_EXTENDED_MODE_ENABLE);
+
+	bus_timing[bank] = timing;
+}
+
+/*******************************************************************//**
+ * The fast read timing is tried one cycle shorter than it will run, on a
+ * sample of the rom read at the safe timing first. Any difference keeps
+ * the safe timing, so does a cartridge that isn't there.
+ * \return true if the bank reads at the fast timing
+ **********************************************************************/
+bool Cartridge::tune_read_timing(uint32_t ce, const s_bus_timing &fast, const s_bus_timing &safe){
+
+	uint16_t sample[TIMING_SAMPLE_WORDS];
+	s_bus_timing margin = fast;
+	bool match = true;
+
+	set_bus_timing(ce, safe);
+	for( uint16_t i = 0; i < TIMING_SAMPLE_WORDS; i++ ){
+		sample[i] = (param.bus_size == 16) ? *(__IO uint16_t *)(ce + (i << 1)) : *(__IO uint8_t *)(ce + i);
+	}
+
+	margin.read_data--;
+	set_bus_timing(ce, margin);
+	for( uint8_t pass = 0; pass < TIMING_SAMPLE_PASSES && match; pass++ ){
+		for( uint16_t i = 0; i < TIMING_SAMPLE_WORDS; i++ ){
+			if( sample[i] != ((param.bus_size == 16) ? *(__IO uint16_t *)(ce + (i << 1)) : *(__IO uint8_t *)(ce + i)) ){
+				match = false;
+				break;
+			}
+		}
+	}
+
+	set_bus_timing(ce, match ? fast : safe);
+	return match;
+}
+
+/*******************************************************************//**
+ * Within a page the flash only needs the low address lines to settle,
+ * as long as its chip enable stays asserted. Only adapters which give
+ * their timing a page_data read this way, writes keep their timing so
+ * commands are never rushed.
+ * \return true if the bank reads at the page timing until page_read_end()
+ **********************************************************************/
+bool Cartridge::page_read_start(uint32_t fsmc_addr){
+
+	uint8_t bank = fsmc_bank(fsmc_addr);
+
+	if( geometry.page_words == 0 || bus_timing[bank].page_data == 0 ){
+		return false;
+	}
+	MODIFY_REG(FSMC_NORSRAM_DEVICE->BTCR[(bank << 1) + 1], FSMC_BTR1_ADDSET | FSMC_BTR1_DATAST | FSMC_BTR1_BUSTURN,
+			bus_timing[bank].page_data << FSMC_BTR1_DATAST_Pos);
+	return true;
+}
+
+/*******************************************************************//**
+ * size is in bytes, buf holds the bus order data read from fsmc_addr.
+ * Nothing guarantees the page hits, the whole transfer is read again at
+ * the read timing and every word compared. A difference is corrected and
+ * leaves page mode off until the geometry is found again.
+ **********************************************************************/
+void Cartridge::page_read_end(uint32_t fsmc_addr, uint8_t *buf, uint16_t size){
+
+	uint8_t bank = fsmc_bank(fsmc_addr);
+	bool match = true;
+
+	MODIFY_REG(FSMC_NORSRAM_DEVICE->BTCR[(bank << 1) + 1], FSMC_BTR1_ADDSET | FSMC_BTR1_DATAST | FSMC_BTR1_BUSTURN,
+			bus_timing[bank].read_setup | (bus_timing[bank].read_data << FSMC_BTR1_DATAST_Pos)
+			| (bus_timing[bank].read_turnaround << FSMC_BTR1_BUSTURN_Pos));
+
+	if( param.bus_size == 16 ){
+		uint16_t *words = (uint16_t *)buf;
+		for( uint16_t i = 0; i < (size >> 1); i++ ){
+			uint16_t word = *(__IO uint16_t *)(fsmc_addr + (i << 1));
+			if( words[i] != word ){
+				words[i] = word;
+				match = false;
+			}
+		}
+	}else{
+		for( uint16_t i = 0; i < size; i++ ){
+			uint8_t byte = *(__IO uint8_t *)(fsmc_addr + i);
+			if( buf[i] != byte ){
+				buf[i] = byte;
+				match = false;
+			}
+		}
+	}
+
+	if( !match ){
+		geometry.page_words = 0;
+	}
+}
+
 /*******************************************************************//**
  *
  **********************************************************************/
@@ -301,6 +405,7 @@ void Cartridge::read_bytes(uint16_t address, uint8_t *buf, uint16_t size, e_memo
  **********************************************************************/
 void Cartridge::read_bytes(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t, bool dma){
 	uint32_t fsmc_addr = UMD_CE0 | address;
+	Perf::Probe probe(Perf::stage_bus_read);
 
 	// do transfer with DMA
 	//HAL_DMA_Start(param.dma_channel, fsmc_addr, (uint32_t)buf, size);
@@ -330,20 +435,75 @@ void Cartridge::write_byte(uint32_t address, uint8_t data, e_memory_type mem_t){
 /*******************************************************************//**
  * single 8 bit program at 32bit address
  **********************************************************************/
-void Cartridge::program_bytes(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t){
-
-	for(; size > 0; size--){
-		this->write_byte((uint32_t)0x0AAA, 0xAA, mem_prg);
-		this->write_byte((uint16_t)0x0555, 0x55, mem_prg);
-		this->write_byte((uint16_t)0x0AAA, 0xA0, mem_prg);
-		// write the data
-		this->write_byte(address, *(buf++), mem_prg);
+uint16_t Cartridge::program_bytes(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t){
+
+	uint16_t done;
+
+	for( done = 0; done < size; done++ ){
+		flash_program(chip_base(address), address, *(buf++));
 		// wait for completion
-		while(this->toggle_bit(2) != 2);
+		if( !wait_program(address++, geometry.program_max_us) ){
+			break;
+		}
 	}
+	return done;
+}
+
+
+/*******************************************************************//**
+ * multiple 8bit writes at 32bit address
+ **********************************************************************/
+void Cartridge::write_bytes(uint32_t address, const uint8_t *buf, uint16_t size, e_memory_type mem_t){
 
+	for(; size != 0; size--){
+		this->write_byte(address++, *(buf++), mem_t);
+	}
 }
 
+/*******************************************************************//**
+ * split the range in runs of programmed data and runs of erased data,
+ * only the programmed runs are sent to the flash
+ **********************************************************************/
+bool Cartridge::program_range(uint32_t address, const uint8_t *buf, uint16_t size, e_memory_type mem_t, uint16_t &programmed){
+
+	uint16_t start, end, done;
+	Perf::Probe probe(Perf::stage_bus_program);
+
+	programmed = 0;
+
+	if( param.bus_size == 8 ){
+		for( start = 0; start < size; start = end ){
+			while( start < size && buf[start] == 0xFF ){
+				start++;
+			}
+			for( end = start; end < size && buf[end] != 0xFF; end++ );
+			if( end != start ){
+				done = program_bytes(address + start, const_cast<uint8_t *>(buf + start), end - start, mem_t);
+				programmed += done;
+				if( done != end - start ){
+					return false;
+				}
+			}
+		}
+	}else{
+		const uint16_t *words = reinterpret_cast<const uint16_t *>(buf);
+		size &= ~1;
+		for( start = 0; start < size; start = end ){
+			while( start < size && words[start >> 1] == 0xFFFF ){
+				start += 2;
+			}
+			for( end = start; end < size && words[end >> 1] != 0xFFFF; end += 2 );
+			if( end != start ){
+				done = program_words(address + start, const_cast<uint16_t *>(words + (start >> 1)), end - start, mem_t);
+				programmed += done;
+				if( done != end - start ){
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
 
 /*******************************************************************//**
 * 16 BIT OPERATIONS
@@ -362,13 +522,34 @@ uint16_t Cartridge::read_word(uint32_t address, e_memory_type mem_t){
  **********************************************************************/
 void Cartridge::read_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t, bool dma){
 	uint32_t fsmc_addr = UMD_CE3 | address;
+	Perf::Probe probe(Perf::stage_bus_read);
 
-	for(; size != 0; size -= 2){
+	// a trailing odd byte isn't a bus word, it's left alone
+	for(; size > 1; size -= 2){
 		*(buf++) = *(__IO uint16_t *)(fsmc_addr);
 		fsmc_addr += 2;
 	}
 }
 
+/*******************************************************************//**
+ * native bus width read, synchronous
+ **********************************************************************/
+void Cartridge::read_async(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t){
+
+	if( param.bus_size == 8 ){
+		read_bytes(address, buf, size, mem_t);
+	}else{
+		read_words(address, (uint16_t *)buf, size, mem_t);
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+bool Cartridge::read_wait(bool bus_order){
+	return false;
+}
+
 /*******************************************************************//**
  * single 16 bit write at 32bit address
  **********************************************************************/
@@ -380,15 +561,17 @@ void Cartridge::write_word(uint32_t address, uint16_t data, e_memory_type mem_t)
 /*******************************************************************//**
  * single 16 bit program at 32bit address
  **********************************************************************/
-void Cartridge::program_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t){
-
-	for(; size > 0; size -= 2){
-		this->write_word((uint32_t)0x0AAA << 1, 0x00AA, mem_prg);
-		this->write_word((uint32_t)0x0555 << 1, 0x0055, mem_prg);
-		this->write_word((uint32_t)0x0AAA << 1, 0x00A0, mem_prg);
-		// write the data
-		this->write_word(address, *(buf++), mem_prg);
+uint16_t Cartridge::program_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t){
+
+	uint16_t done;
+
+	for( done = 0; done + 2 <= size; done += 2 ){
+		flash_program(chip_base(address), address, *(buf++));
 		// wait for completion
-		while(this->toggle_bit(2) != 2);
+		if( !wait_program(address, geometry.program_max_us) ){
+			break;
+		}
+		address += 2;
 	}
+	return done;
 }
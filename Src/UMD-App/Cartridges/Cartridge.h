@@ -25,6 +25,8 @@
 
 #include <cstdint>
 #include "dma.h"
+#include "../Perf.h"
+#include "../Trace.h"
 
 /*******************************************************************//**
  * \class cartridge
@@ -35,9 +37,17 @@ public:
 	Cartridge();
 	virtual ~Cartridge();
 
+	// operations a cartridge implements, reported to the host by the capabilities command
+	enum e_cart_op : uint16_t {
+		op_none=0, op_read=0x0001, op_program=0x0002, op_erase=0x0004, op_flash_id=0x0008, op_dma_read=0x0010,
+		op_save_ram=0x0020, op_bank_mapper=0x0040, op_chr_rom=0x0080
+	};
+
 	struct s_param{
 		uint8_t id;
 		uint8_t bus_size;
+		uint16_t ops;				///< e_cart_op flags
+		uint32_t save_size;			///< save ram bytes with op_save_ram
 		DMA_HandleTypeDef *dma_channel;
 	}param;
 
@@ -47,6 +57,60 @@ public:
 		uint32_t size;
 	} flash_info;
 
+	// where the flash geometry came from
+	enum e_geometry_source : uint8_t {
+		geometry_unprobed=0, geometry_default, geometry_table, geometry_cfi
+	};
+
+	#define FLASH_MAX_REGIONS		4
+	#define FLASH_MAX_CHIPS			4		///< identical chips one after the other in the address space
+
+	/*******************************************************************//**
+	 * \brief s_flash_geometry
+	 * erase block regions from the lowest address up, the times are the
+	 * typical and worst case of the chip. A board with several chips has
+	 * them back to back, each described by the geometry. Replied as is
+	 * by the flash geometry command.
+	 **********************************************************************/
+	struct s_flash_geometry {
+		uint32_t size;						///< of one chip
+		uint16_t write_buffer;				///< bytes per buffered program, 0 without a write buffer
+		uint8_t source;						///< e_geometry_source
+		uint8_t region_count;
+		struct {
+			uint32_t sector_size;
+			uint32_t sectors;
+		} region[FLASH_MAX_REGIONS];
+		uint32_t program_typ_us;			///< one bus word
+		uint32_t program_max_us;
+		uint32_t buffer_typ_us;				///< a full write buffer
+		uint32_t buffer_max_us;
+		uint32_t erase_typ_ms;				///< one sector
+		uint32_t erase_max_ms;
+		uint32_t chip_erase_typ_ms;
+		uint32_t chip_erase_max_ms;
+		uint8_t chips;
+		uint8_t flags;						///< FLASH_xxx
+		uint8_t page_words;					///< bus words of a page mode read, 0 without page mode
+		uint8_t reserved[1];
+	} geometry;
+
+	/*******************************************************************//**
+	 * \brief s_rom_info
+	 * layout of the rom found by cartridges which can read it from the
+	 * cartridge, a 0 size when it isn't known. Replied as is by the rom
+	 * info command.
+	 **********************************************************************/
+	struct s_rom_info {
+		uint32_t size;
+		uint32_t header;					///< offset of the internal header in the rom
+		uint8_t mapping;					///< cartridge specific
+		uint8_t reserved[3];
+	} rom_info;
+
+	// s_flash_geometry flags
+	#define FLASH_ERASE_SUSPEND		0x01	///< a sector erase can be suspended to program other sectors
+
 	// common methods
 	// Cartridge Methods
 	enum eVoltage : uint8_t {
@@ -74,10 +138,52 @@ public:
 
 	// cartridge methods
 	virtual void init(void);
-	virtual void erase_flash(bool wait);
+	// erases return false if they were waited on and didn't finish within the chip's worst case
+	virtual bool erase_flash(bool wait);
+	virtual bool erase_sector(uint32_t address, bool wait);
 	virtual void get_flash_id(void);
 	virtual uint16_t toggle_bit(uint16_t attempts);
-	void find_flash_size(void);
+	// read the rom layout from the cartridge's header into rom_info
+	virtual void find_rom_info(void);
+	// select the board's mapper by its iNES number for prg_size bytes of program rom,
+	// false if the cartridge doesn't have it or it can't switch that much
+	virtual bool set_mapper(uint16_t number, uint32_t prg_size);
+
+	// flash geometry, from the chip's CFI query or from the chip table by id, get_flash_id() looks for it
+	void find_flash_geometry(void);
+	void reset_geometry(void);
+	bool sector_bounds(uint32_t address, uint32_t &start, uint32_t &size);
+	bool erase_range(uint32_t address, uint32_t size);
+	uint32_t inline chip_base(uint32_t address){ return (geometry.chips > 1) ? (address & ~(geometry.size - 1)) : 0; };
+
+	// a run of data for one chip of a multi chip board
+	#define PROGRAM_LANES			FLASH_MAX_CHIPS	///< a lane per chip
+	#define PROGRAM_LANE_DEPTH		2		///< runs queued on a lane, the next run starts as soon as the last word of a run is given
+	struct s_lane {
+		uint32_t address;
+		const uint8_t *data;
+		uint16_t size;
+	};
+
+	// Programs runs on different chips at once, while one chip is busy with a word the next chip is
+	// given its own. The caller queues runs and calls program_step() whenever it waits on something
+	// else, so the chips keep programming while the next runs are received. Erased words are skipped
+	// like program_range() does, and a word past its worst case drops every run left. A queued run's
+	// data must be left alone until program_queued() is false.
+	void program_start(void);
+	bool program_queue(const s_lane &run);
+	bool program_step(void);
+	bool program_queued(const uint8_t *data);
+	bool program_finish(uint32_t &programmed);
+
+	// a sector erase left running while other sectors are programmed, started with erase_sector(address, false).
+	// Only the chip erasing needs the suspend, the other chips of a board program alongside.
+	bool erase_busy(uint32_t address){ return flash_busy(address); };
+	bool erase_wait(uint32_t address, uint32_t start){ return wait_erase(address, false, start); };
+	bool erase_suspend(uint32_t address);
+	void erase_resume(uint32_t address);
+	// give up on an operation running past its worst case, the chip holding address goes back to read mode
+	void flash_reset(uint32_t address){ flash_command(chip_base(address), 0, 0xF0); };
 
 	// 8 bit operations, default to CE0, the base cart implementation ignores mem_t
 	// 16 bit address read/write operations ignore the mapper
@@ -89,8 +195,10 @@ public:
 
 	virtual void write_byte(uint16_t address, uint8_t data, e_memory_type mem_t);
 	virtual void write_byte(uint32_t address, uint8_t data, e_memory_type mem_t);
+	virtual void write_bytes(uint32_t address, const uint8_t *buf, uint16_t size, e_memory_type mem_t);
 
-	virtual void program_bytes(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t);
+	// programs return the bytes done before a word timed out, size when every word finished
+	virtual uint16_t program_bytes(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t);
 
 	// 16 bit operations default to CE3, the base cart implementation ignores mem_t
 	virtual uint16_t read_word(uint32_t address, e_memory_type mem_t);
@@ -98,16 +206,93 @@ public:
 
 	virtual void write_word(uint32_t address, uint16_t data, e_memory_type mem_t);
 
-	virtual void program_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t);
+	virtual uint16_t program_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t);
+
+	/*******************************************************************//**
+	 * \brief program a range at the cartridge's bus width, the erased value
+	 *        (0xFF or 0xFFFF) is skipped since the flash already holds it
+	 * \param programmed number of bytes actually programmed
+	 * \return false if a word timed out, programming stops there
+	 **********************************************************************/
+	bool program_range(uint32_t address, const uint8_t *buf, uint16_t size, e_memory_type mem_t, uint16_t &programmed);
+
+	// reads on the cartridge's native bus width, a cartridge with DMA returns as soon as the transfer
+	// is started so the caller can work on the previous buffer. read_wait() must be called before
+	// buf is used or another cartridge operation is started. The base implementation reads synchronously.
+	// With bus_order a big endian cartridge may leave the halfwords unswapped for a caller which can
+	// fold the swap into its own pass, the return value tells if it did.
+	virtual void read_async(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t);
+	virtual bool read_wait(bool bus_order = false);
 
 protected:
 
+	// command and query cycles at an offset of the chip at address chip, offsets are in bus units.
+	// Chip 0 is reached without the mapper.
+	virtual void flash_command(uint32_t chip, uint32_t offset, uint8_t command);
+	virtual uint8_t flash_query(uint32_t chip, uint32_t offset);
+	// unlock, program command and one bus word of data, returns without waiting
+	virtual void flash_program(uint32_t chip, uint32_t address, uint16_t data);
+	bool query_cfi(void);
+	bool lookup_chip(void);
+	void find_flash_chips(void);
+
+	/*******************************************************************//**
+	 * \brief s_bus_timing
+	 * FSMC timing of a chip enable in HCLK cycles, the extended mode gives
+	 * reads and writes their own. page_data is the data phase of a read
+	 * within the flash's page, 0 keeps page mode reads off for the bank
+	 * and is what every adapter uses until page reads are proven on a board.
+	 **********************************************************************/
+	struct s_bus_timing {
+		uint8_t read_setup;
+		uint8_t read_data;
+		uint8_t read_turnaround;
+		uint8_t write_setup;
+		uint8_t write_data;
+		uint8_t write_turnaround;
+		uint8_t page_data;
+	};
+	static const s_bus_timing BUS_TIMING_DEFAULT;
+
+	// set at init by each cartridge for the chip enables it uses
+	void set_bus_timing(uint32_t ce, const s_bus_timing &timing);
+	// keep a faster read timing only if the rom reads the same with a cycle less
+	bool tune_read_timing(uint32_t ce, const s_bus_timing &fast, const s_bus_timing &safe);
+	static const uint16_t TIMING_SAMPLE_WORDS = 128;
+	static const uint8_t TIMING_SAMPLE_PASSES = 4;
+
+	// DMA reads of a flash with page mode, opted in by a page_data in the adapter's timing. start
+	// switches the bank to the page timing if it can and end restores it and checks the whole transfer
+	bool page_read_start(uint32_t fsmc_addr);
+	void page_read_end(uint32_t fsmc_addr, uint8_t *buf, uint16_t size);
+
+	// the toggle bit of the chip holding address, give up past the chip's worst case
+	bool flash_busy(uint32_t address);
+	bool wait_program(uint32_t address, uint32_t max_us);
+	bool wait_erase(uint32_t address, bool chip_erase){ return wait_erase(address, chip_erase, HAL_GetTick()); };
+	bool wait_erase(uint32_t address, bool chip_erase, uint32_t start);
+
 	//FSMC address offsets
 	const uint32_t UMD_CE0 = 0x60000000U;
 	const uint32_t UMD_CE1 = 0x64000000U;
 	const uint32_t UMD_CE2 = 0x68000000U;
 	const uint32_t UMD_CE3 = 0x6C000000U;
 	uint32_t default_ce = UMD_CE0;
+	uint8_t inline fsmc_bank(uint32_t fsmc_addr){ return (fsmc_addr >> 26) & 0x03; };
+	s_bus_timing bus_timing[4];
+
+	// lanes of program_step(), runs[i][0] is the one being programmed
+	struct {
+		s_lane		runs[PROGRAM_LANES][PROGRAM_LANE_DEPTH];
+		uint8_t		queued[PROGRAM_LANES];
+		uint16_t	pos[PROGRAM_LANES];					///< next byte of runs[i][0]
+		uint32_t	address[PROGRAM_LANES];				///< word in flight
+		uint32_t	started[PROGRAM_LANES];				///< Perf::now() of the word in flight
+		bool		busy[PROGRAM_LANES];
+		bool		failed;								///< a word timed out
+		uint32_t	programmed;							///< words which finished
+	} program;
+	uint8_t program_lane(uint32_t address);
 
 };
 
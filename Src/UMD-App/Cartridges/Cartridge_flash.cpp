@@ -0,0 +1,644 @@
+/*******************************************************************//**
+ *  \file Cartridge_flash.cpp
+ *  \author René Richard
+ *  \brief Flash geometry discovery, from the CFI query or the chip table,
+ *         the bounded waits on the flash's toggle bit and programming
+ *         interleaved across the chips of a board.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Cartridge.h"
+
+#define FLASH_SUSPEND_US		50		///< erase suspend latency, 20us on the parts in the table
+#define FLASH_TOGGLE_BYTE		0x40	///< DQ6
+#define FLASH_TOGGLE_WORD		0x4040	///< DQ6 in either byte of the bus word
+
+// boot block layouts of the chip table, the boot end of the chip is split into smaller sectors
+enum e_boot_layout : uint8_t {
+	boot_none=0,				///< uniform sectors
+	boot_16_8_8_32_bottom,		///< 16KB, 8KB, 8KB, 32KB then 64KB sectors
+	boot_16_8_8_32_top,
+	boot_8x8k_bottom,			///< eight 8KB sectors then 64KB sectors
+	boot_8x8k_top
+};
+
+/*******************************************************************//**
+ * \brief s_chip
+ * chips that don't answer the CFI query, or answer it somewhere else.
+ * Sizes and times are log2 like the CFI fields: bytes, us for programs
+ * and ms for erases.
+ **********************************************************************/
+struct s_chip {
+	uint8_t manufacturer;
+	uint8_t device;
+	uint8_t size;
+	uint8_t sector;
+	uint8_t boot;				///< e_boot_layout
+	uint8_t buffer;				///< 0 without a write buffer
+	uint8_t flags;				///< FLASH_xxx
+	uint8_t program_typ;
+	uint8_t program_max;
+	uint8_t erase_typ;
+	uint8_t erase_max;
+	uint8_t chip_erase_typ;
+	uint8_t chip_erase_max;
+};
+
+static const s_chip chip_table[] = {
+	// microchip, 4KB sectors
+	{ 0xBF, 0x6D, 23, 12, boot_none, 0, 0, 3, 4, 4, 5, 5, 6 },										// SST39VF6401B
+	{ 0xBF, 0x6C, 23, 12, boot_none, 0, 0, 3, 4, 4, 5, 5, 6 },										// SST39VF6402B
+	{ 0xBF, 0x5D, 22, 12, boot_none, 0, 0, 3, 4, 4, 5, 5, 6 },										// SST39VF3201B
+	{ 0xBF, 0x5C, 22, 12, boot_none, 0, 0, 3, 4, 4, 5, 5, 6 },										// SST39VF3202B
+	{ 0xBF, 0x5B, 22, 12, boot_none, 0, 0, 3, 4, 4, 5, 5, 6 },										// SST39VF3201
+	{ 0xBF, 0x5A, 22, 12, boot_none, 0, 0, 3, 4, 4, 5, 5, 6 },										// SST39VF3202
+	{ 0xBF, 0x4F, 21, 12, boot_none, 0, 0, 3, 4, 4, 5, 5, 6 },										// SST39VF1601C
+	{ 0xBF, 0x4E, 21, 12, boot_none, 0, 0, 3, 4, 4, 5, 5, 6 },										// SST39VF1602C
+	{ 0xBF, 0x4B, 21, 12, boot_none, 0, 0, 3, 4, 4, 5, 5, 6 },										// SST39VF1601
+	{ 0xBF, 0x4A, 21, 12, boot_none, 0, 0, 3, 4, 4, 5, 5, 6 },										// SST39VF1602
+	// macronix 3.3V
+	{ 0xC2, 0xC9, 23, 16, boot_8x8k_top, 0, FLASH_ERASE_SUSPEND, 4, 9, 10, 14, 16, 18 },			// MX29LV640ET
+	{ 0xC2, 0xCB, 23, 16, boot_8x8k_bottom, 0, FLASH_ERASE_SUSPEND, 4, 9, 10, 14, 16, 18 },			// MX29LV640EB
+	{ 0xC2, 0xA7, 22, 16, boot_8x8k_top, 0, FLASH_ERASE_SUSPEND, 4, 9, 10, 14, 15, 17 },			// MX29LV320ET
+	{ 0xC2, 0xA8, 22, 16, boot_8x8k_bottom, 0, FLASH_ERASE_SUSPEND, 4, 9, 10, 14, 15, 17 },			// MX29LV320EB
+	{ 0xC2, 0xC4, 21, 16, boot_16_8_8_32_top, 0, FLASH_ERASE_SUSPEND, 4, 9, 10, 14, 14, 16 },		// MX29LV160DT
+	{ 0xC2, 0x49, 21, 16, boot_16_8_8_32_bottom, 0, FLASH_ERASE_SUSPEND, 4, 9, 10, 14, 14, 16 },	// MX29LV160DB
+	// macronix 5V
+	{ 0xC2, 0x58, 20, 16, boot_16_8_8_32_top, 0, FLASH_ERASE_SUSPEND, 3, 9, 10, 14, 14, 16 },		// MX29F800CT
+	{ 0xC2, 0xD6, 20, 16, boot_16_8_8_32_bottom, 0, FLASH_ERASE_SUSPEND, 3, 9, 10, 14, 14, 16 },	// MX29F800CB
+	{ 0xC2, 0x23, 19, 16, boot_16_8_8_32_top, 0, FLASH_ERASE_SUSPEND, 3, 9, 10, 14, 13, 15 },		// MX29F400CT
+	{ 0xC2, 0xAB, 19, 16, boot_16_8_8_32_bottom, 0, FLASH_ERASE_SUSPEND, 3, 9, 10, 14, 13, 15 },	// MX29F400CB
+	{ 0xC2, 0x51, 18, 16, boot_16_8_8_32_top, 0, FLASH_ERASE_SUSPEND, 3, 9, 10, 14, 12, 14 },		// MX29F200CT
+	{ 0xC2, 0x57, 18, 16, boot_16_8_8_32_bottom, 0, FLASH_ERASE_SUSPEND, 3, 9, 10, 14, 12, 14 },	// MX29F200CB
+};
+
+/*******************************************************************//**
+ * worst case times of the chips the board has been used with, nothing
+ * is known of the layout so the size stays 0
+ **********************************************************************/
+void Cartridge::reset_geometry(void){
+
+	geometry.size = 0;
+	geometry.write_buffer = 0;
+	geometry.source = geometry_unprobed;
+	geometry.region_count = 0;
+	for( uint8_t i = 0; i < FLASH_MAX_REGIONS; i++ ){
+		geometry.region[i].sector_size = 0;
+		geometry.region[i].sectors = 0;
+	}
+	geometry.program_typ_us = 16;
+	geometry.program_max_us = 1000;
+	geometry.buffer_typ_us = 0;
+	geometry.buffer_max_us = 0;
+	geometry.erase_typ_ms = 1000;
+	geometry.erase_max_ms = 30000;
+	geometry.chip_erase_typ_ms = 60000;
+	geometry.chip_erase_max_ms = 600000;
+	geometry.chips = 1;
+	geometry.flags = 0;
+	geometry.page_words = 0;
+	geometry.reserved[0] = 0;
+}
+
+/*******************************************************************//**
+ * Called by get_flash_id() once the manufacturer and device are read,
+ * the CFI query wins over the table since it describes the exact part
+ **********************************************************************/
+void Cartridge::find_flash_geometry(void){
+
+	reset_geometry();
+	if( query_cfi() ){
+		geometry.source = geometry_cfi;
+	}else if( lookup_chip() ){
+		geometry.source = geometry_table;
+	}else{
+		geometry.source = geometry_default;
+	}
+	if( geometry.size != 0 ){
+		find_flash_chips();
+	}
+	flash_info.size = geometry.size * geometry.chips;
+}
+
+/*******************************************************************//**
+ * byte wide chips, or x16 chips in byte mode
+ **********************************************************************/
+void Cartridge::flash_command(uint32_t chip, uint32_t offset, uint8_t command){
+	if( chip == 0 ){
+		this->write_byte((uint16_t)offset, command, mem_prg);
+	}else{
+		this->write_byte(chip + offset, command, mem_prg);
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint8_t Cartridge::flash_query(uint32_t chip, uint32_t offset){
+	if( chip == 0 ){
+		return this->read_byte((uint16_t)offset, mem_prg);
+	}
+	return this->read_byte(chip + offset, mem_prg);
+}
+
+/*******************************************************************//**
+ * the unlock cycles are those of program_bytes() and program_words()
+ **********************************************************************/
+void Cartridge::flash_program(uint32_t chip, uint32_t address, uint16_t data){
+	if( param.bus_size == 16 ){
+		this->write_word(chip + ((uint32_t)0x0AAA << 1), 0x00AA, mem_prg);
+		this->write_word(chip + ((uint32_t)0x0555 << 1), 0x0055, mem_prg);
+		this->write_word(chip + ((uint32_t)0x0AAA << 1), 0x00A0, mem_prg);
+		this->write_word(address, data, mem_prg);
+	}else{
+		// first write goes through mapper to ensure page gets reset to 0
+		this->write_byte(chip + (uint32_t)0x0AAA, (uint8_t)0xAA, mem_prg);
+		flash_command(chip, 0x0555, 0x55);
+		flash_command(chip, 0x0AAA, 0xA0);
+		this->write_byte(address, (uint8_t)data, mem_prg);
+	}
+}
+
+/*******************************************************************//**
+ * The query is tried at word offsets, then at byte offsets for x16
+ * chips in byte mode where every field sits at twice its offset.
+ * \return true if the chip answered with "QRY"
+ **********************************************************************/
+bool Cartridge::query_cfi(void){
+
+	uint8_t shift, regions, pri, boot, suspend, page;
+	uint8_t typ[4], max[4];
+	uint16_t buffer;
+	uint32_t sectors, sector_size;
+
+	for( shift = 0; shift < 2; shift++ ){
+		flash_command(0, (uint32_t)0x55 << shift, 0x98);
+		if( flash_query(0, (uint32_t)0x10 << shift) == 'Q' && flash_query(0, (uint32_t)0x11 << shift) == 'R'
+				&& flash_query(0, (uint32_t)0x12 << shift) == 'Y' ){
+			break;
+		}
+		flash_command(0, 0, 0xF0);
+	}
+	if( shift == 2 ){
+		return false;
+	}
+
+	// typical times are 2^n, the maximums are 2^n times the typical, 0 when the operation isn't supported
+	for( uint8_t i = 0; i < 4; i++ ){
+		typ[i] = flash_query(0, (uint32_t)(0x1F + i) << shift);
+		max[i] = flash_query(0, (uint32_t)(0x23 + i) << shift);
+	}
+	geometry.size = 1UL << (flash_query(0, (uint32_t)0x27 << shift) & 0x1F);
+	buffer = flash_query(0, (uint32_t)0x2A << shift) | (flash_query(0, (uint32_t)0x2B << shift) << 8);
+	geometry.write_buffer = (buffer != 0 && buffer < 16) ? (1U << buffer) : 0;
+	if( typ[0] != 0 ){
+		geometry.program_typ_us = 1UL << typ[0];
+		geometry.program_max_us = geometry.program_typ_us << max[0];
+	}
+	if( typ[1] != 0 && geometry.write_buffer != 0 ){
+		geometry.buffer_typ_us = 1UL << typ[1];
+		geometry.buffer_max_us = geometry.buffer_typ_us << max[1];
+	}
+	if( typ[2] != 0 ){
+		geometry.erase_typ_ms = 1UL << typ[2];
+		geometry.erase_max_ms = geometry.erase_typ_ms << max[2];
+	}
+	if( typ[3] != 0 ){
+		geometry.chip_erase_typ_ms = 1UL << typ[3];
+		geometry.chip_erase_max_ms = geometry.chip_erase_typ_ms << max[3];
+	}
+
+	// each region is the sector count - 1 and the sector size / 256, where 0 means 128 bytes
+	regions = flash_query(0, (uint32_t)0x2C << shift);
+	if( regions > FLASH_MAX_REGIONS ){
+		regions = FLASH_MAX_REGIONS;
+	}
+	for( uint8_t i = 0; i < regions; i++ ){
+		uint32_t base = 0x2D + 4 * i;
+		sectors = flash_query(0, base << shift) | (flash_query(0, (base + 1) << shift) << 8);
+		sector_size = flash_query(0, (base + 2) << shift) | (flash_query(0, (base + 3) << shift) << 8);
+		geometry.region[i].sectors = sectors + 1;
+		geometry.region[i].sector_size = sector_size ? (sector_size << 8) : 128;
+	}
+	geometry.region_count = regions;
+
+	// AMD style top boot chips list their regions from the bottom up, the primary table tells which end is the boot
+	pri = flash_query(0, (uint32_t)0x15 << shift);
+	if( flash_query(0, (uint32_t)pri << shift) == 'P' && flash_query(0, (uint32_t)(pri + 1) << shift) == 'R'
+			&& flash_query(0, (uint32_t)(pri + 2) << shift) == 'I' && flash_query(0, (uint32_t)(pri + 4) << shift) >= '1' ){
+		// 2 is reads and programs while suspended
+		suspend = flash_query(0, (uint32_t)(pri + 0x06) << shift);
+		if( suspend >= 2 ){
+			geometry.flags |= FLASH_ERASE_SUSPEND;
+		}
+		// 1, 2 and 3 are pages of 4, 8 and 16 words
+		page = flash_query(0, (uint32_t)(pri + 0x0C) << shift);
+		if( page >= 1 && page <= 3 ){
+			geometry.page_words = 2 << page;
+		}
+		boot = flash_query(0, (uint32_t)(pri + 0x0F) << shift);
+		if( boot == 3 ){
+			for( uint8_t i = 0; i < regions / 2; i++ ){
+				uint32_t swap_size = geometry.region[i].sector_size;
+				uint32_t swap_count = geometry.region[i].sectors;
+				geometry.region[i] = geometry.region[regions - 1 - i];
+				geometry.region[regions - 1 - i].sector_size = swap_size;
+				geometry.region[regions - 1 - i].sectors = swap_count;
+			}
+		}
+	}
+
+	flash_command(0, 0, 0xF0);
+	return true;
+}
+
+/*******************************************************************//**
+ * \return true if the manufacturer and device are in the chip table
+ **********************************************************************/
+bool Cartridge::lookup_chip(void){
+
+	const s_chip *chip = nullptr;
+	uint32_t big_sectors;
+
+	for( const s_chip &entry : chip_table ){
+		if( entry.manufacturer == flash_info.manufacturer && entry.device == flash_info.device ){
+			chip = &entry;
+			break;
+		}
+	}
+	if( chip == nullptr ){
+		return false;
+	}
+
+	geometry.size = 1UL << chip->size;
+	geometry.write_buffer = chip->buffer ? (1U << chip->buffer) : 0;
+	geometry.flags = chip->flags;
+	geometry.program_typ_us = 1UL << chip->program_typ;
+	geometry.program_max_us = 1UL << chip->program_max;
+	geometry.erase_typ_ms = 1UL << chip->erase_typ;
+	geometry.erase_max_ms = 1UL << chip->erase_max;
+	geometry.chip_erase_typ_ms = 1UL << chip->chip_erase_typ;
+	geometry.chip_erase_max_ms = 1UL << chip->chip_erase_max;
+
+	// the boot block takes the place of one big sector
+	big_sectors = geometry.size >> chip->sector;
+	switch( chip->boot ){
+	case boot_16_8_8_32_bottom:
+		geometry.region[0] = { 0x4000, 1 };
+		geometry.region[1] = { 0x2000, 2 };
+		geometry.region[2] = { 0x8000, 1 };
+		geometry.region[3] = { 1UL << chip->sector, big_sectors - 1 };
+		geometry.region_count = 4;
+		break;
+	case boot_16_8_8_32_top:
+		geometry.region[0] = { 1UL << chip->sector, big_sectors - 1 };
+		geometry.region[1] = { 0x8000, 1 };
+		geometry.region[2] = { 0x2000, 2 };
+		geometry.region[3] = { 0x4000, 1 };
+		geometry.region_count = 4;
+		break;
+	case boot_8x8k_bottom:
+		geometry.region[0] = { 0x2000, 8 };
+		geometry.region[1] = { 1UL << chip->sector, big_sectors - 1 };
+		geometry.region_count = 2;
+		break;
+	case boot_8x8k_top:
+		geometry.region[0] = { 1UL << chip->sector, big_sectors - 1 };
+		geometry.region[1] = { 0x2000, 8 };
+		geometry.region_count = 2;
+		break;
+	default:
+		geometry.region[0] = { 1UL << chip->sector, big_sectors };
+		geometry.region_count = 1;
+		break;
+	}
+	return true;
+}
+
+/*******************************************************************//**
+ * A second chip answers the id at the next multiple of the chip size.
+ * A board that doesn't decode the address there mirrors chip 0, which
+ * is caught by chip 0 showing its id instead of its data.
+ **********************************************************************/
+void Cartridge::find_flash_chips(void){
+
+	uint8_t data[2], alias[2], id[2];
+
+	data[0] = flash_query(0, 0);
+	data[1] = flash_query(0, 1);
+	for( geometry.chips = 1; geometry.chips < FLASH_MAX_CHIPS; geometry.chips++ ){
+		uint32_t chip = geometry.size * geometry.chips;
+		flash_command(chip, 0x0AAA, 0xAA);
+		flash_command(chip, 0x0555, 0x55);
+		flash_command(chip, 0x0AAA, 0x90);
+		id[0] = flash_query(chip, 0);
+		id[1] = flash_query(chip, 1);
+		alias[0] = flash_query(0, 0);
+		alias[1] = flash_query(0, 1);
+		flash_command(chip, 0, 0xF0);
+		flash_command(0, 0, 0xF0);
+		if( id[0] != flash_info.manufacturer || id[1] != flash_info.device || alias[0] != data[0] || alias[1] != data[1] ){
+			break;
+		}
+	}
+}
+
+/*******************************************************************//**
+ * \return false if the address is past the known sectors
+ **********************************************************************/
+bool Cartridge::sector_bounds(uint32_t address, uint32_t &start, uint32_t &size){
+
+	uint32_t base = chip_base(address);
+
+	// every chip has the same layout
+	if( geometry.chips > 1 && base >= geometry.size * geometry.chips ){
+		return false;
+	}
+	for( uint8_t i = 0; i < geometry.region_count; i++ ){
+		uint32_t region_size = geometry.region[i].sector_size * geometry.region[i].sectors;
+		if( address < base + region_size ){
+			size = geometry.region[i].sector_size;
+			start = base + ((address - base) / size) * size;
+			return true;
+		}
+		base += region_size;
+	}
+	return false;
+}
+
+/*******************************************************************//**
+ * Erases every sector the range touches, a boot block range is several
+ * small sectors. Without a geometry only the sector at the address is.
+ * \return false at the first sector which didn't finish erasing
+ **********************************************************************/
+bool Cartridge::erase_range(uint32_t address, uint32_t size){
+
+	uint32_t start, sector_size, end;
+
+	if( !sector_bounds(address, start, sector_size) ){
+		return this->erase_sector(address, true);
+	}
+
+	end = address + size;
+	while( start < end ){
+		if( !this->erase_sector(start, true) ){
+			return false;
+		}
+		start += sector_size;
+		if( !sector_bounds(start, start, sector_size) ){
+			break;
+		}
+	}
+	return true;
+}
+
+/*******************************************************************//**
+ * DQ6 flips on every read while the chip is busy, the first read goes
+ * through the mapper to select the chip's page. The other bits are left
+ * out, DQ2 keeps toggling on a suspended sector.
+ **********************************************************************/
+bool Cartridge::flash_busy(uint32_t address){
+	if( param.bus_size == 16 ){
+		return ((this->read_word(address, mem_prg) ^ this->read_word(address, mem_prg)) & FLASH_TOGGLE_WORD) != 0;
+	}
+	return ((this->read_byte(address, mem_prg) ^ this->read_byte(address, mem_prg)) & FLASH_TOGGLE_BYTE) != 0;
+}
+
+/*******************************************************************//**
+ * \return false if the program didn't finish within max_us, the chip is
+ *         reset to read mode
+ **********************************************************************/
+bool Cartridge::wait_program(uint32_t address, uint32_t max_us){
+
+	uint32_t start = Perf::now();
+	uint32_t limit = max_us * (SystemCoreClock / 1000000);
+
+	while( flash_busy(address) ){
+		if( (Perf::now() - start) > limit ){
+			flash_command(chip_base(address), 0, 0xF0);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*******************************************************************//**
+ * Nothing is read back for the first half of the typical time counted
+ * from start, the tick the erase was started at. A long erase shows
+ * it's still going every 250ms.
+ * \return false if the erase didn't finish within the chip's maximum
+ *         time, the chip is reset to read mode
+ **********************************************************************/
+bool Cartridge::wait_erase(uint32_t address, bool chip_erase, uint32_t start){
+
+	uint32_t typ_ms = chip_erase ? geometry.chip_erase_typ_ms : geometry.erase_typ_ms;
+	uint32_t max_ms = chip_erase ? geometry.chip_erase_max_ms : geometry.erase_max_ms;
+	uint32_t event = chip_erase ? TRACE_CHIP_ERASE : address;
+	uint32_t heartbeat = HAL_GetTick();
+	uint32_t polls = 0;
+
+	while( (HAL_GetTick() - start) < typ_ms / 2 ){
+		if( (HAL_GetTick() - heartbeat) > 250 ){
+			heartbeat = HAL_GetTick();
+			trace(TRACE_FLASH_POLL, event, polls);
+		}
+	}
+
+	polls = 1;
+	while( flash_busy(address) ){
+		polls++;
+		if( (HAL_GetTick() - heartbeat) > 250 ){
+			heartbeat = HAL_GetTick();
+			trace(TRACE_FLASH_POLL, event, polls);
+		}
+		if( (HAL_GetTick() - start) > max_ms ){
+			flash_command(chip_base(address), 0, 0xF0);
+			trace(TRACE_FLASH_POLL, event, polls);
+			return false;
+		}
+	}
+	trace(TRACE_FLASH_POLL, event, polls);
+	return true;
+}
+
+/*******************************************************************//**
+ * lanes are indexed by chip, a board with a single chip has one lane
+ **********************************************************************/
+uint8_t Cartridge::program_lane(uint32_t address){
+	return (geometry.chips > 1) ? (chip_base(address) / geometry.size) & (PROGRAM_LANES - 1) : 0;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void Cartridge::program_start(void){
+
+	for( uint8_t i = 0; i < PROGRAM_LANES; i++ ){
+		program.queued[i] = 0;
+		program.pos[i] = 0;
+		program.busy[i] = false;
+	}
+	program.failed = false;
+	program.programmed = 0;
+}
+
+/*******************************************************************//**
+ * \return false if the chip's lane is full, program_step() makes room
+ **********************************************************************/
+bool Cartridge::program_queue(const s_lane &run){
+
+	uint8_t lane = program_lane(run.address);
+
+	if( program.queued[lane] == PROGRAM_LANE_DEPTH ){
+		return false;
+	}
+	program.runs[lane][program.queued[lane]++] = run;
+	return true;
+}
+
+/*******************************************************************//**
+ * One pass over the lanes, each keeps one word in flight on its chip. A
+ * lane whose chip is still busy is passed over, so the program times of
+ * the chips overlap instead of adding up. A word past the chip's worst
+ * case is abandoned like wait_program() does and the runs left are
+ * dropped. A run is done as soon as its last word is given to the chip,
+ * its data is no longer needed, a word is counted once it finished.
+ * \return true while a lane has a word in flight or a run queued
+ **********************************************************************/
+bool Cartridge::program_step(void){
+
+	uint8_t unit = param.bus_size >> 3;
+	uint32_t limit = geometry.program_max_us * (SystemCoreClock / 1000000);
+	bool active = false;
+	Perf::Probe probe(Perf::stage_bus_program);
+
+	auto next_run = [&](uint8_t i){
+		for( uint8_t j = 1; j < program.queued[i]; j++ ){
+			program.runs[i][j - 1] = program.runs[i][j];
+		}
+		program.queued[i]--;
+		program.pos[i] = 0;
+	};
+
+	for( uint8_t i = 0; i < PROGRAM_LANES; i++ ){
+		if( program.busy[i] ){
+			if( flash_busy(program.address[i]) ){
+				if( (Perf::now() - program.started[i]) <= limit ){
+					active = true;
+					continue;
+				}
+				flash_command(chip_base(program.address[i]), 0, 0xF0);
+				program.failed = true;
+			}else{
+				program.programmed += unit;
+			}
+			program.busy[i] = false;
+		}
+		if( program.failed ){
+			program.queued[i] = 0;
+			program.pos[i] = 0;
+		}
+
+		// erased words are already programmed
+		while( program.queued[i] != 0 ){
+			const s_lane &run = program.runs[i][0];
+			while( program.pos[i] < run.size && run.data[program.pos[i]] == 0xFF && (unit == 1 || run.data[program.pos[i] + 1] == 0xFF) ){
+				program.pos[i] += unit;
+			}
+			if( program.pos[i] < run.size ){
+				break;
+			}
+			next_run(i);
+		}
+		if( program.queued[i] == 0 ){
+			continue;
+		}
+
+		const s_lane &run = program.runs[i][0];
+		program.address[i] = run.address + program.pos[i];
+		flash_program(chip_base(program.address[i]), program.address[i],
+			(unit == 1) ? run.data[program.pos[i]] : *reinterpret_cast<const uint16_t *>(&run.data[program.pos[i]]));
+		program.started[i] = Perf::now();
+		program.busy[i] = true;
+		program.pos[i] += unit;
+		if( program.pos[i] >= run.size ){
+			next_run(i);
+		}
+		active = true;
+	}
+
+	return active;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+bool Cartridge::program_queued(const uint8_t *data){
+
+	for( uint8_t i = 0; i < PROGRAM_LANES; i++ ){
+		for( uint8_t j = 0; j < program.queued[i]; j++ ){
+			if( program.runs[i][j].data == data ){
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*******************************************************************//**
+ * \param programmed number of bytes actually programmed since
+ *        program_start() or the last program_finish()
+ * \return false if a word timed out since program_start()
+ **********************************************************************/
+bool Cartridge::program_finish(uint32_t &programmed){
+
+	while( program_step() );
+	programmed = program.programmed;
+	program.programmed = 0;
+	return !program.failed;
+}
+
+/*******************************************************************//**
+ * \return false if the chip can't suspend, or the erase didn't stop
+ *         within the suspend latency, then the erase has to be waited on
+ **********************************************************************/
+bool Cartridge::erase_suspend(uint32_t address){
+
+	uint32_t start = Perf::now();
+	uint32_t limit = FLASH_SUSPEND_US * (SystemCoreClock / 1000000);
+
+	if( !(geometry.flags & FLASH_ERASE_SUSPEND) ){
+		return false;
+	}
+	flash_command(chip_base(address), 0, 0xB0);
+	// the toggle bit stops once the erase is suspended, or done
+	while( flash_busy(address) ){
+		if( (Perf::now() - start) > limit ){
+			// the suspend may still land, the erase must be running when it's waited on
+			erase_resume(address);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*******************************************************************//**
+ * harmless on an erase that completed before the suspend
+ **********************************************************************/
+void Cartridge::erase_resume(uint32_t address){
+	flash_command(chip_base(address), 0, 0x30);
+}
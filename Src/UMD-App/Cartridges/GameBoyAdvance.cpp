@@ -0,0 +1,230 @@
+/*******************************************************************//**
+ *  \file GameBoyAdvance.cpp
+ *  \author René Richard
+ *  \brief This program provides a serial interface over USB to the
+ *         Universal Mega Dumper.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "GameBoyAdvance.h"
+#include "dma.h"
+#include "fsmc.h"
+
+/*******************************************************************//**
+ * one bit per pin spread to the two bits of the pin in MODER
+ **********************************************************************/
+static uint32_t moder_bits(uint16_t pins){
+	uint32_t bits = 0;
+	for( uint8_t i = 0; i < 16; i++ ){
+		if( pins & (1 << i) ){
+			bits |= 1UL << (i << 1);
+		}
+	}
+	return bits;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+GameBoyAdvance::GameBoyAdvance() {}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void GameBoyAdvance::init(void){
+
+	GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+	param.bus_size = 16;
+	param.ops = op_read | op_dma_read;
+	param.dma_channel = &hdma_memtomem_dma2_stream1;
+	reset_geometry();
+	pending_read.buf = nullptr;
+
+	// both chip selects are outputs, high before they're driven so the cart sees no edge
+	HAL_GPIO_WritePin(nCS_GPIO_Port, nCS_Pin | nCS2_Pin, GPIO_PIN_SET);
+	GPIO_InitStruct.Pin = nCS_Pin | nCS2_Pin;
+	GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+	GPIO_InitStruct.Pull = GPIO_NOPULL;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+	HAL_GPIO_Init(nCS_GPIO_Port, &GPIO_InitStruct);
+	end_burst();
+
+	set_bus_timing(GBA_CE, BUS_TIMING_DEFAULT);
+	set_voltage(vcart_3v3);
+	set_level_translators(true);
+}
+
+/*******************************************************************//**
+ * mask roms have no software ID mode
+ **********************************************************************/
+void GameBoyAdvance::get_flash_id(void){
+	end_burst();
+	flash_info.manufacturer = 0;
+	flash_info.device = 0;
+}
+
+/*******************************************************************//**
+ * set the data pins while they're still inputs, then make them outputs
+ **********************************************************************/
+void GameBoyAdvance::drive_ad(uint16_t value){
+
+	uint32_t pins;
+
+	pins = ((value & 0x0003) << 14) | ((value >> 2) & 0x0003) | (((value >> 13) & 0x0007) << 8);
+	GPIOD->BSRR = pins | ((~pins & AD_GPIOD_PINS) << 16);
+	pins = ((value >> 4) & 0x01FF) << 7;
+	GPIOE->BSRR = pins | ((~pins & AD_GPIOE_PINS) << 16);
+
+	GPIOD->MODER = (GPIOD->MODER & ~(moder_bits(AD_GPIOD_PINS) * 3)) | moder_bits(AD_GPIOD_PINS);
+	GPIOE->MODER = (GPIOE->MODER & ~(moder_bits(AD_GPIOE_PINS) * 3)) | moder_bits(AD_GPIOE_PINS);
+}
+
+/*******************************************************************//**
+ * give the data pins back to the FSMC, the alternate function is kept
+ **********************************************************************/
+void GameBoyAdvance::release_ad(void){
+	GPIOD->MODER = (GPIOD->MODER & ~(moder_bits(AD_GPIOD_PINS) * 3)) | (moder_bits(AD_GPIOD_PINS) * 2);
+	GPIOE->MODER = (GPIOE->MODER & ~(moder_bits(AD_GPIOE_PINS) * 3)) | (moder_bits(AD_GPIOE_PINS) * 2);
+}
+
+/*******************************************************************//**
+ * The FSMC address lines keep the value of the last cycle, a read while
+ * /CS is high sets A16-A23 without the cart seeing it. A1-A16 go on the
+ * data pins for the falling edge of /CS.
+ **********************************************************************/
+void GameBoyAdvance::start_burst(uint32_t address){
+
+	end_burst();
+	(void)*(__IO uint16_t *)(GBA_CE | address);
+
+	drive_ad((uint16_t)(address >> 1));
+	// the GPIO writes are in order on the bus, the address is held past the edge by the write to MODER
+	nCS_GPIO_Port->BSRR = (uint32_t)nCS_Pin << 16;
+	release_ad();
+	burst_address = address;
+}
+
+/*******************************************************************//**
+* 8 BIT OPERATIONS
+************************************************************************
+ *
+ **********************************************************************/
+void GameBoyAdvance::write_byte(uint16_t address, uint8_t data, e_memory_type mem_t){
+	end_burst();
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void GameBoyAdvance::write_byte(uint32_t address, uint8_t data, e_memory_type mem_t){
+	end_burst();
+}
+
+/*******************************************************************//**
+* 16 BIT OPERATIONS
+************************************************************************
+ * single 16bit read at 32bit address
+ **********************************************************************/
+uint16_t GameBoyAdvance::read_word(uint32_t address, e_memory_type mem_t){
+	uint16_t read;
+	read_words(address, &read, 2, mem_t);
+	return read;
+}
+
+/*******************************************************************//**
+ * multiple 16bit reads at 32bit address, the address is only latched
+ * when the read doesn't continue the previous one and at every 128KB
+ **********************************************************************/
+void GameBoyAdvance::read_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t, bool dma){
+	uint32_t fsmc_addr, offset;
+	uint16_t len;
+	Perf::Probe probe(Perf::stage_bus_read);
+
+	for(; size > 1; size -= len){
+		offset = address & (BURST_SIZE - 1);
+		len = size & ~1;
+		if( len > BURST_SIZE - offset ){
+			len = BURST_SIZE - offset;
+		}
+		// the counter wrapped at the end of the last block
+		if( address != burst_address || offset == 0 ){
+			start_burst(address);
+		}
+		fsmc_addr = GBA_CE | address;
+		address += len;
+		burst_address = address;
+
+		if(dma){
+			HAL_DMA_Start(param.dma_channel, fsmc_addr, (uint32_t)buf, len >> 1);
+			HAL_DMA_PollForTransfer(param.dma_channel, HAL_DMA_FULL_TRANSFER, DMA_TIMEOUT);
+			buf += len >> 1;
+		}else{
+			// every read is a single /RD pulse, the address lines past A16 don't change within the block
+			for( uint16_t i = len; i > 1; i -= 2 ){
+				*(buf++) = *(__IO uint16_t *)(fsmc_addr);
+				fsmc_addr += 2;
+			}
+		}
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void GameBoyAdvance::write_word(uint32_t address, uint16_t data, e_memory_type mem_t){
+	end_burst();
+}
+
+/*******************************************************************//**
+ * a read crossing a 128KB block is latched twice, it's done synchronously
+ **********************************************************************/
+void GameBoyAdvance::read_async(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t){
+
+	uint32_t offset = address & (BURST_SIZE - 1);
+
+	read_wait();
+	if( offset + size > BURST_SIZE ){
+		read_words(address, (uint16_t *)buf, size, mem_t, true);
+		return;
+	}
+
+	if( address != burst_address || offset == 0 ){
+		start_burst(address);
+	}
+	burst_address = address + size;
+	pending_read.buf = (uint16_t *)buf;
+	pending_read.size = size;
+	HAL_DMA_Start(param.dma_channel, GBA_CE | address, (uint32_t)buf, size >> 1);
+}
+
+/*******************************************************************//**
+ * the bus is little endian, nothing is left to swap
+ **********************************************************************/
+bool GameBoyAdvance::read_wait(bool bus_order){
+
+	if( pending_read.buf == nullptr ){
+		return false;
+	}
+	uint32_t start = Perf::now();
+	HAL_DMA_PollForTransfer(param.dma_channel, HAL_DMA_FULL_TRANSFER, DMA_TIMEOUT);
+	start = Perf::now() - start;
+	Perf::stage(Perf::stage_dma_wait, start);
+	trace(TRACE_DMA_DONE, pending_read.size, start);
+	pending_read.buf = nullptr;
+	return false;
+}
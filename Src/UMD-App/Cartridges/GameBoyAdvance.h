@@ -0,0 +1,107 @@
+/*******************************************************************//**
+ *  \file GameBoyAdvance.h
+ *  \author René Richard
+ *  \brief This program allows to read and write to various game cartridges.
+ *         The UMD base class handles all generic cartridge operations, console
+ *         specific operations are handled in derived classes.
+ *
+ * \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CARTRIDGES_GAMEBOYADVANCE_H_
+#define CARTRIDGES_GAMEBOYADVANCE_H_
+
+#include "Cartridge.h"
+
+/*******************************************************************//**
+ * \class GameBoyAdvance
+ * \brief The cartridge bus multiplexes A0-A15 with the data on AD0-AD15,
+ *        the cartridge latches them on the falling edge of /CS and counts
+ *        up on every /RD pulse while /CS stays low. A16-A23 are on the
+ *        FSMC address lines of the same name and aren't counted, a burst
+ *        stops at the end of a 128KB block.
+ **********************************************************************/
+class GameBoyAdvance : public Cartridge
+{
+public:
+
+	/*******************************************************************//**
+	 * \brief Constructor
+	 **********************************************************************/
+	GameBoyAdvance();
+
+	/*******************************************************************//**
+	 * \brief setup the UMD's hardware for the current cartridge
+	 * \return void
+	 **********************************************************************/
+	void init();
+	void get_flash_id(void);
+
+	// the cartridge is only read, writes end the burst and are dropped
+	void write_byte(uint16_t address, uint8_t data, e_memory_type mem_t);
+	void write_byte(uint32_t address, uint8_t data, e_memory_type mem_t);
+	void write_word(uint32_t address, uint16_t data, e_memory_type mem_t);
+
+	// 16 bit operations on CE3, the bus is little endian
+	uint16_t read_word(uint32_t address, e_memory_type mem_t);
+	void read_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t, bool dma = false);
+
+	// program rom reads are DMA transfers continuing the burst of the previous read
+	void read_async(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t);
+	bool read_wait(bool bus_order = false);
+
+	/*******************************************************************//**
+	 * \brief Pins
+	 **********************************************************************/
+	// nCS on GP0
+	#define nCS_Pin GPIO_PIN_0
+	#define nCS_GPIO_Port GPIOB
+	// nCS2 on GP1, save ram chip select
+	#define nCS2_Pin GPIO_PIN_1
+	#define nCS2_GPIO_Port GPIOB
+
+private:
+
+	// latch address on AD0-AD15 and leave /CS low, only done when a read doesn't continue the burst
+	void start_burst(uint32_t address);
+	void inline end_burst(void){
+		nCS_GPIO_Port->BSRR = nCS_Pin;
+		burst_address = NO_BURST;
+	};
+	// the data pins are switched from the FSMC to outputs to drive the latched address
+	void drive_ad(uint16_t value);
+	void release_ad(void);
+
+	// AD0-AD15 are FSMC D0-D15, D0-D3 and D13-D15 on GPIOD, D4-D12 on GPIOE
+	static const uint16_t AD_GPIOD_PINS = 0xC703;
+	static const uint16_t AD_GPIOE_PINS = 0xFF80;
+
+	const uint32_t GBA_CE = UMD_CE3;
+	static const uint32_t BURST_SIZE = 0x20000;		///< the cartridge counts A1-A16
+	static const uint32_t NO_BURST = 0xFFFFFFFF;
+	uint32_t burst_address = NO_BURST;				///< next address of the burst in progress
+
+	const uint32_t DMA_TIMEOUT = 100;
+
+	// DMA read in progress
+	struct{
+		uint16_t *buf;
+		uint16_t size;
+	} pending_read = { nullptr, 0 };
+
+};
+
+#endif /* CARTRIDGES_GAMEBOYADVANCE_H_ */
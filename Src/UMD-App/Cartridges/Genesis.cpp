@@ -38,7 +38,10 @@ void Genesis::init(void){
 	GPIO_InitTypeDef GPIO_InitStruct = {0};
 
 	param.bus_size = 16;
+	param.ops = op_read | op_program | op_erase | op_flash_id | op_dma_read | op_save_ram | op_bank_mapper;
+	param.save_size = BRAM_SIZE;
 	param.dma_channel = &hdma_memtomem_dma2_stream1;
+	reset_geometry();
 
 	// set nMRES to output and drive low for now to reset cart
 	GPIO_InitStruct.Pin = nMRES_Pin|nM3_Pin;
@@ -62,33 +65,69 @@ void Genesis::init(void){
 	GPIO_InitStruct.Pull = GPIO_NOPULL;
 	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
+	set_bus_timing(GEN_CE, BUS_TIMING_SAFE);
+	set_bus_timing(TIME_CE, BUS_TIMING_DEFAULT);
 	set_voltage(vcart_5v);
 	set_level_translators(true);
 
 	HAL_GPIO_WritePin(nMRES_GPIO_Port, nLWR_Pin, GPIO_PIN_SET);
+
+	// the vectors and header at the start of the rom are the sample
+	tune_read_timing(GEN_CE, BUS_TIMING_FAST, BUS_TIMING_SAFE);
+
+	// a mapper comes out of reset with every slot on its own bank
+	for(uint8_t slot = 0; slot < MAPPER_SLOTS; slot++){
+		bank_shadow[slot] = slot;
+	}
 }
 
 /*******************************************************************//**
  *
  **********************************************************************/
-void Genesis::erase_flash(bool wait){
-
-	this->write_word((uint32_t)0x0AAA << 1, 0xAA00, mem_prg);
-	this->write_word((uint32_t)0x0555 << 1, 0x5500, mem_prg);
-	this->write_word((uint32_t)0x0AAA << 1, 0x8000, mem_prg);
-	this->write_word((uint32_t)0x0AAA << 1, 0xAA00, mem_prg);
-	this->write_word((uint32_t)0x0555 << 1, 0x5500, mem_prg);
-	this->write_word((uint32_t)0x0AAA << 1, 0x1000, mem_prg);
+bool Genesis::erase_flash(bool wait){
+
+	bool ok = true;
+
+	// every chip erases at once
+	for( uint8_t i = 0; i < geometry.chips; i++ ){
+		uint32_t chip = geometry.size * i;
+		flash_command(chip, 0x0AAA, 0xAA);
+		flash_command(chip, 0x0555, 0x55);
+		flash_command(chip, 0x0AAA, 0x80);
+		flash_command(chip, 0x0AAA, 0xAA);
+		flash_command(chip, 0x0555, 0x55);
+		flash_command(chip, 0x0AAA, 0x10);
+	}
 
 	if(wait){
-		uint32_t umd_millis = HAL_GetTick();
-		while( this->toggle_bit(4) != 4 ){
-			if( (HAL_GetTick() - umd_millis) > 250 ){
-				umd_millis = HAL_GetTick();
+		for( uint8_t i = 0; i < geometry.chips; i++ ){
+			if( !wait_erase(geometry.size * i, true) ){
+				ok = false;
 			}
 		}
 	}
+	return ok;
+
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+bool Genesis::erase_sector(uint32_t address, bool wait){
 
+	uint32_t chip = chip_base(address);
+
+	flash_command(chip, 0x0AAA, 0xAA);
+	flash_command(chip, 0x0555, 0x55);
+	flash_command(chip, 0x0AAA, 0x80);
+	flash_command(chip, 0x0AAA, 0xAA);
+	flash_command(chip, 0x0555, 0x55);
+	this->write_word(address, 0x3000, mem_prg);
+
+	if(wait){
+		return wait_erase(address, false);
+	}
+	return true;
 }
 
 /*******************************************************************//**
@@ -102,12 +141,39 @@ void Genesis::get_flash_id(void){
 	this->write_word((uint32_t)0x0555 << 1, 0x5500, mem_prg);
 	this->write_word((uint32_t)0x0AAA << 1, 0x9000, mem_prg);
 	// read manufacturer
-	this->flash_info.manufacturer = (uint8_t)this->read_word((uint32_t)0x0000, mem_prg);
+	this->flash_info.manufacturer = flash_query(0, 0x0000);
 	// read device
-	this->flash_info.device = (uint8_t)this->read_word((uint32_t)0x0001<<1, mem_prg);
+	this->flash_info.device = flash_query(0, 0x0001);
 	// exit software ID mode
 	this->write_word((uint32_t)0x0000, 0xF000, mem_prg);
-	this->find_flash_size();
+	this->find_flash_geometry();
+}
+
+/*******************************************************************//**
+ * commands go in the low byte at word offsets, the bus is big endian
+ **********************************************************************/
+void Genesis::flash_command(uint32_t chip, uint32_t offset, uint8_t command){
+	this->write_word(chip + (offset << 1), (uint16_t)command << 8, mem_prg);
+}
+
+/*******************************************************************//**
+ * the answer is on DQ0-7 like the commands, the low byte of the raw bus
+ * word, read_word() would swap it to the high byte
+ **********************************************************************/
+uint8_t Genesis::flash_query(uint32_t chip, uint32_t offset){
+	uint16_t size = 2;
+	uint32_t fsmc_addr = GEN_CE + this->map_rom(chip + (offset << 1), size);
+	return (uint8_t)*(__IO uint16_t *)(fsmc_addr);
+}
+
+/*******************************************************************//**
+ * data is in bus order, the swap undoes the one of write_word()
+ **********************************************************************/
+void Genesis::flash_program(uint32_t chip, uint32_t address, uint16_t data){
+	flash_command(chip, 0x0AAA, 0xAA);
+	flash_command(chip, 0x0555, 0x55);
+	flash_command(chip, 0x0AAA, 0xA0);
+	this->write_word(address, BIG_END_WORD(data), mem_prg);
 }
 
 /*******************************************************************//**
@@ -158,6 +224,98 @@ void Genesis::write_byte(uint32_t address, uint8_t data, e_memory_type mem_t){
 	}
 }
 
+/*******************************************************************//**
+ * save ram reads map the ram in once for the whole transfer, the odd
+ * lane is the low byte of the bus word
+ **********************************************************************/
+void Genesis::read_bytes(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t, bool dma){
+
+	uint32_t fsmc_addr;
+
+	if( mem_t != mem_bram ){
+		Cartridge::read_bytes(address, buf, size, mem_t, dma);
+		return;
+	}
+	if( address >= BRAM_SIZE ){
+		return;
+	}
+	if( size > BRAM_SIZE - address ){
+		size = BRAM_SIZE - address;
+	}
+
+	Perf::Probe probe(Perf::stage_bus_read);
+	fsmc_addr = bram_address(address);
+	this->enable_bram(false);
+	for(; size != 0; size--){
+		*(buf++) = (uint8_t)*(__IO uint16_t *)(fsmc_addr);
+		fsmc_addr += 2;
+	}
+	this->disable_bram();
+}
+
+/*******************************************************************//**
+ * save ram writes strobe nLWR for the odd lane around every bus write
+ **********************************************************************/
+void Genesis::write_bytes(uint32_t address, const uint8_t *buf, uint16_t size, e_memory_type mem_t){
+
+	uint32_t fsmc_addr;
+
+	if( mem_t != mem_bram ){
+		Cartridge::write_bytes(address, buf, size, mem_t);
+		return;
+	}
+	if( address >= BRAM_SIZE ){
+		return;
+	}
+	if( size > BRAM_SIZE - address ){
+		size = BRAM_SIZE - address;
+	}
+
+	fsmc_addr = bram_address(address);
+	this->enable_bram(true);
+	for(; size != 0; size--){
+		nLWR_GPIO_Port->BSRR = (uint32_t)nLWR_Pin << 16;
+		*(__IO uint16_t *)(fsmc_addr) = *(buf++);
+		// the bus write must be done before the strobe is released
+		__DSB();
+		nLWR_GPIO_Port->BSRR = nLWR_Pin;
+		fsmc_addr += 2;
+	}
+	this->disable_bram();
+}
+
+/*******************************************************************//**
+ * the register is only written when the slot holds another bank
+ **********************************************************************/
+void Genesis::set_bank(uint8_t slot, uint8_t bank){
+
+	if( slot == 0 || slot >= MAPPER_SLOTS || bank_shadow[slot] == bank ){
+		return;
+	}
+	this->write_byte(TIME_LOWER_BOUND + 0xF1 + (slot << 1), bank, mem_ctrl);
+	bank_shadow[slot] = bank;
+}
+
+/*******************************************************************//**
+ * map a program rom address on the cartridge bus, banks past the linear
+ * window are switched into the last slot. size is clipped to the end of
+ * the bank so a transfer never spans a bank switch.
+ * \return bus address of the program rom address
+ **********************************************************************/
+uint32_t Genesis::map_rom(uint32_t address, uint16_t &size){
+	uint32_t bank = address / MAPPER_BANK_SIZE;
+	uint32_t offset = address % MAPPER_BANK_SIZE;
+	uint8_t slot = (address < MAPPER_WINDOW) ? bank : MAPPER_STREAM_SLOT;
+
+	// a previous read may have left another bank in this slot
+	this->set_bank(slot, (uint8_t)bank);
+
+	if( size > MAPPER_BANK_SIZE - offset ){
+		size = MAPPER_BANK_SIZE - offset;
+	}
+	return (slot * MAPPER_BANK_SIZE) + offset;
+}
+
 /*******************************************************************//**
 * 16 BIT OPERATIONS
 ************************************************************************
@@ -167,19 +325,24 @@ uint16_t Genesis::read_word(uint32_t address, e_memory_type mem_t){
 	uint32_t fsmc_addr;
 	uint16_t read;
 
+	uint16_t size = 2;
+
 	switch(mem_t){
 	case mem_prg:
-		fsmc_addr = GEN_CE + address;
+		fsmc_addr = GEN_CE + this->map_rom(address, size);
 		read = *(__IO uint16_t *)(fsmc_addr);
 		break;
 	case mem_bram:
+		// a single access has to map the save ram in and out, use read_bytes() for transfers
+		fsmc_addr = GEN_CE | address;
 		if( address >= BRAM_LOWER_BOUND and address <= BRAM_UPPER_BOUND ){
-			this->enable_bram_writes();
-			fsmc_addr = GEN_CE | address;
+			this->enable_bram(false);
 			read = *(__IO uint16_t *)(fsmc_addr);
 			this->disable_bram();
+		}else{
+			read = *(__IO uint16_t *)(fsmc_addr);
 		}
-
+		break;
 	default:
 		fsmc_addr = GEN_CE | address;
 		read = *(__IO uint16_t *)(fsmc_addr);
@@ -196,37 +359,110 @@ uint16_t Genesis::read_word(uint32_t address, e_memory_type mem_t){
  **********************************************************************/
 void Genesis::read_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t, bool dma){
 	uint32_t fsmc_addr;
-	uint16_t read;
+	uint16_t read, len, i;
+	bool paged;
+	Perf::Probe probe(Perf::stage_bus_read);
+
+	// program rom is read a bank at a time, the mapper is only written when the bank changes
+	for(; size != 0; size -= len){
+		len = size;
+		if( mem_t == mem_prg ){
+			fsmc_addr = GEN_CE | this->map_rom(address, len);
+		}else{
+			fsmc_addr = GEN_CE | address;
+		}
+		address += len;
 
-	switch(mem_t){
-	case mem_prg:
-	default:
-		fsmc_addr = GEN_CE | address;
 		if(dma){
-			HAL_DMA_Start(param.dma_channel, fsmc_addr, (uint32_t)buf, size);
-			while(HAL_DMA_GetState(param.dma_channel) != HAL_DMA_STATE_READY );
-			this->swap_bytes(buf, size);
+			// the stream moves halfwords, the HAL only leaves the busy state once polled
+			paged = page_read_start(fsmc_addr);
+			HAL_DMA_Start(param.dma_channel, fsmc_addr, (uint32_t)buf, len >> 1);
+			HAL_DMA_PollForTransfer(param.dma_channel, HAL_DMA_FULL_TRANSFER, DMA_TIMEOUT);
+			if( paged ){
+				page_read_end(fsmc_addr, (uint8_t *)buf, len);
+			}
+			this->swap_bytes(buf, len);
+			buf += len >> 1;
 		}else{
-			for(; size > 0; size -= 2){
+			// aligned reads fetch two bus words at a time and swap them on the way to buf
+			i = len;
+			if( (((uint32_t)buf | fsmc_addr) & 3) == 0 ){
+				swap16_copy((uint32_t *)buf, (const volatile uint32_t *)fsmc_addr, len >> 2);
+				buf += (len >> 2) << 1;
+				fsmc_addr += len & ~3;
+				i = len & 3;
+			}
+			for(; i > 1; i -= 2){
 				read = *(__IO uint16_t *)(fsmc_addr);
 				*(buf++) = BIG_END_WORD(read);
 				fsmc_addr += 2;
 			}
 		}
-		break;
 	}
 
 }
 
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void Genesis::read_async(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t){
+
+	uint32_t fsmc_addr;
+	uint16_t len = size;
+
+	read_wait();
+	if( mem_t != mem_prg ){
+		read_words(address, (uint16_t *)buf, size, mem_t);
+		return;
+	}
+
+	// a read across a bank boundary needs the mapper written halfway, it's done synchronously
+	fsmc_addr = GEN_CE | this->map_rom(address, len);
+	if( len != size ){
+		read_words(address, (uint16_t *)buf, size, mem_t, true);
+		return;
+	}
+
+	pending_read.buf = (uint16_t *)buf;
+	pending_read.size = size;
+	pending_read.fsmc_addr = fsmc_addr;
+	pending_read.paged = page_read_start(fsmc_addr);
+	HAL_DMA_Start(param.dma_channel, fsmc_addr, (uint32_t)buf, size >> 1);
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+bool Genesis::read_wait(bool bus_order){
+
+	if( pending_read.buf == nullptr ){
+		return false;
+	}
+	uint32_t start = Perf::now();
+	HAL_DMA_PollForTransfer(param.dma_channel, HAL_DMA_FULL_TRANSFER, DMA_TIMEOUT);
+	start = Perf::now() - start;
+	Perf::stage(Perf::stage_dma_wait, start);
+	trace(TRACE_DMA_DONE, pending_read.size, start);
+	if( pending_read.paged ){
+		page_read_end(pending_read.fsmc_addr, (uint8_t *)pending_read.buf, pending_read.size);
+	}
+	if( !bus_order ){
+		swap_bytes(pending_read.buf, pending_read.size);
+	}
+	pending_read.buf = nullptr;
+	return bus_order;
+}
+
 /*******************************************************************//**
  * single 16 bit write at 32bit address
  **********************************************************************/
 void Genesis::write_word(uint32_t address, uint16_t data, e_memory_type mem_t){
 	uint32_t fsmc_addr;
+	uint16_t size = 2;
 
 	switch(mem_t){
 	case mem_prg:
-		fsmc_addr = GEN_CE + address;
+		fsmc_addr = GEN_CE + this->map_rom(address, size);
 		*(__IO uint16_t *)(fsmc_addr) = BIG_END_WORD(data);
 		break;
 	default:
@@ -237,18 +473,57 @@ void Genesis::write_word(uint32_t address, uint16_t data, e_memory_type mem_t){
 }
 
 /*******************************************************************//**
- * single 16 bit program at 32bit address
+ * single 16 bit program at 32bit address, chips with a write buffer
+ * take up to a page of it at a time
  **********************************************************************/
-void Genesis::program_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t){
+uint16_t Genesis::program_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t){
+
+	uint16_t page = geometry.write_buffer;
+	uint16_t len, words, done = 0;
+
+	// the word count is written in a single byte
+	if( page > 512 ){
+		page = 512;
+	}
 
-	for(; size > 0; size -= 2){
-		this->write_word((uint32_t)0x0AAA << 1, 0xAA00, mem_t);
-		this->write_word((uint32_t)0x0555 << 1, 0x5500, mem_t);
-		this->write_word((uint32_t)0x0AAA << 1, 0xA000, mem_t);
-		// write the data
-		this->write_word(address, BIG_END_WORD(*buf), mem_t);
-		buf++;
-		// wait for completion
-		while(this->toggle_bit(2) != 2);
+	// only whole words are programmed, a trailing odd byte isn't counted as done
+	while( size > 1 ){
+		uint32_t chip = chip_base(address);
+		if( page >= 4 && mem_t == mem_prg ){
+			// a buffer load can't cross a page
+			len = page - (address & (page - 1));
+			if( len > size ){
+				len = size & ~1;
+			}
+			words = len >> 1;
+			flash_command(chip, 0x0AAA, 0xAA);
+			flash_command(chip, 0x0555, 0x55);
+			this->write_word(address, 0x2500, mem_t);
+			this->write_word(address, (uint16_t)((words - 1) << 8), mem_t);
+			for( uint16_t i = 0; i < words; i++ ){
+				this->write_word(address + (i << 1), BIG_END_WORD(buf[i]), mem_t);
+			}
+			this->write_word(address, 0x2900, mem_t);
+			// wait for completion, an aborted load needs its own reset
+			if( !wait_program(address, geometry.buffer_max_us) ){
+				flash_command(chip, 0x0AAA, 0xAA);
+				flash_command(chip, 0x0555, 0x55);
+				flash_command(chip, 0x0AAA, 0xF0);
+				return done;
+			}
+		}else{
+			len = 2;
+			words = 1;
+			flash_program(chip, address, *buf);
+			// wait for completion
+			if( !wait_program(address, geometry.program_max_us) ){
+				return done;
+			}
+		}
+		address += len;
+		buf += words;
+		size -= len;
+		done += len;
 	}
+	return done;
 }
@@ -25,6 +25,7 @@
 #define CARTRIDGES_GENESIS_H_
 
 #include "Cartridge.h"
+#include "../ByteSwap.h"
 
 
 /*******************************************************************//**
@@ -45,18 +46,30 @@ public:
 	 * \return void
 	 **********************************************************************/
 	void init();
-	void erase_flash(bool wait);
+	bool erase_flash(bool wait);
+	bool erase_sector(uint32_t address, bool wait);
 	void get_flash_id(void);
 	uint16_t toggle_bit(uint16_t attempts);
 
 	// 8 bit operations, default to CE0, the base cart implementation ignores mem_t
+	// mem_bram addresses are save ram offsets, the bytes are packed from the odd lane
+	using Cartridge::read_bytes;
+	void read_bytes(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t, bool dma = false);
 	void write_byte(uint32_t address, uint8_t data, e_memory_type mem_t);
+	void write_bytes(uint32_t address, const uint8_t *buf, uint16_t size, e_memory_type mem_t);
 
 	// 16 bit operations default to CE3, the base cart implementation ignores mem_t
 	uint16_t read_word(uint32_t address, e_memory_type mem_t);
 	void read_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t, bool dma = false);
 	void write_word(uint32_t address, uint16_t data, e_memory_type mem_t);
-	void program_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t);
+	uint16_t program_words(uint32_t address, uint16_t *buf, uint16_t size, e_memory_type mem_t);
+
+	// program rom reads are DMA transfers, the byte swap is done in read_wait() unless bus order is asked for
+	void read_async(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t);
+	bool read_wait(bool bus_order = false);
+
+	// SSF2 style mapper, 0xA130F3-0xA130FF select the 512KB bank seen in slots 1-7, slot 0 is fixed
+	void set_bank(uint8_t slot, uint8_t bank);
 
 	/*******************************************************************//**
 	 * \brief Pins
@@ -71,28 +84,67 @@ public:
 	#define nM3_Pin GPIO_PIN_4
 	#define nM3_GPIO_Port GPIOC
 
+protected:
+
+	// flash commands and queries are word wide
+	void flash_command(uint32_t chip, uint32_t offset, uint8_t command);
+	uint8_t flash_query(uint32_t chip, uint32_t offset);
+	void flash_program(uint32_t chip, uint32_t address, uint16_t data);
+
 private:
 
 	//macro to flip endianness of words
 	#define BIG_END_WORD(w) ((w & 0xff) << 8) | ((w & 0xff00) >> 8)
+	// aligned buffers are swapped two words at a time
 	void inline swap_bytes(uint16_t *buf, uint16_t size){
-		for(; size > 0; size -= 2){
+		if( ((uint32_t)buf & 3) == 0 ){
+			swap16_inplace((uint32_t *)buf, size >> 2);
+			buf += (size >> 2) << 1;
+			size &= 3;
+		}
+		for(; size > 1; size -= 2){
 			*(buf) = BIG_END_WORD(*buf);
 			buf++;
 		}
 	};
 
-	// enable/disable bram latche
-	void inline enable_bram_writes(void){ this->write_byte(0xA130F1, 0x03, mem_ctrl); };
+	// enable/disable bram latch, bit 0 maps the save ram in, bit 1 write protects it
+	void inline enable_bram(bool writes){ this->write_byte(0xA130F1, writes ? 0x01 : 0x03, mem_ctrl); };
 	void inline disable_bram(void){ this->write_byte(0xA130F1, 0x00, mem_ctrl); };
 
+	// save ram is 8 bits wide on the odd addresses of the bram window, bus word holding a save ram offset
+	uint32_t inline bram_address(uint32_t offset){ return GEN_CE | (BRAM_LOWER_BOUND + (offset << 1)); };
+
 	const uint32_t TIME_CE = UMD_CE0;
 	const uint32_t TIME_LOWER_BOUND = 0xA13000;
 	const uint32_t TIME_UPPER_BOUND = 0xA130FF;
 
+	const uint32_t DMA_TIMEOUT = 100;
+
+	// program rom addresses past the linear window are read through the last slot of the mapper
+	uint32_t map_rom(uint32_t address, uint16_t &size);
+	const uint32_t MAPPER_BANK_SIZE = 0x80000;
+	const uint32_t MAPPER_WINDOW = 0x400000;
+	static const uint8_t MAPPER_SLOTS = 8;
+	const uint8_t MAPPER_STREAM_SLOT = MAPPER_SLOTS - 1;
+	uint8_t bank_shadow[MAPPER_SLOTS];		///< bank selected in each slot, the registers are write only
+
+	// DMA read in progress, paged when it was started at the page timing
+	struct{
+		uint16_t *buf;
+		uint16_t size;
+		uint32_t fsmc_addr;
+		bool paged;
+	} pending_read = { nullptr, 0, 0, false };
+
 	const uint32_t GEN_CE = UMD_CE3;
+	// flash commands keep the long write access and turnaround, reads are 100ns when the rom keeps up and
+	// stay at the write access otherwise. Page mode reads are off.
+	const s_bus_timing BUS_TIMING_SAFE = { 2, 12, 1, 2, 12, 12, 0 };
+	const s_bus_timing BUS_TIMING_FAST = { 1, 9, 1, 2, 12, 12, 0 };
 	const uint32_t BRAM_LOWER_BOUND = 0x200000;
 	const uint32_t BRAM_UPPER_BOUND = 0x3FFFFF;
+	const uint32_t BRAM_SIZE = (BRAM_UPPER_BOUND - BRAM_LOWER_BOUND + 1) >> 1;	///< save ram bytes in the window
 
 };
 
@@ -37,12 +37,14 @@ void MasterSystem::init(void){
 	GPIO_InitTypeDef GPIO_InitStruct = {0};
 
 	param.bus_size = 8;
+	param.ops = op_read | op_flash_id;
 
 	GPIO_InitStruct.Pin = GP0_Pin|GP1_Pin|GP4_Pin|GP5_Pin|GP6_Pin|GP7_Pin;
 	GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
 	GPIO_InitStruct.Pull = GPIO_NOPULL;
 	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
+	set_bus_timing(SMS_CE, BUS_TIMING_DEFAULT);
 	set_voltage(vcart_5v);
 	set_level_translators(true);
 
@@ -0,0 +1,155 @@
+/*******************************************************************//**
+ *  \file Nes.cpp
+ *  \author René Richard
+ *  \brief This program provides a serial interface over USB to the
+ *         Universal Mega Dumper.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Nes.h"
+#include "dma.h"
+#include "fsmc.h"
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+Nes::Nes() {}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void Nes::init(void){
+
+	GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+	param.bus_size = 8;
+	param.ops = op_read | op_dma_read | op_bank_mapper | op_chr_rom;
+	param.dma_channel = &hdma_memtomem_dma2_stream0;
+	reset_geometry();
+	pending_read = 0;
+
+	GPIO_InitStruct.Pin = GP0_Pin|GP1_Pin|GP4_Pin|GP5_Pin|GP6_Pin|GP7_Pin;
+	GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+	GPIO_InitStruct.Pull = GPIO_NOPULL;
+	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+	set_bus_timing(PRG_CE, BUS_TIMING_DEFAULT);
+	set_bus_timing(CHR_CE, BUS_TIMING_DEFAULT);
+	set_voltage(vcart_5v);
+	set_level_translators(true);
+
+	set_mapper(0, 0);
+}
+
+/*******************************************************************//**
+ * the software ID sequence would land on the mapper registers
+ **********************************************************************/
+void Nes::get_flash_id(void){
+	flash_info.manufacturer = 0;
+	flash_info.device = 0;
+}
+
+/*******************************************************************//**
+ * \return false if the mapper isn't supported or the PRG would wrap around
+ *         its banks, the previous one stays
+ **********************************************************************/
+bool Nes::set_mapper(uint16_t number, uint32_t prg_size){
+
+	read_wait();
+	for( NesMapper *m : mappers ){
+		if( m->number == number ){
+			if( !m->set_prg_size(prg_size) ){
+				return false;
+			}
+			mapper = m;
+			mapper->reset(*this);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*******************************************************************//**
+* 8 BIT OPERATIONS
+************************************************************************
+ * single 8bit read at 32bit address
+ **********************************************************************/
+uint8_t Nes::read_byte(uint32_t address, e_memory_type mem_t){
+	uint16_t size = 1;
+	return *(__IO uint8_t *)(this->map(mem_t, address, size));
+}
+
+/*******************************************************************//**
+ * multiple 8bit reads at 32bit address, a bank at a time
+ **********************************************************************/
+void Nes::read_bytes(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t, bool dma){
+	uint32_t fsmc_addr;
+	uint16_t len;
+	Perf::Probe probe(Perf::stage_bus_read);
+
+	for(; size != 0; size -= len){
+		len = size;
+		fsmc_addr = this->map(mem_t, address, len);
+		address += len;
+
+		if(dma){
+			HAL_DMA_Start(param.dma_channel, fsmc_addr, (uint32_t)buf, len);
+			HAL_DMA_PollForTransfer(param.dma_channel, HAL_DMA_FULL_TRANSFER, DMA_TIMEOUT);
+			buf += len;
+		}else{
+			for( uint16_t i = len; i != 0; i-- ){
+				*(buf++) = *(__IO uint8_t *)(fsmc_addr++);
+			}
+		}
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void Nes::read_async(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t){
+
+	uint32_t fsmc_addr;
+	uint16_t len = size;
+
+	read_wait();
+	fsmc_addr = this->map(mem_t, address, len);
+	if( len != size ){
+		read_bytes(address, buf, size, mem_t, true);
+		return;
+	}
+
+	pending_read = size;
+	HAL_DMA_Start(param.dma_channel, fsmc_addr, (uint32_t)buf, size);
+}
+
+/*******************************************************************//**
+ * bytes need no swap
+ **********************************************************************/
+bool Nes::read_wait(bool bus_order){
+
+	if( pending_read == 0 ){
+		return false;
+	}
+	uint32_t start = Perf::now();
+	HAL_DMA_PollForTransfer(param.dma_channel, HAL_DMA_FULL_TRANSFER, DMA_TIMEOUT);
+	start = Perf::now() - start;
+	Perf::stage(Perf::stage_dma_wait, start);
+	trace(TRACE_DMA_DONE, pending_read, start);
+	pending_read = 0;
+	return false;
+}
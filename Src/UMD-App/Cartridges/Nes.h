@@ -0,0 +1,91 @@
+/*******************************************************************//**
+ *  \file Nes.h
+ *  \author René Richard
+ *  \brief This program allows to read and write to various game cartridges.
+ *         The UMD base class handles all generic cartridge operations, console
+ *         specific operations are handled in derived classes.
+ *
+ * \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CARTRIDGES_NES_H_
+#define CARTRIDGES_NES_H_
+
+#include "Cartridge.h"
+#include "NesMappers.h"
+
+/*******************************************************************//**
+ * \class Nes
+ * \brief PRG is on CE0 as the CPU's 0x8000-0xFFFF, /ROMSEL is the chip
+ *        enable and M2 comes from the adapter. CHR is on CE1 as the PPU's
+ *        0x0000-0x1FFF. Both are read through the selected mapper, mem_prg
+ *        and mem_chr addresses are offsets in the roms.
+ **********************************************************************/
+class Nes : public Cartridge
+{
+public:
+
+	/*******************************************************************//**
+	 * \brief Constructor
+	 **********************************************************************/
+	Nes();
+
+	/*******************************************************************//**
+	 * \brief setup the UMD's hardware for the current cartridge
+	 * \return void
+	 **********************************************************************/
+	void init();
+	void get_flash_id(void);
+	bool set_mapper(uint16_t number, uint32_t prg_size);
+
+	// 16 bit address reads ignore the mapper, they're offsets in the PRG window
+	using Cartridge::read_byte;
+	using Cartridge::read_bytes;
+	uint8_t read_byte(uint32_t address, e_memory_type mem_t);
+	void read_bytes(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t, bool dma = false);
+
+	// PRG and CHR reads are DMA transfers, a read past the bank is done synchronously
+	void read_async(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t);
+	bool read_wait(bool bus_order = false);
+
+	// mapper register write at a CPU address
+	void inline write_register(uint16_t address, uint8_t data){ *(__IO uint8_t *)(PRG_CE | (address & 0x7FFF)) = data; };
+
+private:
+
+	// bus address of a rom offset with its bank switched in
+	uint32_t inline map(e_memory_type mem_t, uint32_t address, uint16_t &size){
+		return ((mem_t == mem_chr) ? CHR_CE : PRG_CE) | mapper->map(*this, mem_t, address, size);
+	};
+
+	const uint32_t PRG_CE = UMD_CE0;
+	const uint32_t CHR_CE = UMD_CE1;
+
+	// every mapper is allocated with the cartridge
+	NesNrom nrom;
+	NesMmc1 mmc1;
+	NesUxrom uxrom;
+	NesMmc3 mmc3;
+	NesMapper *const mappers[4] = { &nrom, &mmc1, &uxrom, &mmc3 };
+	NesMapper *mapper = &nrom;
+
+	const uint32_t DMA_TIMEOUT = 100;
+
+	uint16_t pending_read = 0;				///< bytes of the DMA read in progress
+
+};
+
+#endif /* CARTRIDGES_NES_H_ */
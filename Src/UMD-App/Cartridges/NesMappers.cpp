@@ -0,0 +1,181 @@
+/*******************************************************************//**
+ *  \file NesMappers.cpp
+ *  \author René Richard
+ *  \brief This program provides a serial interface over USB to the
+ *         Universal Mega Dumper.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "NesMappers.h"
+#include "Nes.h"
+
+/*******************************************************************//**
+* NROM
+************************************************************************
+ *
+ **********************************************************************/
+uint32_t NesNrom::map(Nes &cart, Cartridge::e_memory_type mem_t, uint32_t address, uint16_t &size){
+	return window(address, (mem_t == Cartridge::mem_chr) ? 0x2000 : 0x8000, size);
+}
+
+/*******************************************************************//**
+* MMC1
+************************************************************************
+ * a write with bit 7 set clears the shift register, control 0x00 is
+ * 32KB PRG and 8KB CHR banks
+ **********************************************************************/
+void NesMmc1::reset(Nes &cart){
+	cart.write_register(0x8000, 0x80);
+	write_serial(cart, 0x8000, 0x00);
+	prg_shadow = UNKNOWN;
+	chr_shadow = UNKNOWN;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void NesMmc1::write_serial(Nes &cart, uint16_t reg, uint8_t value){
+	for( uint8_t i = 0; i < 5; i++ ){
+		cart.write_register(reg, value >> i);
+	}
+}
+
+/*******************************************************************//**
+ * the bank registers count 16KB and 4KB banks, the low bit is ignored
+ * in the 32KB and 8KB modes
+ **********************************************************************/
+uint32_t NesMmc1::map(Nes &cart, Cartridge::e_memory_type mem_t, uint32_t address, uint16_t &size){
+	uint8_t bank;
+
+	if( mem_t == Cartridge::mem_chr ){
+		bank = (uint8_t)((address >> 13) << 1) & 0x1F;
+		if( bank != chr_shadow ){
+			write_serial(cart, 0xA000, bank);
+			chr_shadow = bank;
+		}
+		return window(address, 0x2000, size);
+	}
+
+	bank = (uint8_t)((address >> 15) << 1) & 0x0F;
+	if( bank != prg_shadow ){
+		write_serial(cart, 0xE000, bank);
+		prg_shadow = bank;
+	}
+	return window(address, 0x8000, size);
+}
+
+/*******************************************************************//**
+* UxROM
+************************************************************************
+ * enough banks for the whole PRG, a power of 2 like the board decodes
+ **********************************************************************/
+bool NesUxrom::set_prg_size(uint32_t size){
+
+	if( size > prg_max ){
+		return false;
+	}
+	for( banks = 1; ((uint32_t)banks << 14) < size; banks <<= 1 );
+	return true;
+}
+
+/*******************************************************************//**
+ * the last bank is at 0xC000, look in it for a byte equal to each bank
+ * number so switching doesn't fight the rom on the data bus
+ **********************************************************************/
+void NesUxrom::reset(Nes &cart){
+	uint16_t found = 0, i;
+	uint8_t data;
+
+	for( i = 0; i < banks; i++ ){
+		conflict_free[i] = 0x8000;
+	}
+	for( uint16_t offset = 0x4000; offset < 0x8000 && found < banks; offset++ ){
+		data = cart.read_byte(offset, Cartridge::mem_prg);
+		if( data < banks && conflict_free[data] == 0x8000 ){
+			conflict_free[data] = 0x8000 | offset;
+			found++;
+		}
+	}
+	bank_shadow = UNKNOWN;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint32_t NesUxrom::map(Nes &cart, Cartridge::e_memory_type mem_t, uint32_t address, uint16_t &size){
+	uint8_t bank;
+
+	if( mem_t == Cartridge::mem_chr ){
+		return window(address, 0x2000, size);
+	}
+
+	bank = (uint8_t)((address >> 14) & (banks - 1));
+	if( bank != bank_shadow ){
+		cart.write_register(conflict_free[bank], bank);
+		bank_shadow = bank;
+	}
+	return window(address, 0x4000, size);
+}
+
+/*******************************************************************//**
+* MMC3
+************************************************************************
+ *
+ **********************************************************************/
+void NesMmc3::reset(Nes &cart){
+	select_shadow = UNKNOWN;
+	for( uint8_t i = 0; i < 8; i++ ){
+		shadow[i] = UNKNOWN;
+	}
+	// R6 at 0x8000, R0 and R1 at 0x0000, the bits of the select write are the modes
+	set_register(cart, 0, 0);
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void NesMmc3::set_register(Nes &cart, uint8_t reg, uint8_t value){
+	if( shadow[reg] == value ){
+		return;
+	}
+	if( select_shadow != reg ){
+		cart.write_register(0x8000, reg);
+		select_shadow = reg;
+	}
+	cart.write_register(0x8001, value);
+	shadow[reg] = value;
+}
+
+/*******************************************************************//**
+ * banks are numbered in 8KB for PRG and 1KB for CHR, the 2KB CHR banks
+ * ignore the low bit
+ **********************************************************************/
+uint32_t NesMmc3::map(Nes &cart, Cartridge::e_memory_type mem_t, uint32_t address, uint16_t &size){
+	uint8_t bank;
+
+	if( mem_t == Cartridge::mem_chr ){
+		bank = (uint8_t)((address >> 12) << 2);
+		set_register(cart, 0, bank);
+		set_register(cart, 1, bank + 2);
+		return window(address, 0x1000, size);
+	}
+
+	bank = (uint8_t)((address >> 14) << 1);
+	set_register(cart, 6, bank);
+	set_register(cart, 7, bank + 1);
+	return window(address, 0x4000, size);
+}
@@ -0,0 +1,142 @@
+/*******************************************************************//**
+ *  \file NesMappers.h
+ *  \author René Richard
+ *  \brief This program allows to read and write to various game cartridges.
+ *         The UMD base class handles all generic cartridge operations, console
+ *         specific operations are handled in derived classes.
+ *
+ * \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CARTRIDGES_NESMAPPERS_H_
+#define CARTRIDGES_NESMAPPERS_H_
+
+#include "Cartridge.h"
+
+class Nes;
+
+/*******************************************************************//**
+ * \class NesMapper
+ * \brief Switches the banks of a board so a PRG or CHR rom address can be
+ *        read through the cartridge's window. Registers are write only,
+ *        the mapper keeps a shadow of each and only writes the ones which
+ *        change. PRG offsets are from 0x8000, CHR offsets from 0x0000.
+ **********************************************************************/
+class NesMapper
+{
+public:
+	NesMapper(uint16_t number, uint32_t prg_max) : number(number), prg_max(prg_max) {}
+	virtual ~NesMapper() {}
+
+	const uint16_t number;			///< iNES mapper number
+	const uint32_t prg_max;			///< largest PRG the bank registers reach, more would wrap
+
+	// size of the PRG about to be read, false if the mapper can't switch all of it
+	virtual bool set_prg_size(uint32_t size) { return size <= prg_max; }
+
+	// the cartridge may have been switched by anything, forget the shadows and set a known state
+	virtual void reset(Nes &cart) {}
+
+	/*******************************************************************//**
+	 * \brief switch the bank holding a rom address into the window
+	 * \param size is clipped to the end of the bank
+	 * \return offset of the address in the window
+	 **********************************************************************/
+	virtual uint32_t map(Nes &cart, Cartridge::e_memory_type mem_t, uint32_t address, uint16_t &size) = 0;
+
+protected:
+	static uint32_t window(uint32_t address, uint32_t window_size, uint16_t &size){
+		uint32_t offset = address & (window_size - 1);
+		if( size > window_size - offset ){
+			size = window_size - offset;
+		}
+		return offset;
+	}
+
+	static const uint8_t UNKNOWN = 0xFF;	///< shadow of a register the cartridge may hold anything in
+};
+
+/*******************************************************************//**
+ * \class NesNrom
+ * \brief mapper 0, 32KB of PRG and 8KB of CHR without banks
+ **********************************************************************/
+class NesNrom : public NesMapper
+{
+public:
+	NesNrom() : NesMapper(0, 0x8000) {}
+	uint32_t map(Nes &cart, Cartridge::e_memory_type mem_t, uint32_t address, uint16_t &size);
+};
+
+/*******************************************************************//**
+ * \class NesMmc1
+ * \brief mapper 1, set for 32KB PRG and 8KB CHR banks so a bank is one
+ *        serial register write. Up to 256KB of PRG and 128KB of CHR.
+ **********************************************************************/
+class NesMmc1 : public NesMapper
+{
+public:
+	NesMmc1() : NesMapper(1, 0x40000) {}
+	void reset(Nes &cart);
+	uint32_t map(Nes &cart, Cartridge::e_memory_type mem_t, uint32_t address, uint16_t &size);
+
+private:
+	// registers are loaded a bit at a time from the LSB, five writes each
+	void write_serial(Nes &cart, uint16_t reg, uint8_t value);
+	uint8_t prg_shadow, chr_shadow;
+};
+
+/*******************************************************************//**
+ * \class NesUxrom
+ * \brief mapper 2, 16KB banks at 0x8000, 0xC000 is fixed to the last
+ *        bank. The boards have bus conflicts, the bank number is written
+ *        where the fixed bank holds the same value. The bank count follows
+ *        the PRG size, up to 4MB with an 8 bit bank register.
+ **********************************************************************/
+class NesUxrom : public NesMapper
+{
+public:
+	NesUxrom() : NesMapper(2, BANKS_MAX * 0x4000) {}
+	bool set_prg_size(uint32_t size);
+	void reset(Nes &cart);
+	uint32_t map(Nes &cart, Cartridge::e_memory_type mem_t, uint32_t address, uint16_t &size);
+
+private:
+	static const uint16_t BANKS_MAX = 256;
+	uint16_t banks = 16;					///< a power of 2
+	uint16_t conflict_free[BANKS_MAX];		///< address in the fixed bank holding each bank number
+	uint8_t bank_shadow;
+};
+
+/*******************************************************************//**
+ * \class NesMmc3
+ * \brief mapper 4, PRG is read through R6 and R7 as a 16KB window at
+ *        0x8000, CHR through the 2KB banks R0 and R1 as a 4KB window.
+ **********************************************************************/
+class NesMmc3 : public NesMapper
+{
+public:
+	NesMmc3() : NesMapper(4, 0x200000) {}
+	void reset(Nes &cart);
+	uint32_t map(Nes &cart, Cartridge::e_memory_type mem_t, uint32_t address, uint16_t &size);
+
+private:
+	// the bank select write is skipped when the register is already selected
+	void set_register(Nes &cart, uint8_t reg, uint8_t value);
+	uint8_t select_shadow;
+	uint8_t shadow[8];
+};
+
+#endif /* CARTRIDGES_NESMAPPERS_H_ */
@@ -0,0 +1,221 @@
+/*******************************************************************//**
+ *  \file SuperNes.cpp
+ *  \author René Richard
+ *  \brief This program provides a serial interface over USB to the
+ *         Universal Mega Dumper.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SuperNes.h"
+#include "dma.h"
+#include "fsmc.h"
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+SuperNes::SuperNes() {}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void SuperNes::init(void){
+
+	GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+	param.bus_size = 8;
+	param.ops = op_read | op_dma_read;
+	param.dma_channel = &hdma_memtomem_dma2_stream0;
+	reset_geometry();
+	pending_read = 0;
+
+	GPIO_InitStruct.Pin = GP0_Pin|GP1_Pin|GP4_Pin|GP5_Pin|GP6_Pin|GP7_Pin;
+	GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+	GPIO_InitStruct.Pull = GPIO_NOPULL;
+	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+	set_bus_timing(SNES_CE, BUS_TIMING_DEFAULT);
+	set_voltage(vcart_5v);
+	set_level_translators(true);
+
+	find_rom_info();
+}
+
+/*******************************************************************//**
+ * mask roms have no software ID mode
+ **********************************************************************/
+void SuperNes::get_flash_id(void){
+	flash_info.manufacturer = 0;
+	flash_info.device = 0;
+}
+
+/*******************************************************************//**
+ * The reset vector page is in bank 0x00 in every mapping, so is the
+ * header. The map mode tells the mapping once the checksum complement
+ * shows the header is there, a cart without one is read as LoROM.
+ **********************************************************************/
+void SuperNes::find_rom_info(void){
+
+	uint8_t header[HEADER_SIZE];
+	uint16_t complement, checksum;
+	uint8_t size_code;
+
+	read_wait();
+	read_bytes(HEADER_ADDRESS, header, HEADER_SIZE, mem_prg);
+	complement = header[HEADER_COMPLEMENT] | (header[HEADER_COMPLEMENT + 1] << 8);
+	checksum = header[HEADER_COMPLEMENT + 2] | (header[HEADER_COMPLEMENT + 3] << 8);
+
+	rom_info.size = 0;
+	rom_info.mapping = map_lorom;
+	rom_info.header = HEADER_ADDRESS & (LOROM_BANK_SIZE - 1);
+	if( (complement ^ checksum) != 0xFFFF ){
+		rom_info.mapping = map_unknown;
+		return;
+	}
+
+	// 0x20 LoROM, 0x21 HiROM, 0x25 ExHiROM, bit 4 is the fast rom flag
+	switch( header[HEADER_MAP_MODE] & 0xEF ){
+	case 0x21:
+		rom_info.mapping = map_hirom;
+		rom_info.header = HEADER_ADDRESS;
+		break;
+	case 0x25:
+		rom_info.mapping = map_exhirom;
+		rom_info.header = HIROM_SIZE | HEADER_ADDRESS;
+		break;
+	default:
+		break;
+	}
+
+	// 1KB << n, past the mapping's end the banks aren't there
+	size_code = header[HEADER_ROM_SIZE];
+	if( size_code >= 8 && size_code <= 13 ){
+		rom_info.size = 0x400UL << size_code;
+		if( rom_info.mapping == map_exhirom && rom_info.size > EXHIROM_SIZE ){
+			rom_info.size = EXHIROM_SIZE;
+		}else if( rom_info.mapping != map_exhirom && rom_info.size > HIROM_SIZE ){
+			rom_info.size = HIROM_SIZE;
+		}
+	}
+}
+
+/*******************************************************************//**
+ * LoROM has 32KB in the upper half of banks 0x80-0xFF, HiROM 64KB
+ * banks at 0xC0-0xFF and ExHiROM continues at 0x40-0x7D. Consecutive
+ * banks are consecutive bus addresses so a HiROM run is the whole rom.
+ **********************************************************************/
+uint32_t SuperNes::map_rom(uint32_t address, uint16_t &size){
+	uint32_t bus, run;
+
+	switch( rom_info.mapping ){
+	case map_hirom:
+		address &= HIROM_SIZE - 1;
+		bus = 0xC00000 | address;
+		run = HIROM_SIZE - address;
+		break;
+	case map_exhirom:
+		if( address < HIROM_SIZE ){
+			bus = 0xC00000 | address;
+			run = HIROM_SIZE - address;
+		}else{
+			bus = (address - HIROM_SIZE) & (HIROM_SIZE - 1);
+			run = HIROM_SIZE - bus;
+			bus |= 0x400000;
+		}
+		break;
+	default:
+		address &= HIROM_SIZE - 1;
+		bus = 0x808000 | ((address & ~(LOROM_BANK_SIZE - 1)) << 1) | (address & (LOROM_BANK_SIZE - 1));
+		run = LOROM_BANK_SIZE - (address & (LOROM_BANK_SIZE - 1));
+		break;
+	}
+
+	if( size > run ){
+		size = run;
+	}
+	return SNES_CE | bus;
+}
+
+/*******************************************************************//**
+* 8 BIT OPERATIONS
+************************************************************************
+ * single 8bit read at 32bit address
+ **********************************************************************/
+uint8_t SuperNes::read_byte(uint32_t address, e_memory_type mem_t){
+	uint16_t size = 1;
+	return *(__IO uint8_t *)(this->map_rom(address, size));
+}
+
+/*******************************************************************//**
+ * multiple 8bit reads at 32bit address, a run at a time
+ **********************************************************************/
+void SuperNes::read_bytes(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t, bool dma){
+	uint32_t fsmc_addr;
+	uint16_t len;
+	Perf::Probe probe(Perf::stage_bus_read);
+
+	for(; size != 0; size -= len){
+		len = size;
+		fsmc_addr = this->map_rom(address, len);
+		address += len;
+
+		if(dma){
+			HAL_DMA_Start(param.dma_channel, fsmc_addr, (uint32_t)buf, len);
+			HAL_DMA_PollForTransfer(param.dma_channel, HAL_DMA_FULL_TRANSFER, DMA_TIMEOUT);
+			buf += len;
+		}else{
+			for( uint16_t i = len; i != 0; i-- ){
+				*(buf++) = *(__IO uint8_t *)(fsmc_addr++);
+			}
+		}
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void SuperNes::read_async(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t){
+
+	uint32_t fsmc_addr;
+	uint16_t len = size;
+
+	read_wait();
+	fsmc_addr = this->map_rom(address, len);
+	if( len != size ){
+		read_bytes(address, buf, size, mem_t, true);
+		return;
+	}
+
+	pending_read = size;
+	HAL_DMA_Start(param.dma_channel, fsmc_addr, (uint32_t)buf, size);
+}
+
+/*******************************************************************//**
+ * bytes need no swap
+ **********************************************************************/
+bool SuperNes::read_wait(bool bus_order){
+
+	if( pending_read == 0 ){
+		return false;
+	}
+	uint32_t start = Perf::now();
+	HAL_DMA_PollForTransfer(param.dma_channel, HAL_DMA_FULL_TRANSFER, DMA_TIMEOUT);
+	start = Perf::now() - start;
+	Perf::stage(Perf::stage_dma_wait, start);
+	trace(TRACE_DMA_DONE, pending_read, start);
+	pending_read = 0;
+	return false;
+}
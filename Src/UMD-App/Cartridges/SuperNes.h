@@ -0,0 +1,92 @@
+/*******************************************************************//**
+ *  \file SuperNes.h
+ *  \author René Richard
+ *  \brief This program allows to read and write to various game cartridges.
+ *         The UMD base class handles all generic cartridge operations, console
+ *         specific operations are handled in derived classes.
+ *
+ * \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CARTRIDGES_SUPERNES_H_
+#define CARTRIDGES_SUPERNES_H_
+
+#include "Cartridge.h"
+
+/*******************************************************************//**
+ * \class SuperNes
+ * \brief The 24 bit CPU address is on the FSMC address lines of CE0, bank
+ *        in A16-A23, and CE0 is /ROMSEL. mem_prg addresses are offsets in
+ *        the rom file, they're translated to the banks of the mapping
+ *        found in the internal header. 16 bit address reads are CPU
+ *        addresses in bank 0x00.
+ **********************************************************************/
+class SuperNes : public Cartridge
+{
+public:
+
+	/*******************************************************************//**
+	 * \brief Constructor
+	 **********************************************************************/
+	SuperNes();
+
+	/*******************************************************************//**
+	 * \brief setup the UMD's hardware for the current cartridge
+	 * \return void
+	 **********************************************************************/
+	void init();
+	void get_flash_id(void);
+	void find_rom_info(void);
+
+	// rom_info.mapping
+	enum e_mapping : uint8_t {
+		map_unknown=0, map_lorom, map_hirom, map_exhirom
+	};
+
+	using Cartridge::read_byte;
+	using Cartridge::read_bytes;
+	uint8_t read_byte(uint32_t address, e_memory_type mem_t);
+	void read_bytes(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t, bool dma = false);
+
+	// a read within one run of the mapping is a single DMA transfer
+	void read_async(uint32_t address, uint8_t *buf, uint16_t size, e_memory_type mem_t);
+	bool read_wait(bool bus_order = false);
+
+private:
+
+	// bus address of a rom offset, size is clipped to the run of consecutive CPU addresses holding it
+	uint32_t map_rom(uint32_t address, uint16_t &size);
+
+	const uint32_t SNES_CE = UMD_CE0;
+
+	// the internal header, at 0x00FFC0 in every mapping
+	const uint16_t HEADER_ADDRESS = 0xFFC0;
+	static const uint8_t HEADER_SIZE = 0x20;
+	static const uint8_t HEADER_MAP_MODE = 0x15;
+	static const uint8_t HEADER_ROM_SIZE = 0x17;
+	static const uint8_t HEADER_COMPLEMENT = 0x1C;	///< u16 complement then u16 checksum
+
+	const uint32_t LOROM_BANK_SIZE = 0x8000;
+	const uint32_t HIROM_SIZE = 0x400000;			///< banks 0xC0-0xFF
+	const uint32_t EXHIROM_SIZE = 0x7E0000;			///< then banks 0x40-0x7D
+
+	const uint32_t DMA_TIMEOUT = 100;
+
+	uint16_t pending_read = 0;						///< bytes of the DMA read in progress
+
+};
+
+#endif /* CARTRIDGES_SUPERNES_H_ */
@@ -0,0 +1,271 @@
+/*******************************************************************//**
+ *  \file Codec.cpp
+ *  \author René Richard
+ *  \brief Block codec used to compress dumped data before it is sent over
+ *         USB.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include "Codec.h"
+
+// unaligned 32 bit load, a single ldr on the Cortex-M4
+static inline uint32_t read32(const uint8_t *p){
+	uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint16_t hash32(uint32_t v){
+	return (uint16_t)((v * 2654435761U) >> (32 - CODEC_HASH_BITS));
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint16_t Codec::encode(const uint8_t *src, uint16_t len, uint8_t *dst){
+
+	s_block_header *header = reinterpret_cast<s_block_header *>(dst);
+	uint16_t i, n;
+
+	header->raw_len = len;
+	header->fill = 0;
+
+	// padding and erased areas are a single repeated byte
+	for( i = 1; i < len && src[i] == src[0]; i++ );
+	if( len != 0 && i == len ){
+		header->type = block_fill;
+		header->fill = src[0];
+		return CODEC_HEADER_SIZE;
+	}
+
+	// the lz block is only kept if it's smaller than the raw data
+	n = lz_compress(src, len, dst + CODEC_HEADER_SIZE, len);
+	if( n != 0 ){
+		header->type = block_lz;
+	}else{
+		header->type = block_raw;
+		std::memcpy(dst + CODEC_HEADER_SIZE, src, len);
+		n = len;
+	}
+
+	while( n % 4 != 0 ){
+		dst[CODEC_HEADER_SIZE + n++] = 0;
+	}
+	return CODEC_HEADER_SIZE + n;
+}
+
+/*******************************************************************//**
+ * Greedy LZ77 with a single entry hash chain, sequences are
+ * [token][literal len ext][literals][u16 offset][match len ext]
+ * the token holds the literal length in the high nibble and the match
+ * length - MIN_MATCH in the low nibble, 15 means more bytes follow.
+ * \return compressed length, 0 if it doesn't fit in capacity
+ **********************************************************************/
+uint16_t Codec::lz_compress(const uint8_t *src, uint16_t len, uint8_t *dst, uint16_t capacity){
+
+	uint8_t *op = dst;
+	const uint8_t *op_end = dst + capacity;
+	uint32_t ip, anchor, ref, match_len, lit_len, n;
+	uint16_t h;
+	uint8_t *token;
+
+	std::memset(hash_table, 0xFF, sizeof(hash_table));
+
+	ip = 0;
+	anchor = 0;
+	while( ip + MIN_MATCH <= len ){
+
+		h = hash32(read32(src + ip));
+		ref = hash_table[h];
+		hash_table[h] = (uint16_t)ip;
+
+		if( ref == HASH_EMPTY || read32(src + ref) != read32(src + ip) ){
+			// skip faster through data that doesn't compress
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+
+		match_len = MIN_MATCH;
+		while( ip + match_len < len && src[ref + match_len] == src[ip + match_len] ){
+			match_len++;
+		}
+
+		// worst case size of this sequence
+		lit_len = ip - anchor;
+		if( op + 1 + (lit_len / 255) + 1 + lit_len + 2 + (match_len / 255) + 1 > op_end ){
+			return 0;
+		}
+
+		token = op++;
+		*token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+		if( lit_len >= 15 ){
+			for( n = lit_len - 15; n >= 255; n -= 255 ){
+				*(op++) = 255;
+			}
+			*(op++) = (uint8_t)n;
+		}
+		std::memcpy(op, src + anchor, lit_len);
+		op += lit_len;
+
+		*(op++) = (uint8_t)(ip - ref);
+		*(op++) = (uint8_t)((ip - ref) >> 8);
+
+		n = match_len - MIN_MATCH;
+		*token |= (uint8_t)(n >= 15 ? 15 : n);
+		if( n >= 15 ){
+			for( n -= 15; n >= 255; n -= 255 ){
+				*(op++) = 255;
+			}
+			*(op++) = (uint8_t)n;
+		}
+
+		ip += match_len;
+		anchor = ip;
+		// the position just before the next search is a likely match for the following data
+		if( ip + MIN_MATCH <= len ){
+			hash_table[hash32(read32(src + ip - 2))] = (uint16_t)(ip - 2);
+		}
+	}
+
+	// the last sequence only has literals
+	lit_len = len - anchor;
+	if( op + 1 + (lit_len / 255) + 1 + lit_len >= op_end ){
+		return 0;
+	}
+	token = op++;
+	*token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+	if( lit_len >= 15 ){
+		for( n = lit_len - 15; n >= 255; n -= 255 ){
+			*(op++) = 255;
+		}
+		*(op++) = (uint8_t)n;
+	}
+	std::memcpy(op, src + anchor, lit_len);
+	op += lit_len;
+
+	return (uint16_t)(op - dst);
+}
+
+/*******************************************************************//**
+ * every length and offset is checked, a corrupt block can't write outside dst
+ **********************************************************************/
+int32_t Codec::decode(const uint8_t *block, uint32_t block_len, uint8_t *dst, uint32_t capacity){
+
+	s_block_header header;
+	const uint8_t *ip, *ip_end;
+	uint8_t *op, *op_end;
+	uint32_t lit_len, match_len, offset;
+	uint8_t token, b;
+
+	if( block_len < CODEC_HEADER_SIZE ){
+		return -1;
+	}
+	std::memcpy(&header, block, sizeof(header));
+	if( header.raw_len > capacity ){
+		return -1;
+	}
+	ip = block + CODEC_HEADER_SIZE;
+	ip_end = block + block_len;
+
+	switch(header.type){
+	case block_fill:
+		std::memset(dst, header.fill, header.raw_len);
+		return header.raw_len;
+
+	case block_raw:
+		if( (uint32_t)(ip_end - ip) < header.raw_len ){
+			return -1;
+		}
+		std::memcpy(dst, ip, header.raw_len);
+		return header.raw_len;
+
+	case block_lz:
+		break;
+
+	default:
+		return -1;
+	}
+
+	op = dst;
+	op_end = dst + header.raw_len;
+	while( op < op_end ){
+
+		if( ip >= ip_end ){
+			return -1;
+		}
+		token = *(ip++);
+
+		lit_len = token >> 4;
+		if( lit_len == 15 ){
+			do{
+				if( ip >= ip_end ){
+					return -1;
+				}
+				b = *(ip++);
+				lit_len += b;
+			}while( b == 255 );
+		}
+		if( lit_len > (uint32_t)(ip_end - ip) || lit_len > (uint32_t)(op_end - op) ){
+			return -1;
+		}
+		std::memcpy(op, ip, lit_len);
+		op += lit_len;
+		ip += lit_len;
+
+		// the last sequence has no match
+		if( op == op_end ){
+			break;
+		}
+
+		if( ip_end - ip < 2 ){
+			return -1;
+		}
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if( offset == 0 || offset > (uint32_t)(op - dst) ){
+			return -1;
+		}
+
+		match_len = token & 0x0F;
+		if( match_len == 15 ){
+			do{
+				if( ip >= ip_end ){
+					return -1;
+				}
+				b = *(ip++);
+				match_len += b;
+			}while( b == 255 );
+		}
+		match_len += MIN_MATCH;
+		if( match_len > (uint32_t)(op_end - op) ){
+			return -1;
+		}
+
+		if( offset >= match_len ){
+			std::memcpy(op, op - offset, match_len);
+			op += match_len;
+		}else{
+			// byte copy, the match overlaps the output for runs
+			for( const uint8_t *ref = op - offset; match_len != 0; match_len-- ){
+				*(op++) = *(ref++);
+			}
+		}
+	}
+
+	return header.raw_len;
+}
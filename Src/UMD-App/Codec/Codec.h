@@ -0,0 +1,85 @@
+/*******************************************************************//**
+ *  \file Codec.h
+ *  \author René Richard
+ *  \brief Block codec used to compress dumped data before it is sent over
+ *         USB. It has no hardware dependencies, the host tools build the
+ *         same source to decode.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CODEC_CODEC_H_
+#define CODEC_CODEC_H_
+
+#include <cstdint>
+
+#define CODEC_BLOCK_SIZE		4096							///< largest uncompressed block
+#define CODEC_HEADER_SIZE		4
+#define CODEC_MAX_BLOCK			(CODEC_BLOCK_SIZE + CODEC_HEADER_SIZE)	///< worst case encoded block
+#define CODEC_HASH_BITS			11
+
+/*******************************************************************//**
+ * \class Codec
+ * \brief Every block is encoded on its own so it can be decoded as soon as it
+ *        is received. A block is a 4 byte header followed by the data, 0 padded
+ *        to a multiple of 4:
+ *        - block_raw  the data as is
+ *        - block_fill nothing, the whole block is the fill byte (0xFF/0x00 padding)
+ *        - block_lz   LZ77 sequences in the LZ4 layout, matches only reference
+ *                     earlier bytes of the same block
+ **********************************************************************/
+class Codec{
+public:
+
+	enum e_block_type : uint8_t {
+		block_raw=0, block_fill, block_lz
+	};
+
+	struct s_block_header{
+		uint8_t		type;			///< e_block_type
+		uint8_t		fill;			///< fill byte of a block_fill
+		uint16_t	raw_len;		///< size of the block once decoded
+	};
+
+	/*******************************************************************//**
+	 * \brief encode a block with whichever type is the smallest
+	 * \param src data to encode
+	 * \param len at most CODEC_BLOCK_SIZE
+	 * \param dst room for CODEC_MAX_BLOCK bytes, 4 byte aligned
+	 * \return encoded length, a multiple of 4
+	 **********************************************************************/
+	uint16_t encode(const uint8_t *src, uint16_t len, uint8_t *dst);
+
+	/*******************************************************************//**
+	 * \brief decode a block
+	 * \param block the encoded block
+	 * \param block_len length of the encoded block
+	 * \param dst destination for the decoded data
+	 * \param capacity room in dst
+	 * \return decoded length, -1 if the block is corrupt or doesn't fit
+	 **********************************************************************/
+	static int32_t decode(const uint8_t *block, uint32_t block_len, uint8_t *dst, uint32_t capacity);
+
+private:
+	static const uint16_t MIN_MATCH = 4;
+	static const uint16_t HASH_EMPTY = 0xFFFF;
+
+	uint16_t hash_table[1 << CODEC_HASH_BITS];		///< last position of each hashed 4 byte sequence
+
+	uint16_t lz_compress(const uint8_t *src, uint16_t len, uint8_t *dst, uint16_t capacity);
+};
+
+#endif /* CODEC_CODEC_H_ */
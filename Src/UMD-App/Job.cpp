@@ -0,0 +1,172 @@
+/*******************************************************************//**
+ *  \file Job.cpp
+ *  \author René Richard
+ *  \brief Long cartridge operations stepped by the main loop.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Job.h"
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+Job::Job(e_kind kind){
+	status = {};
+	status.kind = kind;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+bool Job::start(uint16_t id, Cartridge *cart){
+
+	this->cart = cart;
+	abort_requested = false;
+	status.id = id;
+	status.done = 0;
+	status.total = 0;
+	status.elapsed_ms = 0;
+	start_tick = HAL_GetTick();
+
+	// flash commands need the geometry for the chip count and the times
+	if( cart->geometry.source == Cartridge::geometry_unprobed ){
+		cart->get_flash_id();
+	}
+	status.state = begin() ? state_running : state_failed;
+	return running();
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+bool Job::poll(void){
+
+	if( !running() ){
+		return false;
+	}
+	status.state = step();
+	status.elapsed_ms = HAL_GetTick() - start_tick;
+	return running();
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void Job::cancel(void){
+
+	if( running() ){
+		status.state = state_failed;
+		status.elapsed_ms = HAL_GetTick() - start_tick;
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+bool JobEraseChip::begin(void){
+
+	if( !(cart->param.ops & Cartridge::op_erase) ){
+		return false;
+	}
+	cart->erase_flash(false);
+	chip = 0;
+	status.total = cart->geometry.size * cart->geometry.chips;
+	return true;
+}
+
+/*******************************************************************//**
+ * Like wait_erase() nothing is read back for the first half of the
+ * typical time, the progress is the share of the typical time gone by
+ * and stays short of the total until the chips are done.
+ **********************************************************************/
+Job::e_state JobEraseChip::step(void){
+
+	const Cartridge::s_flash_geometry &g = cart->geometry;
+	uint32_t elapsed = HAL_GetTick() - start_tick;
+
+	if( elapsed >= g.chip_erase_typ_ms / 2 ){
+		while( chip < g.chips && !cart->erase_busy(g.size * chip) ){
+			chip++;
+		}
+		if( chip == g.chips ){
+			status.done = status.total;
+			return abort_requested ? state_aborted : state_done;
+		}
+		if( elapsed > g.chip_erase_max_ms ){
+			cart->flash_reset(g.size * chip);
+			return state_failed;
+		}
+	}
+
+	if( g.chip_erase_typ_ms != 0 && elapsed < g.chip_erase_typ_ms ){
+		status.done = (uint32_t)(((uint64_t)status.total * elapsed) / g.chip_erase_typ_ms);
+	}else if( status.total != 0 ){
+		status.done = status.total - 1;
+	}
+	return state_running;
+}
+
+/*******************************************************************//**
+ * the range is rounded out to whole sectors, it needs a geometry
+ **********************************************************************/
+bool JobEraseRange::begin(void){
+
+	uint32_t last, last_size;
+
+	if( !(cart->param.ops & Cartridge::op_erase) || size == 0
+			|| !cart->sector_bounds(address, sector, sector_size)
+			|| !cart->sector_bounds(address + size - 1, last, last_size) ){
+		return false;
+	}
+	end = last + last_size;
+	status.total = end - sector;
+	pending = false;
+	return true;
+}
+
+/*******************************************************************//**
+ * a sector erase is started and then checked on at every step
+ **********************************************************************/
+Job::e_state JobEraseRange::step(void){
+
+	if( pending ){
+		if( cart->erase_busy(sector) ){
+			if( (HAL_GetTick() - sector_tick) > cart->geometry.erase_max_ms ){
+				cart->flash_reset(sector);
+				return state_failed;
+			}
+			return state_running;
+		}
+		pending = false;
+		status.done += sector_size;
+		sector += sector_size;
+	}
+
+	if( sector >= end ){
+		return state_done;
+	}
+	if( abort_requested ){
+		return state_aborted;
+	}
+	if( !cart->sector_bounds(sector, sector, sector_size) ){
+		return state_failed;
+	}
+	cart->erase_sector(sector, false);
+	sector_tick = HAL_GetTick();
+	pending = true;
+	return state_running;
+}
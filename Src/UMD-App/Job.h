@@ -0,0 +1,134 @@
+/*******************************************************************//**
+ *  \file Job.h
+ *  \author René Richard
+ *  \brief Long cartridge operations run as jobs, stackless state machines
+ *         stepped by the main loop between commands. A step never waits
+ *         on the flash, so the UMDv2 keeps answering the host and reading
+ *         the cartridge current while an erase goes on for minutes.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JOB_H_
+#define JOB_H_
+
+#include <cstdint>
+#include "Cartridges/Cartridge.h"
+
+/*******************************************************************//**
+ * \class Job
+ * \brief base of the jobs, each kind is allocated once with the UMD and
+ *        started again for every request
+ **********************************************************************/
+class Job{
+public:
+
+	enum e_kind : uint8_t {
+		kind_none=0, kind_erase_chip, kind_erase_range
+	};
+
+	enum e_state : uint8_t {
+		state_idle=0, state_running, state_done, state_failed, state_aborted
+	};
+
+	/*******************************************************************//**
+	 * \brief s_status
+	 * replied as is by the job status command, done and total are in bytes
+	 **********************************************************************/
+	struct s_status{
+		uint16_t id;
+		uint8_t kind;						///< e_kind
+		uint8_t state;						///< e_state
+		uint32_t done;
+		uint32_t total;
+		uint32_t elapsed_ms;
+	} status;
+
+	explicit Job(e_kind kind);
+	virtual ~Job(){}
+
+	/*******************************************************************//**
+	 * \brief start the job on the cartridge
+	 * \return false if the cartridge can't run it, the job is then failed
+	 **********************************************************************/
+	bool start(uint16_t id, Cartridge *cart);
+
+	/*******************************************************************//**
+	 * \brief one step of a running job
+	 * \return true while the job is running
+	 **********************************************************************/
+	bool poll(void);
+
+	// the job stops at its next safe point and ends as aborted
+	void inline abort(void){ abort_requested = true; };
+	// the cartridge went away, nothing more is sent to it
+	void cancel(void);
+	bool inline running(void) const { return status.state == state_running; };
+
+protected:
+
+	virtual bool begin(void) = 0;
+	virtual e_state step(void) = 0;
+
+	Cartridge *cart = nullptr;
+	uint32_t start_tick = 0;
+	bool abort_requested = false;
+};
+
+/*******************************************************************//**
+ * \class JobEraseChip
+ * \brief every chip of the board erases at once, a chip erase can't be
+ *        stopped so an abort only ends the job once the chips are done
+ **********************************************************************/
+class JobEraseChip : public Job{
+public:
+	JobEraseChip() : Job(kind_erase_chip) {}
+
+protected:
+	bool begin(void);
+	e_state step(void);
+
+private:
+	uint8_t chip = 0;						///< first chip still busy
+};
+
+/*******************************************************************//**
+ * \class JobEraseRange
+ * \brief erases the sectors a range touches one at a time, an abort
+ *        stops before the next sector
+ **********************************************************************/
+class JobEraseRange : public Job{
+public:
+	JobEraseRange() : Job(kind_erase_range) {}
+
+	// the range of the next start()
+	void inline set_range(uint32_t address, uint32_t size){ this->address = address; this->size = size; };
+
+protected:
+	bool begin(void);
+	e_state step(void);
+
+private:
+	uint32_t address = 0;
+	uint32_t size = 0;
+	uint32_t sector = 0;
+	uint32_t sector_size = 0;
+	uint32_t end = 0;						///< end of the range's last sector
+	uint32_t sector_tick = 0;				///< the erase of sector started
+	bool pending = false;
+};
+
+#endif /* JOB_H_ */
@@ -0,0 +1,33 @@
+/*******************************************************************//**
+ *  \file NoHeap.cpp
+ *  \author René Richard
+ *  \brief The UMD firmware is statically allocated, nothing is ever created
+ *         with new or malloc.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstddef>
+
+/*******************************************************************//**
+ * The deleting destructors of classes with a virtual destructor (i.e. the
+ * cartridges) reference operator delete. The library version calls free()
+ * which drags malloc and _sbrk into the link, these never get called so
+ * replace them with empty versions. Any use of new will still reach _sbrk
+ * and fail the link, see sysmem.c
+ **********************************************************************/
+void operator delete(void *ptr) noexcept {}
+void operator delete(void *ptr, std::size_t size) noexcept {}
@@ -0,0 +1,46 @@
+/*******************************************************************//**
+ *  \file Perf.cpp
+ *  \author René Richard
+ *  \brief Cycle counter profiler statistics.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include "Perf.h"
+
+Perf::s_stat Perf::stages[Perf::stage_count];
+Perf::s_stat Perf::commands[PERF_MAX_COMMANDS];
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+static void reset_stats(Perf::s_stat *stats, uint16_t count){
+
+	std::memset(stats, 0, count * sizeof(Perf::s_stat));
+	for(; count != 0; count--){
+		(stats++)->min = 0xFFFFFFFF;
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void Perf::reset(void){
+
+	reset_stats(stages, stage_count);
+	reset_stats(commands, PERF_MAX_COMMANDS);
+}
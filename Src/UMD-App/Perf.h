@@ -0,0 +1,122 @@
+/*******************************************************************//**
+ *  \file Perf.h
+ *  \author René Richard
+ *  \brief Cycle counter profiler. Probes around the stages of a command
+ *         accumulate min/max/total and a log2 histogram of the cycles spent
+ *         in each stage and in each command. A probe costs a couple dozen
+ *         cycles so it stays enabled in release builds.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PERF_H_
+#define PERF_H_
+
+#include <cstdint>
+#include "main.h"
+
+#define UMD_PERF				1		///< 0 compiles the statistics and probes out, now() stays
+
+#define PERF_HIST_BINS			32		///< bin n counts durations of 2^n to 2^(n+1)-1 cycles
+#define PERF_MAX_COMMANDS		32
+
+/*******************************************************************//**
+ * \class Perf
+ * \brief the statistics are static so probes can be placed in any class,
+ *        only the main loop records, never an interrupt
+ **********************************************************************/
+class Perf{
+public:
+
+	// stages of a command, keep in sync with the host's names
+	enum e_stage : uint8_t {
+		stage_header_wait=0,		///< a command header arriving, only recorded when one did
+		stage_payload_wait,			///< rest of the payload after the header
+		stage_crc,					///< request and reply crc
+		stage_execute,				///< the command itself
+		stage_bus_read,				///< cartridge bulk reads
+		stage_bus_program,			///< cartridge programming
+		stage_dma_wait,				///< waiting on a background cartridge read
+		stage_transmit,				///< handing a reply to the CDC class
+		stage_count
+	};
+
+	struct s_stat{
+		uint32_t count;
+		uint32_t min;				///< 0xFFFFFFFF while count is 0
+		uint32_t max;
+		uint32_t reserved;
+		uint64_t total;				///< average is total / count
+		uint32_t hist[PERF_HIST_BINS];
+	};
+
+	// the cycle counter is also the clock of the flash timeouts and bus measurements, it stays with UMD_PERF 0
+	static inline uint32_t now(void){ return DWT->CYCCNT; }
+
+	/*******************************************************************//**
+	 * \brief add a duration to a statistic
+	 **********************************************************************/
+	static inline void record(s_stat &stat, uint32_t cycles){
+#if UMD_PERF
+		stat.count++;
+		stat.total += cycles;
+		if( cycles < stat.min ){
+			stat.min = cycles;
+		}
+		if( cycles > stat.max ){
+			stat.max = cycles;
+		}
+		stat.hist[31 - __CLZ(cycles | 1)]++;
+#endif
+	}
+
+	static inline void stage(e_stage s, uint32_t cycles){ record(stages[s], cycles); }
+	static inline void command(uint16_t index, uint32_t cycles){
+		if( index < PERF_MAX_COMMANDS ){
+			record(commands[index], cycles);
+		}
+	}
+
+	/*******************************************************************//**
+	 * \brief clear every statistic
+	 **********************************************************************/
+	static void reset(void);
+
+	/*******************************************************************//**
+	 * \class Probe
+	 * \brief times its own scope into a stage
+	 **********************************************************************/
+#if UMD_PERF
+	class Probe{
+	public:
+		explicit Probe(e_stage s) : s(s), start(now()) {}
+		~Probe(){ stage(s, now() - start); }
+	private:
+		e_stage s;
+		uint32_t start;
+	};
+#else
+	class Probe{
+	public:
+		explicit Probe(e_stage) {}
+	};
+#endif
+
+	static s_stat stages[stage_count];
+	static s_stat commands[PERF_MAX_COMMANDS];
+};
+
+#endif /* PERF_H_ */
@@ -0,0 +1,168 @@
+/*******************************************************************//**
+ *  \file Serializer.h
+ *  \author René Richard
+ *  \brief Word aligned serializer used to build replies in the USB buffer.
+ *         It has no hardware dependencies so the host tools can use it too.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERIALIZER_H_
+#define SERIALIZER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/*******************************************************************//**
+ * \class Span
+ * \brief typed view of space reserved in the serializer
+ **********************************************************************/
+template<typename T>
+struct Span{
+	T			*data;
+	uint16_t	count;
+
+	T& operator[](uint16_t i) const { return data[i]; }
+	T* begin(void) const { return data; }
+	T* end(void) const { return data + count; }
+	explicit operator bool(void) const { return data != nullptr; }
+};
+
+/*******************************************************************//**
+ * \class Serializer
+ * \brief Appends fields to a uint32_t buffer. Every field starts on a uint32_t
+ *        boundary and is 0 padded to the next one, so all stores are aligned
+ *        32-bit stores and the buffer can be CRC'd a uint32_t at a time.
+ **********************************************************************/
+class Serializer{
+public:
+
+	/*******************************************************************//**
+	 * \brief Constructor
+	 * \param buf the buffer to serialize into
+	 * \param capacity usable size of buf in bytes, a multiple of 4
+	 * \param size the current size of buf in bytes, updated as fields are added
+	 **********************************************************************/
+	Serializer(uint32_t *buf, uint16_t capacity, uint16_t &size) :
+		lwords(buf), capacity(capacity), size(size) {}
+
+	uint16_t room(void) const { return (size < capacity) ? capacity - size : 0; }
+
+	/*******************************************************************//**
+	 * \brief reserve space for count elements of T, the caller fills them in
+	 * \return span over the reserved space, empty if there isn't enough room
+	 **********************************************************************/
+	template<typename T>
+	Span<T> reserve(uint16_t count){
+		static_assert(std::is_trivially_copyable<T>::value, "only plain data can be serialized");
+		static_assert(alignof(T) <= sizeof(uint32_t), "fields are only aligned to uint32_t");
+
+		uint32_t len = padded((uint32_t)count * sizeof(T));
+		if( len > room() ){
+			return { nullptr, 0 };
+		}
+
+		T *data = reinterpret_cast<T *>(&lwords[size >> 2]);
+		// clear the pad bytes of the last lword before the caller fills it
+		if( len != 0 ){
+			lwords[((size + len) >> 2) - 1] = 0;
+		}
+		size += len;
+		return { data, count };
+	}
+
+	/*******************************************************************//**
+	 * \brief fixed size field of up to 4 bytes, a single aligned store
+	 * \return bytes used in the buffer, 0 if there isn't enough room
+	 **********************************************************************/
+	template<typename T>
+	uint16_t put(T value){
+		static_assert(std::is_trivially_copyable<T>::value, "only plain data can be serialized");
+		static_assert(sizeof(T) <= sizeof(uint32_t), "use put(data, len) for fields larger than 4 bytes");
+
+		uint32_t lword = 0;
+		if( room() < sizeof(lword) ){
+			return 0;
+		}
+		std::memcpy(&lword, &value, sizeof(T));
+		lwords[size >> 2] = lword;
+		size += sizeof(lword);
+		return sizeof(lword);
+	}
+
+	/*******************************************************************//**
+	 * \brief fixed size array, the length is known at compile time
+	 **********************************************************************/
+	template<typename T, size_t N>
+	uint16_t put(const T (&array)[N]){
+		static_assert(std::is_trivially_copyable<T>::value, "only plain data can be serialized");
+		return put(array, (uint16_t)(sizeof(T) * N));
+	}
+
+	/*******************************************************************//**
+	 * \brief bulk copy of len bytes
+	 * \return bytes used in the buffer, 0 if there isn't enough room
+	 **********************************************************************/
+	uint16_t put(const void *data, uint16_t len){
+
+		uint32_t padded_len = padded(len);
+		if( padded_len > room() ){
+			return 0;
+		}
+		if( padded_len != len ){
+			lwords[((size + padded_len) >> 2) - 1] = 0;
+		}
+		copy(&lwords[size >> 2], data, len);
+		size += padded_len;
+		return padded_len;
+	}
+
+	static constexpr uint32_t padded(uint32_t len){ return (len + 3) & ~(uint32_t)3; }
+
+private:
+	uint32_t	*lwords;
+	uint16_t	capacity;
+	uint16_t	&size;
+
+	// word copy when the source is aligned, the library memcpy may be the small byte-at-a-time one
+	static void copy(uint32_t *dst, const void *src, uint16_t len){
+
+		if( ((uintptr_t)src & 3) == 0 ){
+			const uint32_t *s = static_cast<const uint32_t *>(src);
+			uint16_t n = len >> 2;
+			for( ; n >= 4; n -= 4 ){
+				dst[0] = s[0];
+				dst[1] = s[1];
+				dst[2] = s[2];
+				dst[3] = s[3];
+				dst += 4;
+				s += 4;
+			}
+			for( ; n != 0; n-- ){
+				*(dst++) = *(s++);
+			}
+			if( len & 3 ){
+				std::memcpy(dst, s, len & 3);
+			}
+		}else{
+			std::memcpy(dst, src, len);
+		}
+	}
+};
+
+#endif /* SERIALIZER_H_ */
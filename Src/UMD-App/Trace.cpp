@@ -0,0 +1,183 @@
+/*******************************************************************//**
+ *  \file Trace.cpp
+ *  \author René Richard
+ *  \brief Binary event trace ring drained to USART3 by DMA1 stream 3.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "main.h"
+#include "usart.h"
+#include "Trace.h"
+
+static_assert((TRACE_SLOTS & (TRACE_SLOTS - 1)) == 0, "the ring size must be a power of 2");
+static_assert(sizeof(s_trace_record) == 16, "records are 16 bytes on the wire");
+
+volatile uint32_t trace_mask = 0;
+
+/*******************************************************************//**
+ * Writers reserve a slot by bumping head with LDREX/STREX, so an interrupt
+ * can record in the middle of a thread mode record. A record is complete
+ * once its seq matches its index, the drain stops at the first incomplete
+ * one. Only thread mode and the DMA interrupt start the drain and never
+ * while it is running, they can't both be in drain_start().
+ **********************************************************************/
+static struct{
+	s_trace_record		ring[TRACE_SLOTS];
+	volatile uint32_t	head;				///< next index to reserve
+	volatile uint32_t	tail;				///< next index to send
+	volatile uint32_t	dropped;			///< records lost to a full ring
+	volatile uint32_t	in_flight;			///< records the DMA is sending
+	volatile bool		busy;
+}tr;
+
+#define TRACE_DMA			DMA1_Stream3
+#define TRACE_DMA_CHANNEL	4
+#define TRACE_DMA_FLAGS		(DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3)
+
+static void atomic_add(volatile uint32_t *value, uint32_t n){
+	uint32_t v;
+	do{
+		v = __LDREXW(value);
+	}while( __STREXW(v + n, value) );
+}
+
+/*******************************************************************//**
+ * \return false if the ring is full
+ **********************************************************************/
+static bool trace_write(uint16_t event, uint32_t arg0, uint32_t arg1){
+	uint32_t index;
+	s_trace_record *rec;
+
+	do{
+		index = __LDREXW(&tr.head);
+		if( index - tr.tail >= TRACE_SLOTS ){
+			__CLREX();
+			return false;
+		}
+	}while( __STREXW(index + 1, &tr.head) );
+
+	rec = &tr.ring[index & (TRACE_SLOTS - 1)];
+	rec->event = event;
+	rec->timestamp = DWT->CYCCNT;
+	rec->arg0 = arg0;
+	rec->arg1 = arg1;
+	// the record must be complete before the drain can see it
+	__DMB();
+	rec->seq = (uint16_t)index;
+	return true;
+}
+
+/*******************************************************************//**
+ * send the complete records from tail up to the end of the ring
+ **********************************************************************/
+static void drain_start(void){
+	uint32_t tail = tr.tail;
+	uint32_t slot = tail & (TRACE_SLOTS - 1);
+	uint32_t count = 0;
+
+	while( slot + count < TRACE_SLOTS && tr.ring[slot + count].seq == (uint16_t)(tail + count) ){
+		count++;
+	}
+	if( count == 0 ){
+		return;
+	}
+
+	tr.in_flight = count;
+	tr.busy = true;
+	DMA1->LIFCR = TRACE_DMA_FLAGS;
+	TRACE_DMA->M0AR = (uint32_t)&tr.ring[slot];
+	TRACE_DMA->NDTR = count * sizeof(s_trace_record);
+	TRACE_DMA->CR |= DMA_SxCR_EN;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void trace_init(void){
+
+	uint32_t i;
+
+	// a slot is complete when seq matches its index, start every slot a lap behind
+	for( i = 0; i < TRACE_SLOTS; i++ ){
+		tr.ring[i].seq = (uint16_t)(i - TRACE_SLOTS);
+	}
+	tr.head = 0;
+	tr.tail = 0;
+	tr.dropped = 0;
+	tr.busy = false;
+
+	huart3.Init.BaudRate = TRACE_BAUD;
+	HAL_UART_Init(&huart3);
+
+	// byte transfers from the ring to the data register, an interrupt per block of records
+	__HAL_RCC_DMA1_CLK_ENABLE();
+	TRACE_DMA->CR = 0;
+	while( TRACE_DMA->CR & DMA_SxCR_EN );
+	TRACE_DMA->PAR = (uint32_t)&USART3->DR;
+	TRACE_DMA->FCR = 0;
+	TRACE_DMA->CR = (TRACE_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_MINC | DMA_SxCR_DIR_0 | DMA_SxCR_TCIE;
+	USART3->CR3 |= USART_CR3_DMAT;
+
+	HAL_NVIC_SetPriority(DMA1_Stream3_IRQn, 15, 0);
+	HAL_NVIC_EnableIRQ(DMA1_Stream3_IRQn);
+
+	trace_mask = TRACE_DEFAULT_MASK;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void trace_event(uint16_t event, uint32_t arg0, uint32_t arg1){
+
+	if( !trace_write(event, arg0, arg1) ){
+		atomic_add(&tr.dropped, 1);
+		return;
+	}
+	// interrupts only record, the drain is started from thread mode or the DMA interrupt
+	if( !tr.busy && __get_IPSR() == 0 ){
+		drain_start();
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void trace_poll(void){
+
+	if( !tr.busy ){
+		drain_start();
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void trace_dma_irq(void){
+
+	uint32_t dropped;
+
+	DMA1->LIFCR = TRACE_DMA_FLAGS;
+	tr.tail = tr.tail + tr.in_flight;
+	tr.busy = false;
+
+	// the host learns about lost records as soon as there is room for it
+	dropped = tr.dropped;
+	if( dropped != 0 && trace_write(TRACE_OVERFLOW, dropped, 0) ){
+		atomic_add(&tr.dropped, -dropped);
+	}
+	drain_start();
+}
@@ -0,0 +1,104 @@
+/*******************************************************************//**
+ *  \file Trace.h
+ *  \author René Richard
+ *  \brief Binary event trace streamed out of USART3 by DMA. Events can be
+ *         recorded from any context, interrupts included, and cost a few
+ *         dozen cycles. This header is plain C so the CubeMX generated files
+ *         and the host decoder can include it.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_BAUD				2000000		///< exact with the 50MHz APB1 clock
+#define TRACE_SLOTS				256			///< records in the ring, a power of 2
+
+/*******************************************************************//**
+ * events, the mask bit of an event is 1 << event
+ **********************************************************************/
+enum e_trace_event {
+	TRACE_OVERFLOW = 0,			///< arg0 = records dropped since the last one
+	TRACE_USB_RX,				///< arg0 = packet length, arg1 = receive buffer fill
+	TRACE_USB_RX_PAUSED,		///< arg0 = receive buffer fill
+	TRACE_CMD_START,			///< arg0 = command word, arg1 = payload size
+	TRACE_CMD_END,				///< arg0 = command word, arg1 = return code
+	TRACE_DMA_DONE,				///< arg0 = bytes, arg1 = cycles spent waiting
+	TRACE_FLASH_POLL,			///< arg0 = sector address or TRACE_CHIP_ERASE, arg1 = polls so far
+	TRACE_EVENT_COUNT
+};
+
+#define TRACE_CHIP_ERASE		0xFFFFFFFFU
+
+// one USB packet per record floods the link during uploads, enable it when needed
+#define TRACE_DEFAULT_MASK		(((1U << TRACE_EVENT_COUNT) - 1) & ~(1U << TRACE_USB_RX))
+
+/*******************************************************************//**
+ * \brief s_trace_record
+ * 16 bytes on the wire, little endian. seq increments by one for every
+ * record so the host can find the record boundaries in the stream.
+ **********************************************************************/
+struct s_trace_record {
+	uint16_t	seq;
+	uint16_t	event;
+	uint32_t	timestamp;				///< DWT cycle counter
+	uint32_t	arg0;
+	uint32_t	arg1;
+};
+
+extern volatile uint32_t trace_mask;
+
+/*******************************************************************//**
+ * \brief configure USART3 and its DMA stream, call once after MX_USART3_UART_Init()
+ **********************************************************************/
+void trace_init(void);
+
+/*******************************************************************//**
+ * \brief record an event, dropped if the ring is full
+ **********************************************************************/
+void trace_event(uint16_t event, uint32_t arg0, uint32_t arg1);
+
+/*******************************************************************//**
+ * \brief record an event if it is enabled in trace_mask
+ **********************************************************************/
+static inline void trace(uint16_t event, uint32_t arg0, uint32_t arg1){
+	if( trace_mask & (1U << event) ){
+		trace_event(event, arg0, arg1);
+	}
+}
+
+/*******************************************************************//**
+ * \brief send what interrupts recorded while the drain was idle, thread mode only
+ **********************************************************************/
+void trace_poll(void);
+
+/*******************************************************************//**
+ * \brief DMA1 stream 3 transfer complete, sends the next records
+ **********************************************************************/
+void trace_dma_irq(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H_ */
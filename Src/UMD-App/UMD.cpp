@@ -48,6 +48,16 @@ void UMD::init(void){
 
 	int i;
 
+	// paint the stack first so the memory report sees everything
+	mem_paint_stack();
+	ubuf_high_water = 0;
+
+	// cycle counter for timing measurements
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	Perf::reset();
+
 	// We need a cart factory but only one, and this function is the only one that needs to update
 	// the cart ptr.  So we can use the static keyword to keep this across calls to the function
 	// check for a connected adapter and set the cartridge type accordingly
@@ -104,6 +114,11 @@ void UMD::run(void){
 		// super loop, listen for commands
 		listen();
 
+		// a running job gets a step between commands
+		if( job != nullptr ){
+			job->poll();
+		}
+
 		// check adc
 		HAL_ADC_Start(&hadc1);
 		HAL_ADC_PollForConversion(&hadc1, HAL_MAX_DELAY);
@@ -113,12 +128,18 @@ void UMD::run(void){
 		cart->get_adapter_id();
 		if(cart_id != cart->param.id){
 			//uh oh, the cartridge adapter changed!
+			if( job != nullptr ){
+				job->cancel();
+			}
 			cart_id = cart->param.id;
 			set_cartridge_type(cart_id); // type 0 = UNDEFINED
 			// set the IO according to this adapter
 			cart->init();
 		}
 
+		// send what the interrupts traced since the last command
+		trace_poll();
+
 		// wait a bit
 		umd_millis = HAL_GetTick();
 		while( (HAL_GetTick() - umd_millis) < LISTEN_INTERVAL );
@@ -132,55 +153,123 @@ void UMD::listen(void){
 
 	uint32_t crc_calc;
 	WORD_T crc_pc;
-	uint16_t data_size;
+	uint16_t data_size, cmd_index;
+	uint32_t cmd_start, stage_start;
+	uint8_t ext_status;
+	bool crc_ok, ext;
+	bool busy = (job != nullptr) && job->running();
 
 	// first 2 bytes are command, next 2 bytes are the size of this packet
-	if( usb.available(CMD_TIMEOUT, CMD_HEADER_SIZE) ){
+	stage_start = Perf::now();
+	if( usb.available(busy ? JOB_CMD_TIMEOUT : CMD_TIMEOUT, CMD_HEADER_SIZE) ){
+
+		cmd_start = Perf::now();
+		Perf::stage(Perf::stage_header_wait, cmd_start - stage_start);
 
 		// retrieve the command header 4 bytes
 		usb.get(cmd.header.bytes, CMD_HEADER_SIZE);
 
-		// reset the crc calc and add the start of packet
-		crc_calc = crc32mpeg2_calc(&cmd.header.sop, 4, true);
+		// the extended frame bit isn't part of the command index
+		ext = (cmd.header.cmd & USB_EXT_FRAME) != 0;
+		cmd_index = cmd.header.cmd & ~USB_EXT_FRAME;
+
+		if( ext ){
+			// extended request, the header has its own crc and the payload is
+			// handed to the command a segment at a time
+			data_size = 0;
+			ext_status = usb.ext_rx_start(cmd.header.sop, PAYLOAD_TIMEOUT);
+			if( ext_status != USB::EXT_OK ){
+				usb.put_header(ext_error_reply(ext_status));
+				usb.transmit();
+				// reset usb rx buffer
+				usb.flush();
+				return;
+			}
+			crc_ok = true;
+		}else{
+
+			// reset the crc calc and add the start of packet
+			crc_calc = crc32mpeg2_calc(&cmd.header.sop, 4, true);
+
+			// get the size of the data in this packet, substract 8 (4 for SOP and 4 for CRC)
+			data_size = cmd.header.size - (CMD_HEADER_SIZE + sizeof(crc_pc));
 
-		// get the size of the data in this packet, substract 8 (4 for SOP and 4 for CRC)
-		data_size = cmd.header.size - (CMD_HEADER_SIZE + sizeof(crc_pc));
+			// never accept more than the data buffer can hold
+			if( data_size > UMD_BUFER_SIZE ){
+				usb.put_header(CMDREPLY.PAYLOAD_SIZE_ERROR);
+				usb.transmit();
+				// reset usb rx buffer
+				usb.flush();
+				return;
+			}
+
+			// wait for rest of data if payload is not 0, a pipelined request may already follow it
+			if( data_size ){
+				stage_start = Perf::now();
+				if( usb.available(PAYLOAD_TIMEOUT, data_size) < data_size ){
+					usb.put_header(CMDREPLY.PAYLOAD_TIMEOUT);
+					usb.transmit();
+					// reset usb rx buffer
+					usb.flush();
+					return;
+				}
+				// command with payload, accumulate over payload
+				usb.get(ubuf.u8, data_size);
+				if( data_size > ubuf_high_water ){
+					ubuf_high_water = data_size;
+				}
+				Perf::stage(Perf::stage_payload_wait, Perf::now() - stage_start);
 
-		// wait for rest of data if payload is not 0
-		if( data_size ){
-			if( usb.available(PAYLOAD_TIMEOUT, data_size) != data_size ){
+				Perf::Probe probe(Perf::stage_crc);
+				crc_calc = crc32mpeg2_calc(ubuf.u32, data_size, false);
+			}
+
+			// CRC is the final uint32_t
+			if( usb.available(PAYLOAD_TIMEOUT, sizeof(crc_pc)) < sizeof(crc_pc) ){
 				usb.put_header(CMDREPLY.PAYLOAD_TIMEOUT);
 				usb.transmit();
 				// reset usb rx buffer
 				usb.flush();
 				return;
 			}
-			// command with payload, accumulate over payload
-			usb.get(ubuf.u8, data_size);
-			crc_calc = crc32mpeg2_calc(ubuf.u32, data_size, false);
+			usb.get(crc_pc.u8, sizeof(crc_pc));
+			crc_ok = ( crc_calc == crc_pc.u32 );
 		}
 
-		// CRC is the final uint32_t
-		usb.get(crc_pc.u8, sizeof(crc_pc));
-
 		// compare with received CRC
-		if( crc_calc != crc_pc.u32 ){
+		if( !crc_ok ){
 			// reply with CRC error
 			usb.put_header(CMDREPLY.CRC_ERROR);
 		}else{
 
 			// check bounds for command
-			if( cmd.header.cmd < cmd_table.size() ){
-				// reply acknowledge with the command's word + bit14
-				usb.put_header(cmd.header.cmd + CMDREPLY.CMD_ACK);
-				// get command from table
-				exec_command = cmd_table[cmd.header.cmd];
-				// execute the command
-				cmd_return_code = (this->*exec_command.command)(&ubuf);
-				if( cmd_return_code != UMD_CMD_OK ){
-					// command failed, override header with command failed, and send failed return code
-					usb.put_header(CMDREPLY.CMD_FAILED);
-					usb.put(cmd_return_code);
+			if( cmd_index < CMD_TABLE_SIZE ){
+				// get command from table, no copy
+				const UMD_CMD &command = cmd_table[cmd_index];
+
+				if( ext ? !(command.flags & CMD_FLAG_EXT) : (data_size < command.min_payload || data_size > command.max_payload) ){
+					// payload doesn't match what the command expects
+					usb.put_header(CMDREPLY.PAYLOAD_SIZE_ERROR);
+				}else{
+					// reply acknowledge with the command's word + bit14
+					usb.put_header(cmd_index + CMDREPLY.CMD_ACK);
+					// execute the command
+					payload_size = data_size;
+					trace(TRACE_CMD_START, cmd.header.cmd, ext ? usb.ext_rx_remaining() : data_size);
+					if( (command.flags & CMD_FLAG_CART) && cart_id == CartFactory::UNDEFINED ){
+						cmd_return_code = UMD_CMD_NO_CART;
+					}else if( (command.flags & (CMD_FLAG_CART | CMD_FLAG_JOB)) && busy ){
+						cmd_return_code = UMD_CMD_BUSY;
+					}else{
+						Perf::Probe probe(Perf::stage_execute);
+						cmd_return_code = (this->*command.command)(&ubuf);
+					}
+					trace(TRACE_CMD_END, cmd.header.cmd, cmd_return_code);
+					if( cmd_return_code != UMD_CMD_OK && !usb.ext_tx_active() ){
+						// command failed, override header with command failed, and send failed return code
+						usb.put_header(CMDREPLY.CMD_FAILED);
+						usb.put(cmd_return_code);
+					}
 				}
 			}else{
 				// command index out of range - i.e. unimplemented
@@ -188,9 +277,68 @@ void UMD::listen(void){
 				usb.put_header(CMDREPLY.NO_ACK);
 			}
 		}
-		// transmit the queue
-		usb.transmit();
+
+		// drop whatever the command didn't read of an extended request
+		ext_status = usb.ext_rx_finish(PAYLOAD_TIMEOUT);
+
+		if( usb.ext_tx_active() ){
+			// an extended reply ends with its status instead of a separate packet
+			usb.ext_tx_end( (ext_status != USB::EXT_OK) ? ext_error_reply(ext_status) : cmd_return_code );
+		}else{
+			if( ext_status != USB::EXT_OK ){
+				usb.put_header(ext_error_reply(ext_status));
+			}
+			// transmit the queue
+			usb.transmit();
+		}
+
+		// whole round trip of the command, from its header to the end of the reply
+		Perf::command(cmd_index, Perf::now() - cmd_start);
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint16_t UMD::ext_error_reply(uint8_t ext_status){
+
+	switch(ext_status){
+	case USB::EXT_TIMEOUT:
+		return CMDREPLY.PAYLOAD_TIMEOUT;
+	case USB::EXT_CRC_ERROR:
+		return CMDREPLY.CRC_ERROR;
+	case USB::EXT_SIZE_ERROR:
+	default:
+		return CMDREPLY.PAYLOAD_SIZE_ERROR;
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint32_t UMD::job_start(Job &j){
+
+	// 0 asks for the last job, it's never an id
+	if( ++job_id == 0 ){
+		job_id = 1;
 	}
+	job = &j;
+	if( !j.start(job_id, cart) ){
+		return UMD_CMD_FAIL;
+	}
+	usb.put(job_id);
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+Job *UMD::job_find(uint32_t id){
+
+	if( job == nullptr || (id != 0 && id != job->status.id) ){
+		return nullptr;
+	}
+	return job;
 }
 
 /*******************************************************************//**
@@ -205,7 +353,7 @@ void UMD::set_cartridge_type(const uint8_t& mode){
  *
  **********************************************************************/
 uint32_t UMD::crc32mpeg2_calc(uint32_t *data, const uint32_t& len, bool reset){
-	uint32_t swapped, result, i;
+	uint32_t i;
 
 	// swapping the endianness of each u32 gets the same results as python's:
 	// from crccheck.crc import Crc32Mpeg2
@@ -214,14 +362,24 @@ uint32_t UMD::crc32mpeg2_calc(uint32_t *data, const uint32_t& len, bool reset){
 		__HAL_CRC_DR_RESET(&hcrc);
 	}
 
+	// feed the data register directly, HAL_CRC_Accumulate costs a call and the handle locking per word
+	for( i = 0 ; i<(len>>2) ; i++){
+		hcrc.Instance->DR = __REV(*(data + i));
+	}
+	return hcrc.Instance->DR;
+}
+
+/*******************************************************************//**
+ * continue the crc over halfwords still in big endian bus order, the
+ * halfword swap and the __REV above combine into a single rotate
+ **********************************************************************/
+uint32_t UMD::crc32mpeg2_calc_swap16(uint32_t *data, const uint32_t& len){
+	uint32_t i;
+
 	for( i = 0 ; i<(len>>2) ; i++){
-		swapped = ( *(data + i) & 0x000000FF ) << 24;
-		swapped |= ( *(data + i) & 0x0000FF00 ) << 8;
-		swapped |= ( *(data + i) & 0x00FF0000 ) >> 8;
-		swapped |= ( *(data + i) & 0xFF000000 ) >> 24;
-		result = HAL_CRC_Accumulate(&hcrc, &swapped, 1);
+		hcrc.Instance->DR = __ROR(*(data + i), 16);
 	}
-	return result;
+	return hcrc.Instance->DR;
 }
 
 
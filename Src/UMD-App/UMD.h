@@ -24,8 +24,6 @@
 #define UMD_H_
 
 #include <cstdint>
-#include <string>
-#include <vector>
 
 #include "main.h"
 #include "fatfs.h"
@@ -33,6 +31,10 @@
 #include "USB.h"
 #include "Cartridges/Cartridge.h"
 #include "CartFactory.h"
+#include "Codec/Codec.h"
+#include "Perf.h"
+#include "Trace.h"
+#include "Job.h"
 
 
 #define LED_SHIFT_DIR_LEFT		0
@@ -46,6 +48,8 @@
 
 #define UMD_BUFER_SIZE			8192
 
+#define UMD_PROTOCOL_VERSION	1		///< bumped whenever the framing changes
+
 #define IGNORE_CRC				1
 
 
@@ -72,6 +76,11 @@ private:
 	void init(void);
 	void listen(void);
 
+	/*******************************************************************//**
+	 * \brief map an extended frame receive error to its reply
+	 **********************************************************************/
+	uint16_t ext_error_reply(uint8_t ext_status);
+
 	// UMD 'global' variables
 	Cartridge *cart;				///< pointer to cartridge object
 	USB usb;						///< USB object for communications
@@ -80,6 +89,8 @@ private:
 	uint32_t cmd_return_code;
 	uint32_t pc_assigned_id;
 	uint8_t cart_id;
+	uint16_t ubuf_high_water;		///< largest payload received so far
+	uint16_t payload_size;			///< payload size of the command being executed
 
 	struct _ADC_READINGS{
 		uint16_t current;			///< latest ADC reading of cartridge current
@@ -93,6 +104,7 @@ private:
 		uint16_t CMD_FAILED = 0xFFFE;
 		uint16_t PAYLOAD_TIMEOUT = 0xFFFD;
 		uint16_t CRC_ERROR = 0xFFFC;
+		uint16_t PAYLOAD_SIZE_ERROR = 0xFFFB;
 		uint16_t CMD_ACK = 0x4000;
 	}CMDREPLY;
 
@@ -102,6 +114,7 @@ private:
 	// main loop executes at millisecond intervals of this value
 	const uint32_t LISTEN_INTERVAL = 10;
 	const uint32_t CMD_TIMEOUT = 100;
+	const uint32_t JOB_CMD_TIMEOUT = 1;		///< shorter wait for a header while a job needs its steps
 	const uint32_t PAYLOAD_TIMEOUT = 200;
 
 	// listen for commands, data buffers for small transfer
@@ -137,6 +150,25 @@ private:
 		uint8_t  u8[UMD_BUFER_SIZE];
 	}ubuf;
 
+	// long operations, the job last started stays around for its status
+	JobEraseChip job_erase_chip;
+	JobEraseRange job_erase_range;
+	Job *job = nullptr;
+	uint16_t job_id = 0;			///< of the last job started, 0 is never used
+
+	/*******************************************************************//**
+	 * \brief start a job and reply with its id
+	 * \return UMD_CMD_FAIL if the cartridge can't run it
+	 **********************************************************************/
+	uint32_t job_start(Job &j);
+
+	// the current job if id matches it, 0 matches any
+	Job *job_find(uint32_t id);
+
+	// compressed reads, the encoded blocks alternate between the two buffers while they're transmitted
+	Codec codec;
+	uint32_t zbuf[2][USB_EXT_CHUNK_MAX / 4];
+
 
 
     /*******************************************************************//**
@@ -147,6 +179,7 @@ private:
      * \return the current crc value
      **********************************************************************/
 	uint32_t crc32mpeg2_calc(uint32_t *data, const uint32_t& len, bool reset);
+	uint32_t crc32mpeg2_calc_swap16(uint32_t *data, const uint32_t& len);
 
 	void set_cartridge_type(const uint8_t& mode);
 
@@ -158,33 +191,103 @@ private:
 	void io_set_level_translators(bool enable);
 	void io_boot_precharge(bool charge);
 
+	/*******************************************************************//**
+	 * \brief time a read of the current cartridge with the cycle counter
+	 * \param dma read with the cartridge's DMA channel
+	 * \return read throughput in bytes per second, 0 without a cartridge
+	 **********************************************************************/
+	uint32_t io_read_throughput(bool dma);
+
+	/*******************************************************************//**
+	 * \brief CRC32/MPEG2 of a range of the cartridge, read through zbuf
+	 * \param size in bytes, a multiple of 4
+	 **********************************************************************/
+	uint32_t io_cart_crc32(uint32_t address, uint32_t size);
+
+	// memory budget methods
+	const uint32_t STACK_PAINT = 0xA5A5A5A5;
+	const uint32_t STACK_PAINT_GUARD = 256;		///< bytes below the current sp left unpainted
+
+	/*******************************************************************//**
+	 * \brief fill the unused stack with STACK_PAINT so the high water mark can be found later
+	 **********************************************************************/
+	void mem_paint_stack(void);
+
+	/*******************************************************************//**
+	 * \brief find the deepest stack usage since mem_paint_stack()
+	 * \return stack usage in bytes
+	 **********************************************************************/
+	uint32_t mem_stack_high_water(void);
+
 	/* Return codes for UMD commands */
 	typedef enum{
 		UMD_CMD_OK   = 0,
 		UMD_CMD_FAIL,
+		UMD_CMD_NO_CART,
+		UMD_CMD_BUSY,				///< a job is running on the cartridge
 	}UMD_StatusTypedef;
 
-	// command struct includes a function pointer and a descriptive string
+	// command flags, checked in listen() before the command is executed
+	enum : uint8_t {
+		CMD_FLAG_NONE	= 0x00,
+		CMD_FLAG_CART	= 0x01,		///< command needs a cartridge adapter to be connected
+		CMD_FLAG_EXT	= 0x02,		///< command accepts an extended request, it reads the payload with usb.ext_get()
+		CMD_FLAG_JOB	= 0x04,		///< command is refused while a job runs, like the CMD_FLAG_CART ones
+	};
+
+	/*******************************************************************//**
+	 * \brief UMD_CMD
+	 * command table entry, the payload bounds are in bytes and are validated
+	 * by listen() so the commands themselves can trust their payload
+	 **********************************************************************/
 	struct UMD_CMD{
-		uint32_t		(UMD::*command)(UMD_BUF *buf) = nullptr;    /**< function pointer implementing the command */
-		std::string 	name;                           			/**< command name */
+		uint32_t		(UMD::*command)(UMD_BUF *buf);	/**< function pointer implementing the command */
+		const char		*name;							/**< command name */
+		uint16_t		min_payload;					/**< minimum payload size */
+		uint16_t		max_payload;					/**< maximum payload size */
+		uint8_t			flags;							/**< CMD_FLAG_xxx */
+	};
+
+	// feature flags of the capabilities reply
+	enum : uint16_t {
+		CAP_EXT_FRAMES		= 0x0001,	///< extended requests and replies
+		CAP_RX_BACKPRESSURE	= 0x0002,	///< requests can be pipelined, listen() takes a payload with the next request already behind it and the receive buffer NAKs instead of dropping data
+		CAP_COMPRESSION		= 0x0004,	///< compressed reads, see Codec
 	};
 
-	// commands are decoded by their index in the vector
-	UMD_CMD exec_command;
-	std::vector<UMD_CMD> cmd_table {
-		{ &UMD::cmd_undefined, 		"0x0000: undefined" },
-		{ &UMD::cmd_listcmd,   		"0x0001: list commands" },
-		{ &UMD::cmd_setleds,   		"0x0002: set leds		[uint32_t]val" },
-		{ &UMD::cmd_setid,     		"0x0003: set id			[uint32_t]val" },
-		{ &UMD::cmd_version,   		"0x0004: get version" },
-		{ &UMD::cmd_getcartv,  		"0x0005: get cartv" },
-		{ &UMD::cmd_setcartv,  		"0x0006: set cartv:		[uint32_t]val" },
-		{ &UMD::cmd_getadapterid,	"0x0007: get adapterid" },
-		{ &UMD::cmd_getflashid,		"0x0008: get flashid" },
-		{ &UMD::cmd_getflashid,		"0x0009: read rom		[uint32_t]addr	[uint16_t]size" }
+	/*******************************************************************//**
+	 * \brief s_capabilities
+	 * capabilities reply, everything a host needs to pick its transfer sizes
+	 **********************************************************************/
+	struct s_capabilities{
+		uint16_t		protocol;						/**< UMD_PROTOCOL_VERSION */
+		uint16_t		features;						/**< CAP_xxx */
+		uint32_t		request_payload;				/**< largest regular request payload */
+		uint32_t		reply_size;						/**< largest regular reply, header and crc included */
+		uint32_t		rx_ring_size;					/**< CDC receive buffer */
+		uint32_t		ext_segment_size;				/**< segment size of extended frames */
+		uint8_t			cart_id;
+		uint8_t			bus_size;						/**< 8 or 16 bits */
+		uint16_t		cart_ops;						/**< Cartridge::e_cart_op */
+		uint32_t		pio_read_rate;					/**< measured bytes/s of cpu reads */
+		uint32_t		dma_read_rate;					/**< measured bytes/s of DMA reads, 0 if not supported */
 	};
 
+	/*******************************************************************//**
+	 * \brief s_perf_header
+	 * start of the perf stats reply, followed by the Perf::s_stat of every
+	 * stage and then of every command
+	 **********************************************************************/
+	struct s_perf_header{
+		uint32_t		core_clock;						/**< cycles per second */
+		uint16_t		stage_count;
+		uint16_t		command_count;
+	};
+
+	// commands are decoded by their index in the table, the table is constexpr and lives in flash
+	static const UMD_CMD cmd_table[];
+	static const uint16_t CMD_TABLE_SIZE;
+
 	// Command prototypes
 	uint32_t cmd_undefined(UMD_BUF *buf);
 	uint32_t cmd_listcmd(UMD_BUF *buf);
@@ -196,6 +299,32 @@ private:
 	uint32_t cmd_getadapterid(UMD_BUF *buf);
 	uint32_t cmd_getflashid(UMD_BUF *buf);
 	uint32_t cmd_readrom(UMD_BUF *buf);
+	uint32_t cmd_getmemstats(UMD_BUF *buf);
+	uint32_t cmd_readrom_ext(UMD_BUF *buf);
+	uint32_t cmd_loopback(UMD_BUF *buf);
+	uint32_t cmd_getcapabilities(UMD_BUF *buf);
+	uint32_t cmd_readrom_compressed(UMD_BUF *buf);
+	uint32_t cmd_programrange(UMD_BUF *buf);
+	uint32_t cmd_syncimage(UMD_BUF *buf);
+	uint32_t cmd_readsaveram(UMD_BUF *buf);
+	uint32_t cmd_writesaveram(UMD_BUF *buf);
+	uint32_t cmd_getperfstats(UMD_BUF *buf);
+	uint32_t cmd_resetperfstats(UMD_BUF *buf);
+	uint32_t cmd_settracemask(UMD_BUF *buf);
+	uint32_t cmd_getid(UMD_BUF *buf);
+	uint32_t cmd_getflashgeometry(UMD_BUF *buf);
+	uint32_t cmd_eraseprogram(UMD_BUF *buf);
+	uint32_t cmd_readprgchr(UMD_BUF *buf);
+	uint32_t cmd_getrominfo(UMD_BUF *buf);
+	uint32_t cmd_erasechip(UMD_BUF *buf);
+	uint32_t cmd_eraserange(UMD_BUF *buf);
+	uint32_t cmd_jobstatus(UMD_BUF *buf);
+	uint32_t cmd_jobabort(UMD_BUF *buf);
+
+	// cmd_syncimage flags
+	enum : uint16_t {
+		SYNC_ERASE		= 0x0001,		///< erase the sectors that don't match
+	};
 
 };
 
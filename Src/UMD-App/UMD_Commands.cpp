@@ -20,8 +20,54 @@
  *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
 #include "UMD.h"
 
+/*******************************************************************//**
+ * Command table, indexed by the command word. Entries are
+ * { command, name, min payload, max payload, flags }
+ **********************************************************************/
+constexpr UMD::UMD_CMD UMD::cmd_table[] = {
+	{ &UMD::cmd_undefined, 		"0x0000: undefined",									0, 0, CMD_FLAG_NONE },
+	{ &UMD::cmd_listcmd,   		"0x0001: list commands",								0, 0, CMD_FLAG_NONE },
+	{ &UMD::cmd_setleds,   		"0x0002: set leds		[uint32_t]val",					1, 4, CMD_FLAG_NONE },
+	{ &UMD::cmd_setid,     		"0x0003: set id			[uint32_t]val",					4, 4, CMD_FLAG_NONE },
+	{ &UMD::cmd_version,   		"0x0004: get version",									0, 0, CMD_FLAG_NONE },
+	{ &UMD::cmd_getcartv,  		"0x0005: get cartv",									0, 0, CMD_FLAG_NONE },
+	{ &UMD::cmd_setcartv,  		"0x0006: set cartv:		[uint32_t]val",					1, 4, CMD_FLAG_JOB },
+	{ &UMD::cmd_getadapterid,	"0x0007: get adapterid",								0, 0, CMD_FLAG_NONE },
+	{ &UMD::cmd_getflashid,		"0x0008: get flashid",									0, 0, CMD_FLAG_CART },
+	{ &UMD::cmd_readrom,		"0x0009: read rom		[uint32_t]addr	[uint16_t]size",	6, 8, CMD_FLAG_CART },
+	{ &UMD::cmd_getmemstats,	"0x000A: get memory stats",								0, 0, CMD_FLAG_NONE },
+	{ &UMD::cmd_readrom_ext,	"0x000B: read rom ext	[uint32_t]addr	[uint32_t]size",	8, 8, CMD_FLAG_CART },
+	{ &UMD::cmd_loopback,		"0x000C: loopback		[ext]data",						0, 0, CMD_FLAG_EXT },
+	{ &UMD::cmd_getcapabilities,"0x000D: get capabilities",								0, 0, CMD_FLAG_NONE },
+	{ &UMD::cmd_readrom_compressed,"0x000E: read rom compressed	[uint32_t]addr	[uint32_t]size",	8, 8, CMD_FLAG_CART },
+	{ &UMD::cmd_programrange,	"0x000F: program range	[ext chunks][uint32_t]addr [codec block]",	0, 0, CMD_FLAG_CART | CMD_FLAG_EXT },
+	{ &UMD::cmd_syncimage,		"0x0010: sync image		[uint32_t]addr	[uint32_t]sector size	[uint16_t]count	[uint16_t]flags	[uint32_t]crc[count]",	12, UMD_BUFER_SIZE, CMD_FLAG_CART },
+	{ &UMD::cmd_readsaveram,	"0x0011: read save ram	[uint32_t]offset	[uint32_t]size",	8, 8, CMD_FLAG_CART },
+	{ &UMD::cmd_writesaveram,	"0x0012: write save ram	[ext][uint32_t]offset [data]",	0, 0, CMD_FLAG_CART | CMD_FLAG_EXT },
+	{ &UMD::cmd_getperfstats,	"0x0013: get perf stats",								0, 0, CMD_FLAG_NONE },
+	{ &UMD::cmd_resetperfstats,	"0x0014: reset perf stats",								0, 0, CMD_FLAG_NONE },
+	{ &UMD::cmd_settracemask,	"0x0015: set trace mask	[uint32_t]mask",				4, 4, CMD_FLAG_NONE },
+	{ &UMD::cmd_getid,			"0x0016: get id",										0, 0, CMD_FLAG_NONE },
+	{ &UMD::cmd_getflashgeometry,"0x0017: get flash geometry",							0, 0, CMD_FLAG_CART },
+	{ &UMD::cmd_eraseprogram,	"0x0018: erase and program	[ext chunks][uint32_t]count {[uint32_t]addr [uint32_t]size}[count], then [uint32_t]addr [codec block]",	0, 0, CMD_FLAG_CART | CMD_FLAG_EXT },
+	{ &UMD::cmd_readprgchr,		"0x0019: read prg chr	[uint16_t]mapper	[uint16_t]reserved	[uint32_t]prg size	[uint32_t]chr size",	12, 12, CMD_FLAG_CART },
+	{ &UMD::cmd_getrominfo,		"0x001A: get rom info",									0, 0, CMD_FLAG_CART },
+	{ &UMD::cmd_erasechip,		"0x001B: erase chip job",								0, 0, CMD_FLAG_CART },
+	{ &UMD::cmd_eraserange,		"0x001C: erase range job	[uint32_t]addr	[uint32_t]size",	8, 8, CMD_FLAG_CART },
+	{ &UMD::cmd_jobstatus,		"0x001D: job status		[uint32_t]id",					0, 4, CMD_FLAG_NONE },
+	{ &UMD::cmd_jobabort,		"0x001E: job abort		[uint32_t]id",					0, 4, CMD_FLAG_NONE }
+};
+
+constexpr uint16_t UMD::CMD_TABLE_SIZE = sizeof(UMD::cmd_table) / sizeof(UMD::cmd_table[0]);
+
+// extended transfers alternate between the two halves of the data buffer
+static_assert(UMD_BUFER_SIZE >= 2 * USB_EXT_SEGMENT_SIZE, "the data buffer must hold two extended segments");
+static_assert(UMD_BUFER_SIZE >= 2 * CODEC_BLOCK_SIZE && USB_EXT_CHUNK_MAX >= CODEC_MAX_BLOCK, "compressed reads don't fit the buffers");
+static_assert(UMD_BUFER_SIZE >= 2 * CODEC_BLOCK_SIZE && USB_EXT_CHUNK_MAX >= CODEC_BLOCK_SIZE, "interleaved programming stages blocks in the data buffer and zbuf[1]");
+
 /*******************************************************************//**
  * 0x0000
  **********************************************************************/
@@ -37,10 +83,10 @@ uint32_t UMD::cmd_undefined(UMD_BUF *buf){
 uint32_t UMD::cmd_listcmd(UMD_BUF *buf){
 
 	// generate a nice terminal friendly output of available commands
-	usb.put(std::string("UMDv2 Commands:\n\n"));
-	for( auto &cmd_it : cmd_table ) {
-		usb.put(cmd_it.name);
-		usb.put(std::string("\n"));
+	usb.put("UMDv2 Commands:\n\n");
+	for( uint16_t i = 0; i < CMD_TABLE_SIZE; i++ ) {
+		usb.put(cmd_table[i].name);
+		usb.put("\n");
 	}
 	return UMD_CMD_OK;
 }
@@ -70,7 +116,7 @@ uint32_t UMD::cmd_setid(UMD_BUF *buf){
  **********************************************************************/
 uint32_t UMD::cmd_version(UMD_BUF *buf){
 
-	usb.put(std::string("UMD v2.0.0.0"));
+	usb.put("UMD v2.0.0.0");
 	return UMD_CMD_OK;
 }
 
@@ -124,9 +170,14 @@ uint32_t UMD::cmd_readrom(UMD_BUF *buf){
 
 	// retrieve start address and size in bytes of requested read
 	address = *(buf->u32);
-	size = *((buf + sizeof(address))->u16);
+	size = buf->u16[2];
 	crc_len = size;
 
+	// the data is read into and transmitted from the data buffer, a 16 bit bus only reads whole words
+	if( size > UMD_BUFER_SIZE || (cart->param.bus_size != 8 && (size & 1) != 0) ){
+		return UMD_CMD_FAIL;
+	}
+
 	// read the rom
 	if( cart->param.bus_size == 8 ){
 		cart->read_bytes(address, &buf->u8[0], size, Cartridge::mem_prg);
@@ -134,24 +185,815 @@ uint32_t UMD::cmd_readrom(UMD_BUF *buf){
 		cart->read_words(address, &buf->u16[0], size, Cartridge::mem_prg);
 	}
 
-	// send back to host, 0 pad to nearest u32 size
+	// 0 pad the data to nearest u32 size
 	pad = size % sizeof(uint32_t);
 	if( pad != 0){
 		pad = 4 - pad;
-		size += pad;
 		crc_len += pad;
 		while(pad--){
-			usb.put((uint8_t)0x00);
+			buf->u8[size++] = 0x00;
 		}
 	}
 
-	// put data in output buffer
-	usb.put(&buf->u8[0], size);
+	// the data is transmitted straight from the buffer it was read into
+	usb.attach(&buf->u8[0], size);
 	// add crc32
-	crc = crc32mpeg2_calc(buf->u32, crc_len, true);
+	{
+		Perf::Probe probe(Perf::stage_crc);
+		crc = crc32mpeg2_calc(buf->u32, crc_len, true);
+	}
 	usb.put(crc);
 
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x000A
+ **********************************************************************/
+uint32_t UMD::cmd_getmemstats(UMD_BUF *buf){
+
+	extern uint32_t _sdata, _ebss, _end, _estack;
+
+	Span<uint32_t> stats = usb.reserve<uint32_t>(9);
+	if( !stats ){
+		return UMD_CMD_FAIL;
+	}
+
+	// statically allocated ram and the stack
+	stats[0] = (uint32_t)&_ebss - (uint32_t)&_sdata;
+	stats[1] = (uint32_t)&_estack - (uint32_t)&_end;
+	stats[2] = mem_stack_high_water();
+
+	// buffer sizes and how much of them was used so far
+	stats[3] = UMD_BUFER_SIZE;
+	stats[4] = ubuf_high_water;
+	stats[5] = USB_BUFFER_SIZE;
+	stats[6] = usb.usbbuf.high_water;
+	stats[7] = usb.rx_size();
+	stats[8] = usb.rx_high_water();
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x000B
+ **********************************************************************/
+uint32_t UMD::cmd_readrom_ext(UMD_BUF *buf){
+	uint32_t address, size;
+	uint16_t len;
+	uint8_t *segment;
+
+	// retrieve start address and size in bytes of requested read
+	address = buf->u32[0];
+	size = buf->u32[1];
+
+	// the whole read is a single extended reply, 0 padded to the nearest u32,
+	// a 16 bit bus only reads whole words
+	if( (cart->param.bus_size != 8 && (size & 1) != 0) || !usb.ext_tx_start(Serializer::padded(size)) ){
+		return UMD_CMD_FAIL;
+	}
+
+	// read a segment in one half of the buffer while the other half is transmitted
+	segment = &buf->u8[0];
+	while( size != 0 ){
+		len = (size > USB_EXT_SEGMENT_SIZE) ? USB_EXT_SEGMENT_SIZE : size;
+
+		if( cart->param.bus_size == 8 ){
+			cart->read_bytes(address, segment, len, Cartridge::mem_prg);
+		}else{
+			cart->read_words(address, (uint16_t *)segment, len, Cartridge::mem_prg);
+		}
+		address += len;
+		size -= len;
+
+		while( len % sizeof(uint32_t) != 0 ){
+			segment[len++] = 0x00;
+		}
+		if( !usb.ext_put(segment, len) ){
+			return UMD_CMD_FAIL;
+		}
+
+		segment = (segment == &buf->u8[0]) ? &buf->u8[USB_EXT_SEGMENT_SIZE] : &buf->u8[0];
+	}
+
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x000C
+ **********************************************************************/
+uint32_t UMD::cmd_loopback(UMD_BUF *buf){
+	uint16_t len;
+	uint8_t i;
+
+	// echo an extended request back as an extended reply, handy to check host framing and throughput
+	// a chunked request is echoed chunk for chunk
+	if( !usb.ext_tx_start(usb.ext_rx_remaining()) ){
+		return UMD_CMD_FAIL;
+	}
+
+	// zbuf holds a full chunk, alternate while the previous one is transmitted
+	for( i = 0; (len = usb.ext_get((uint8_t *)zbuf[i], PAYLOAD_TIMEOUT)) != 0; i ^= 1 ){
+		if( !usb.ext_put((uint8_t *)zbuf[i], len) ){
+			return UMD_CMD_FAIL;
+		}
+	}
+
+	return (usb.ext_rx_remaining() == 0) ? UMD_CMD_OK : UMD_CMD_FAIL;
+}
+
+/*******************************************************************//**
+ * 0x000D
+ **********************************************************************/
+uint32_t UMD::cmd_getcapabilities(UMD_BUF *buf){
+
+	Span<s_capabilities> caps = usb.reserve<s_capabilities>(1);
+	if( !caps ){
+		return UMD_CMD_FAIL;
+	}
+
+	caps[0].protocol = UMD_PROTOCOL_VERSION;
+	// pipelining relies on listen() only waiting for at least the payload, not exactly it
+	caps[0].features = CAP_EXT_FRAMES | CAP_RX_BACKPRESSURE | CAP_COMPRESSION;
+	caps[0].request_payload = UMD_BUFER_SIZE;
+	caps[0].reply_size = USB_BUFFER_SIZE;
+	caps[0].rx_ring_size = usb.rx_size();
+	caps[0].ext_segment_size = USB_EXT_SEGMENT_SIZE;
+
+	// what the connected adapter can do and how fast its bus is
+	caps[0].cart_id = cart_id;
+	caps[0].bus_size = (cart_id == CartFactory::UNDEFINED) ? 0 : cart->param.bus_size;
+	caps[0].cart_ops = (cart_id == CartFactory::UNDEFINED) ? Cartridge::op_none : cart->param.ops;
+	caps[0].pio_read_rate = io_read_throughput(false);
+	caps[0].dma_read_rate = (caps[0].cart_ops & Cartridge::op_dma_read) ? io_read_throughput(true) : 0;
+
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x000E
+ **********************************************************************/
+uint32_t UMD::cmd_readrom_compressed(UMD_BUF *buf){
+	uint32_t address, size;
+	uint16_t len, next_len, encoded_len;
+	uint8_t i;
+
+	// retrieve start address and size in bytes of requested read
+	address = buf->u32[0];
+	size = buf->u32[1];
+
+	// the compressed size isn't known until the end, every block is its own chunk
+	if( !usb.ext_tx_start(USB_EXT_CHUNKED) ){
+		return UMD_CMD_FAIL;
+	}
+
+	// the next block is read into the other half of ubuf while this one is encoded
+	len = (size > CODEC_BLOCK_SIZE) ? CODEC_BLOCK_SIZE : size;
+	if( len != 0 ){
+		cart->read_async(address, &buf->u8[0], len, Cartridge::mem_prg);
+	}
+	for( i = 0; size != 0; i ^= 1 ){
+		cart->read_wait();
+		address += len;
+		size -= len;
+
+		next_len = (size > CODEC_BLOCK_SIZE) ? CODEC_BLOCK_SIZE : size;
+		if( next_len != 0 ){
+			cart->read_async(address, &buf->u8[(i ^ 1) * CODEC_BLOCK_SIZE], next_len, Cartridge::mem_prg);
+		}
+
+		encoded_len = codec.encode(&buf->u8[i * CODEC_BLOCK_SIZE], len, (uint8_t *)zbuf[i]);
+		if( !usb.ext_put((uint8_t *)zbuf[i], encoded_len) ){
+			cart->read_wait();
+			return UMD_CMD_FAIL;
+		}
+		len = next_len;
+	}
+
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x000F
+ **********************************************************************/
+uint32_t UMD::cmd_programrange(UMD_BUF *buf){
+	uint32_t address, received, programmed, finished;
+	uint16_t len, written;
+	int32_t raw_len;
+	const uint8_t *block;
+	Cartridge::s_lane run;
+	uint8_t i;
+	bool interleave;
+
+	// blocks wait for their chip's lane in the halves of the data buffer and in zbuf[1]
+	uint8_t *const slots[] = { &buf->u8[0], &buf->u8[CODEC_BLOCK_SIZE], (uint8_t *)zbuf[1] };
+	const uint8_t slot_count = sizeof(slots) / sizeof(slots[0]);
+
+	received = 0;
+	programmed = 0;
+
+	// the write buffer and the program timeouts come with the geometry
+	if( cart->geometry.source == Cartridge::geometry_unprobed ){
+		cart->get_flash_id();
+	}
+
+	// with several chips each chip is kept programming from its lane while the next chunks
+	// are received and decoded
+	interleave = cart->geometry.chips > 1;
+	cart->program_start();
+
+	// every chunk is the address of a block followed by the encoded block
+	for(;;){
+		while( interleave && !usb.ext_ready() && cart->program_step() );
+		if( (len = usb.ext_get((uint8_t *)zbuf[0], PAYLOAD_TIMEOUT)) == 0 ){
+			break;
+		}
+		if( len < sizeof(address) + CODEC_HEADER_SIZE ){
+			cart->program_finish(finished);
+			return UMD_CMD_FAIL;
+		}
+		address = zbuf[0][0];
+		block = (const uint8_t *)&zbuf[0][1];
+
+		// erased blocks don't need to be decoded, nor programmed
+		const Codec::s_block_header *header = reinterpret_cast<const Codec::s_block_header *>(block);
+		if( header->type == Codec::block_fill && header->fill == 0xFF ){
+			received += header->raw_len;
+			continue;
+		}
+
+		if( !interleave ){
+			// ubuf is the staging buffer
+			raw_len = Codec::decode(block, len - sizeof(address), buf->u8, CODEC_BLOCK_SIZE);
+			if( raw_len < 0 ){
+				cart->program_finish(finished);
+				return UMD_CMD_FAIL;
+			}
+			received += raw_len;
+			if( !cart->program_range(address, buf->u8, raw_len, Cartridge::mem_prg, written) ){
+				cart->program_finish(finished);
+				return UMD_CMD_FAIL;
+			}
+			programmed += written;
+			continue;
+		}
+
+		// the lanes drain while every slot is taken
+		for(;;){
+			for( i = 0; i < slot_count && cart->program_queued(slots[i]); i++ );
+			if( i != slot_count ){
+				break;
+			}
+			cart->program_step();
+		}
+		raw_len = Codec::decode(block, len - sizeof(address), slots[i], CODEC_BLOCK_SIZE);
+		if( raw_len < 0 ){
+			cart->program_finish(finished);
+			return UMD_CMD_FAIL;
+		}
+		received += raw_len;
+
+		// a block across two chips is programmed on its own
+		if( cart->chip_base(address) != cart->chip_base(address + raw_len - 1) ){
+			if( !cart->program_finish(finished) || !cart->program_range(address, slots[i], raw_len, Cartridge::mem_prg, written) ){
+				return UMD_CMD_FAIL;
+			}
+			programmed += finished + written;
+			continue;
+		}
+		run.address = address;
+		run.data = slots[i];
+		run.size = raw_len;
+		while( !cart->program_queue(run) ){
+			cart->program_step();
+		}
+	}
+	if( !cart->program_finish(finished) ){
+		return UMD_CMD_FAIL;
+	}
+	programmed += finished;
+
+	if( usb.ext_rx_remaining() != 0 ){
+		return UMD_CMD_FAIL;
+	}
+
+	usb.put(received);
+	usb.put(programmed);
+	usb.put(received - programmed);
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x0010
+ **********************************************************************/
+uint32_t UMD::cmd_syncimage(UMD_BUF *buf){
+	uint32_t address, sector_size;
+	uint16_t count, flags, mismatched, i;
+
+	address = buf->u32[0];
+	sector_size = buf->u32[1];
+	count = buf->u16[4];
+	flags = buf->u16[5];
+
+	// the payload must hold a crc for every sector
+	if( sector_size == 0 || (sector_size % 4) != 0 || payload_size < 12 + (uint32_t)count * sizeof(uint32_t) ){
+		return UMD_CMD_FAIL;
+	}
+
+	// reply is the number of sectors that differ and a bitmap of them, bit 0 of the first lword is the first sector
+	Span<uint16_t> mismatch_count = usb.reserve<uint16_t>(1);
+	Span<uint32_t> bitmap = usb.reserve<uint32_t>((count + 31) / 32);
+	if( !mismatch_count || (count != 0 && !bitmap) ){
+		return UMD_CMD_FAIL;
+	}
+	for( uint32_t &lword : bitmap ){
+		lword = 0;
+	}
+
+	mismatched = 0;
+	for( i = 0; i < count; i++, address += sector_size ){
+		// the crcs start at the 4th lword of the payload
+		if( io_cart_crc32(address, sector_size) == buf->u32[3 + i] ){
+			continue;
+		}
+		bitmap[i >> 5] |= 1UL << (i & 31);
+		mismatched++;
+		if( flags & SYNC_ERASE ){
+			// a host sector can hold several small boot sectors
+			if( cart->geometry.source == Cartridge::geometry_unprobed ){
+				cart->get_flash_id();
+			}
+			if( !cart->erase_range(address, sector_size) ){
+				return UMD_CMD_FAIL;
+			}
+		}
+	}
+
+	mismatch_count[0] = mismatched;
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x0011
+ **********************************************************************/
+uint32_t UMD::cmd_readsaveram(UMD_BUF *buf){
+	uint32_t offset, size;
+	uint16_t len;
+	uint8_t *segment;
+
+	if( !(cart->param.ops & Cartridge::op_save_ram) ){
+		return UMD_CMD_FAIL;
+	}
+
+	// offset and size are in save ram bytes, the cartridge packs them densely
+	offset = buf->u32[0];
+	size = buf->u32[1];
+	if( offset > cart->param.save_size || size > cart->param.save_size - offset ){
+		return UMD_CMD_FAIL;
+	}
+	if( !usb.ext_tx_start(Serializer::padded(size)) ){
+		return UMD_CMD_FAIL;
+	}
+
+	segment = &buf->u8[0];
+	while( size != 0 ){
+		len = (size > USB_EXT_SEGMENT_SIZE) ? USB_EXT_SEGMENT_SIZE : size;
+		cart->read_bytes(offset, segment, len, Cartridge::mem_bram);
+		offset += len;
+		size -= len;
+
+		while( len % sizeof(uint32_t) != 0 ){
+			segment[len++] = 0x00;
+		}
+		if( !usb.ext_put(segment, len) ){
+			return UMD_CMD_FAIL;
+		}
+		segment = (segment == &buf->u8[0]) ? &buf->u8[USB_EXT_SEGMENT_SIZE] : &buf->u8[0];
+	}
+
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x0012
+ **********************************************************************/
+uint32_t UMD::cmd_writesaveram(UMD_BUF *buf){
+	uint32_t offset, written;
+	uint16_t len;
+	const uint8_t *data;
+
+	if( !(cart->param.ops & Cartridge::op_save_ram) ){
+		return UMD_CMD_FAIL;
+	}
+
+	// the offset is the first lword of the payload, the data follows
+	len = usb.ext_get(buf->u8, PAYLOAD_TIMEOUT);
+	if( len < sizeof(offset) ){
+		return UMD_CMD_FAIL;
+	}
+	offset = buf->u32[0];
+	data = &buf->u8[sizeof(offset)];
+	len -= sizeof(offset);
+
+	// nothing is written unless all of it fits the save ram
+	if( offset > cart->param.save_size || len > cart->param.save_size - offset ){
+		return UMD_CMD_FAIL;
+	}
+	if( usb.ext_rx_remaining() != USB_EXT_CHUNKED && usb.ext_rx_remaining() > cart->param.save_size - offset - len ){
+		return UMD_CMD_FAIL;
+	}
+
+	written = 0;
+	do{
+		// a chunked request is only known to fit a chunk at a time
+		if( len > cart->param.save_size - offset ){
+			return UMD_CMD_FAIL;
+		}
+		cart->write_bytes(offset, data, len, Cartridge::mem_bram);
+		offset += len;
+		written += len;
+		data = buf->u8;
+	}while( (len = usb.ext_get(buf->u8, PAYLOAD_TIMEOUT)) != 0 );
+
+	if( usb.ext_rx_remaining() != 0 ){
+		return UMD_CMD_FAIL;
+	}
+	usb.put(written);
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x0013
+ **********************************************************************/
+uint32_t UMD::cmd_getperfstats(UMD_BUF *buf){
+	uint32_t size;
+	uint16_t len;
+	uint8_t *data;
+
+	static_assert(CMD_TABLE_SIZE <= PERF_MAX_COMMANDS, "the profiler needs a statistic per command");
+	static_assert(sizeof(s_perf_header) + sizeof(Perf::stages) + sizeof(Perf::commands) <= UMD_BUFER_SIZE, "perf stats don't fit the data buffer");
+
+	// too large for a regular reply, the snapshot is laid out in the data buffer and sent in segments
+	s_perf_header *header = reinterpret_cast<s_perf_header *>(buf->u32);
+	header->core_clock = SystemCoreClock;
+	header->stage_count = Perf::stage_count;
+	header->command_count = CMD_TABLE_SIZE;
+	data = &buf->u8[sizeof(s_perf_header)];
+	std::memcpy(data, Perf::stages, sizeof(Perf::stages));
+	std::memcpy(data + sizeof(Perf::stages), Perf::commands, CMD_TABLE_SIZE * sizeof(Perf::s_stat));
+
+	size = sizeof(s_perf_header) + sizeof(Perf::stages) + CMD_TABLE_SIZE * sizeof(Perf::s_stat);
+	if( !usb.ext_tx_start(size) ){
+		return UMD_CMD_FAIL;
+	}
+	for( data = &buf->u8[0]; size != 0; size -= len, data += len ){
+		len = (size > USB_EXT_SEGMENT_SIZE) ? USB_EXT_SEGMENT_SIZE : size;
+		if( !usb.ext_put(data, len) ){
+			return UMD_CMD_FAIL;
+		}
+	}
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x0014
+ **********************************************************************/
+uint32_t UMD::cmd_resetperfstats(UMD_BUF *buf){
+
+	Perf::reset();
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x0015
+ **********************************************************************/
+uint32_t UMD::cmd_settracemask(UMD_BUF *buf){
+
+	// reply with the previous mask so the host can restore it
+	usb.put((uint32_t)trace_mask);
+	trace_mask = buf->u32[0];
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x0016
+ **********************************************************************/
+uint32_t UMD::cmd_getid(UMD_BUF *buf){
+
+	// lets a host running several units tell them apart
+	usb.put(pc_assigned_id);
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x0017
+ **********************************************************************/
+uint32_t UMD::cmd_getflashgeometry(UMD_BUF *buf){
+
+	cart->get_flash_id();
+	Span<Cartridge::s_flash_geometry> geometry = usb.reserve<Cartridge::s_flash_geometry>(1);
+	if( !geometry ){
+		return UMD_CMD_FAIL;
+	}
+	geometry[0] = cart->geometry;
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x0018
+ * The first chunk lists the ranges to erase in the order they are
+ * programmed, the blocks follow in the same order. The sectors are
+ * erased one after the other in that order whatever the ranges hold,
+ * the next one starts as soon as the previous one is done. A block only
+ * waits on the sectors it's written to, while it's programmed the next
+ * sector erases: on another chip alongside, on the same chip it's
+ * suspended for the block.
+ **********************************************************************/
+uint32_t UMD::cmd_eraseprogram(UMD_BUF *buf){
+	uint32_t address, received, programmed, skipped, erased;
+	uint32_t next, sector_start, sector_size, pending_address, pending_tick, last;
+	uint16_t len, written, count, entry, pending_entry, range;
+	int32_t raw_len;
+	const uint8_t *block;
+	const uint32_t *ranges;
+	bool pending, suspended, failed;
+
+	if( cart->geometry.source == Cartridge::geometry_unprobed ){
+		cart->get_flash_id();
+	}
+
+	// the range list stays in zbuf[1] for the whole command
+	len = usb.ext_get((uint8_t *)zbuf[1], PAYLOAD_TIMEOUT);
+	count = (len >= sizeof(uint32_t)) ? zbuf[1][0] : 0;
+	if( count == 0 || len < sizeof(uint32_t) * (1 + 2 * (uint32_t)count) ){
+		return UMD_CMD_FAIL;
+	}
+	ranges = &zbuf[1][1];
+
+	// a sector shared by two ranges would be erased after part of it was programmed
+	for( entry = 0; entry < count; entry++ ){
+		address = ranges[2 * entry];
+		if( ranges[2 * entry + 1] == 0 || !cart->sector_bounds(address, sector_start, sector_size) || sector_start != address
+				|| !cart->sector_bounds(address + ranges[2 * entry + 1] - 1, sector_start, sector_size)
+				|| sector_start + sector_size != address + ranges[2 * entry + 1] ){
+			return UMD_CMD_FAIL;
+		}
+	}
+
+	received = 0;
+	programmed = 0;
+	skipped = 0;
+	erased = 0;
+	entry = 0;
+	next = ranges[0];
+	pending = false;
+	pending_entry = 0;
+	pending_address = 0;
+	pending_tick = 0;
+	failed = false;
+
+	// erase the sector at next and move next to the sector after it, or to the following range
+	auto erase_next = [&](bool wait){
+		cart->sector_bounds(next, sector_start, sector_size);
+		if( wait ){
+			failed |= !cart->erase_sector(sector_start, true);
+		}else{
+			cart->erase_sector(sector_start, false);
+			pending = true;
+			pending_entry = entry;
+			pending_address = sector_start;
+			pending_tick = HAL_GetTick();
+		}
+		erased++;
+		next = sector_start + sector_size;
+		if( next >= ranges[2 * entry] + ranges[2 * entry + 1] ){
+			entry++;
+			next = (entry < count) ? ranges[2 * entry] : 0;
+		}
+	};
+
+	// an erase which finished makes way for the next sector
+	auto erase_advance = [&](void){
+		if( pending && !cart->erase_busy(pending_address) ){
+			pending = false;
+		}
+		if( !pending && entry < count ){
+			erase_next(false);
+		}
+	};
+
+	// every sector up to the one holding end in range r is erased when this returns
+	auto erase_through = [&](uint16_t r, uint32_t end){
+		bool started = (entry > r) || (entry == r && next > end);
+		if( pending && (!started || (pending_entry == r && end >= pending_address)) ){
+			failed |= !cart->erase_wait(pending_address, pending_tick);
+			pending = false;
+		}
+		while( !failed && entry < count && (entry < r || (entry == r && next <= end)) ){
+			erase_next(true);
+		}
+	};
+
+	while( (len = usb.ext_get((uint8_t *)zbuf[0], PAYLOAD_TIMEOUT)) != 0 ){
+		if( len < sizeof(address) + CODEC_HEADER_SIZE ){
+			return UMD_CMD_FAIL;
+		}
+		address = zbuf[0][0];
+		block = (const uint8_t *)&zbuf[0][1];
+
+		// an erase may have finished while the chunk arrived
+		erase_advance();
+
+		// erased blocks only need their sectors erased, done by the end at the latest
+		const Codec::s_block_header *header = reinterpret_cast<const Codec::s_block_header *>(block);
+		if( header->type == Codec::block_fill && header->fill == 0xFF ){
+			received += header->raw_len;
+			skipped += header->raw_len;
+			continue;
+		}
+
+		for( range = 0; range < count; range++ ){
+			if( address - ranges[2 * range] < ranges[2 * range + 1] ){
+				break;
+			}
+		}
+		if( range == count ){
+			return UMD_CMD_FAIL;
+		}
+		last = address + header->raw_len;
+		if( last > ranges[2 * range] + ranges[2 * range + 1] ){
+			last = ranges[2 * range] + ranges[2 * range + 1];
+		}
+		erase_through(range, last - 1);
+		if( failed ){
+			return UMD_CMD_FAIL;
+		}
+		erase_advance();
+
+		// ubuf is the staging buffer
+		raw_len = Codec::decode(block, len - sizeof(address), buf->u8, CODEC_BLOCK_SIZE);
+		if( raw_len < 0 ){
+			return UMD_CMD_FAIL;
+		}
+
+		suspended = false;
+		if( pending && cart->chip_base(pending_address) == cart->chip_base(address) ){
+			suspended = cart->erase_suspend(pending_address);
+			if( !suspended ){
+				failed |= !cart->erase_wait(pending_address, pending_tick);
+				pending = false;
+			}
+		}
+		if( failed ){
+			return UMD_CMD_FAIL;
+		}
+		received += raw_len;
+		failed |= !cart->program_range(address, buf->u8, raw_len, Cartridge::mem_prg, written);
+		programmed += written;
+		skipped += raw_len - written;
+		if( suspended ){
+			cart->erase_resume(pending_address);
+		}
+		if( failed ){
+			return UMD_CMD_FAIL;
+		}
+		erase_advance();
+	}
+
+	if( usb.ext_rx_remaining() != 0 ){
+		return UMD_CMD_FAIL;
+	}
+	erase_through(count, 0);
+	if( failed ){
+		return UMD_CMD_FAIL;
+	}
+
+	usb.put(received);
+	usb.put(programmed);
+	usb.put(skipped);
+	usb.put(erased);
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x0019
+ **********************************************************************/
+uint32_t UMD::cmd_readprgchr(UMD_BUF *buf){
+	static const Cartridge::e_memory_type mem_types[2] = { Cartridge::mem_prg, Cartridge::mem_chr };
+	uint32_t address[2] = { 0, 0 }, remaining[2];
+	uint16_t len;
+	uint8_t i, mem, next_mem;
+
+	remaining[0] = buf->u32[1];
+	remaining[1] = buf->u32[2];
+
+	// the mapper stays selected for the reads which follow
+	if( !cart->set_mapper(buf->u16[0], remaining[0]) ){
+		return UMD_CMD_FAIL;
+	}
+
+	// both roms in a single extended reply, segments of PRG and CHR take turns while both have data left
+	if( ((remaining[0] | remaining[1]) % sizeof(uint32_t)) != 0 || !usb.ext_tx_start(remaining[0] + remaining[1]) ){
+		return UMD_CMD_FAIL;
+	}
+
+	mem = (remaining[0] != 0) ? 0 : 1;
+	len = (remaining[mem] > USB_EXT_SEGMENT_SIZE) ? USB_EXT_SEGMENT_SIZE : remaining[mem];
+	if( len != 0 ){
+		cart->read_async(address[mem], &buf->u8[0], len, mem_types[mem]);
+	}
+	for( i = 0; len != 0; i ^= 1 ){
+		cart->read_wait();
+		address[mem] += len;
+		remaining[mem] -= len;
+
+		// once the segment is queued the other half of the buffer is free for the next read
+		if( !usb.ext_put(&buf->u8[i * USB_EXT_SEGMENT_SIZE], len) ){
+			return UMD_CMD_FAIL;
+		}
+
+		next_mem = mem ^ 1;
+		if( remaining[next_mem] == 0 ){
+			next_mem = mem;
+		}
+		mem = next_mem;
+		len = (remaining[mem] > USB_EXT_SEGMENT_SIZE) ? USB_EXT_SEGMENT_SIZE : remaining[mem];
+		if( len != 0 ){
+			cart->read_async(address[mem], &buf->u8[(i ^ 1) * USB_EXT_SEGMENT_SIZE], len, mem_types[mem]);
+		}
+	}
+
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x001A
+ **********************************************************************/
+uint32_t UMD::cmd_getrominfo(UMD_BUF *buf){
 
+	cart->find_rom_info();
+	Span<Cartridge::s_rom_info> info = usb.reserve<Cartridge::s_rom_info>(1);
+	if( !info ){
+		return UMD_CMD_FAIL;
+	}
+	info[0] = cart->rom_info;
 	return UMD_CMD_OK;
 }
 
+/*******************************************************************//**
+ * 0x001B
+ * replies with the job id right away, the erase runs between commands
+ **********************************************************************/
+uint32_t UMD::cmd_erasechip(UMD_BUF *buf){
+
+	return job_start(job_erase_chip);
+}
+
+/*******************************************************************//**
+ * 0x001C
+ **********************************************************************/
+uint32_t UMD::cmd_eraserange(UMD_BUF *buf){
+
+	job_erase_range.set_range(buf->u32[0], buf->u32[1]);
+	return job_start(job_erase_range);
+}
+
+/*******************************************************************//**
+ * 0x001D
+ * without an id the status is of the last job started
+ **********************************************************************/
+uint32_t UMD::cmd_jobstatus(UMD_BUF *buf){
+
+	// the id is a whole uint32_t or left out
+	if( payload_size != 0 && payload_size != sizeof(uint32_t) ){
+		return UMD_CMD_FAIL;
+	}
+	Job *j = job_find(payload_size ? buf->u32[0] : 0);
+	if( j == nullptr ){
+		return UMD_CMD_FAIL;
+	}
+	Span<Job::s_status> status = usb.reserve<Job::s_status>(1);
+	if( !status ){
+		return UMD_CMD_FAIL;
+	}
+	status[0] = j->status;
+	return UMD_CMD_OK;
+}
+
+/*******************************************************************//**
+ * 0x001E
+ * replies with the status at the time of the request, the job ends as
+ * aborted at its next step
+ **********************************************************************/
+uint32_t UMD::cmd_jobabort(UMD_BUF *buf){
+
+	// the id is a whole uint32_t or left out
+	if( payload_size != 0 && payload_size != sizeof(uint32_t) ){
+		return UMD_CMD_FAIL;
+	}
+	Job *j = job_find(payload_size ? buf->u32[0] : 0);
+	if( j == nullptr || !j->running() ){
+		return UMD_CMD_FAIL;
+	}
+	j->abort();
+	return cmd_jobstatus(buf);
+}
@@ -5,6 +5,7 @@
  *      Author: rene
  */
 
+#include "crc.h"
 #include "UMD.h"
 
 
@@ -48,3 +49,60 @@ void UMD::io_boot_precharge(bool charge){
 	}
 }
 
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint32_t UMD::io_read_throughput(bool dma){
+
+	const uint16_t len = 1024;
+	uint32_t start, cycles;
+
+	if( cart_id == CartFactory::UNDEFINED ){
+		return 0;
+	}
+
+	// ubuf is free while a command without payload runs
+	start = DWT->CYCCNT;
+	if( cart->param.bus_size == 8 ){
+		cart->read_bytes((uint32_t)0, ubuf.u8, len, Cartridge::mem_prg, dma);
+	}else{
+		cart->read_words((uint32_t)0, ubuf.u16, len, Cartridge::mem_prg, dma);
+	}
+	cycles = DWT->CYCCNT - start;
+
+	return (cycles != 0) ? (uint32_t)(((uint64_t)len * SystemCoreClock) / cycles) : 0;
+}
+
+/*******************************************************************//**
+ * the next piece is read while the crc unit digests the previous one
+ **********************************************************************/
+uint32_t UMD::io_cart_crc32(uint32_t address, uint32_t size){
+
+	uint32_t crc;
+	uint16_t len, next_len;
+	uint8_t i;
+	bool bus_order;
+
+	__HAL_CRC_DR_RESET(&hcrc);
+	crc = hcrc.Instance->DR;
+
+	len = (size > CODEC_BLOCK_SIZE) ? CODEC_BLOCK_SIZE : size;
+	if( len != 0 ){
+		cart->read_async(address, (uint8_t *)zbuf[0], len, Cartridge::mem_prg);
+	}
+	for( i = 0; size != 0; i ^= 1 ){
+		// the data is only crc'd, a big endian cartridge's swap is folded into the crc feed
+		bus_order = cart->read_wait(true);
+		address += len;
+		size -= len;
+
+		next_len = (size > CODEC_BLOCK_SIZE) ? CODEC_BLOCK_SIZE : size;
+		if( next_len != 0 ){
+			cart->read_async(address, (uint8_t *)zbuf[i ^ 1], next_len, Cartridge::mem_prg);
+		}
+		crc = bus_order ? crc32mpeg2_calc_swap16(zbuf[i], len) : crc32mpeg2_calc(zbuf[i], len, false);
+		len = next_len;
+	}
+	return crc;
+}
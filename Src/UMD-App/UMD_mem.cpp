@@ -0,0 +1,53 @@
+/*******************************************************************//**
+ *  \file UMD_mem.cpp
+ *  \author René Richard
+ *  \brief Stack painting and RAM usage of the firmware.
+ *
+ *  \copyright This file is part of Universal Mega Dumper.
+ *
+ *   Universal Mega Dumper is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Universal Mega Dumper is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Universal Mega Dumper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "UMD.h"
+
+// linker script symbols, the stack grows down from _estack towards _end
+extern uint32_t _end;
+extern uint32_t _estack;
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+void UMD::mem_paint_stack(void){
+
+	uint32_t *p = &_end;
+	uint32_t *sp = (uint32_t *)(__get_MSP() - STACK_PAINT_GUARD);
+
+	while( p < sp ){
+		*(p++) = STACK_PAINT;
+	}
+}
+
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint32_t UMD::mem_stack_high_water(void){
+
+	uint32_t *p = &_end;
+
+	// the first word that isn't the paint pattern is the deepest the stack has been
+	while( p < &_estack && *p == STACK_PAINT ){
+		p++;
+	}
+	return (uint32_t)&_estack - (uint32_t)p;
+}
@@ -23,12 +23,24 @@
 #include "USB.h"
 #include "usbd_cdc_if.h"
 #include "crc.h"
+#include "Perf.h"
 
 /*******************************************************************//**
  *
  **********************************************************************/
-USB::USB(){
+USB::USB() : out(usbbuf.data.lwords, USB_BUFFER_SIZE - sizeof(uint32_t), usbbuf.size) {
 	usbbuf.size = 0;
+	usbbuf.high_water = 0;
+	reply_desc.count = 0;
+	reply_desc.size = 0;
+	ext_rx.remaining = 0;
+	ext_rx.chunked = false;
+	ext_rx.error = EXT_OK;
+	ext_tx.active = false;
+	ext_tx.crc_pending = false;
+	ext_tx.chunked = false;
+	ext_tx.remaining = 0;
+	tx_aborted = false;
 	CDC_InitBuffer();
 }
 
@@ -52,57 +64,109 @@ bool USB::is_full(void){
 }
 
 /*******************************************************************//**
- *
- **********************************************************************/
-bool USB::usbbuf_enough_room(uint16_t size){
-
-	// check if size + 4 (crc) fits in the buffer
-	if( USB_BUFFER_SIZE - (usbbuf.size + size + 4) >= 0 ){
-		return true;
-	}else{
-		return false;
-	}
-}
-
-/*******************************************************************//**
- *
+ * Calculate the CRC32/MPEG2 over the packet in transmission order: usbbuf
+ * segments interleaved with the attached descriptors, then send each piece
+ * from where it lives.
  **********************************************************************/
 void USB::transmit(void){
 
-	uint32_t crc, swapped;
+	uint32_t crc, start;
+	uint16_t pos;
+	uint8_t i;
 
 	// don't transmit if there's nothing to transmit
 	if( usbbuf.size != 0){
-		if( usbbuf.size > USB_BUFFER_SIZE ){
-			usbbuf.size = USB_BUFFER_SIZE;
+		// always leave room for the trailing CRC
+		if( usbbuf.size > USB_BUFFER_SIZE - sizeof(crc) ){
+			usbbuf.size = USB_BUFFER_SIZE - sizeof(crc);
+		}
+		if( usbbuf.size > usbbuf.high_water ){
+			usbbuf.high_water = usbbuf.size;
 		}
 
-		// add size of trailing CRC before calculation, because this number is part of the crc32 calculation
-		usbbuf.data.packet_size += 4;
+		// the packet size includes the attached data and the trailing CRC, it is part of the crc32 calculation
+		usbbuf.data.packet_size = usbbuf.size + reply_desc.size + sizeof(crc);
 
-		// swapping the endianness of each u32 gets the same results as python's:
-		// from crccheck.crc import Crc32Mpeg2
-		// I figure the STM32 can reverse endianness much faster than Python can so let's do it here
+		start = Perf::now();
 		__HAL_CRC_DR_RESET(&hcrc);
-
-
-		for( uint16_t i = 0 ; i < usbbuf.size ; i += 4){
-			swapped = usbbuf.data.bytes[i] << 24;
-			swapped |= usbbuf.data.bytes[i + 1] << 16;
-			swapped |= usbbuf.data.bytes[i + 2] << 8;
-			swapped |= usbbuf.data.bytes[i + 3];
-			crc = HAL_CRC_Accumulate(&hcrc, &swapped, 1);
+		pos = 0;
+		for( i = 0; i < reply_desc.count; i++ ){
+			crc_accumulate(&usbbuf.data.bytes[pos], reply_desc.list[i].offset - pos);
+			crc_accumulate(reply_desc.list[i].data, reply_desc.list[i].len);
+			pos = reply_desc.list[i].offset;
 		}
+		crc = crc_accumulate(&usbbuf.data.bytes[pos], usbbuf.size - pos);
 
 		// add crc as the trailing uint32_t to the buffer
-		put(crc);
+		usbbuf.data.lwords[usbbuf.size >> 2] = crc;
+		usbbuf.size += sizeof(crc);
+		Perf::stage(Perf::stage_crc, Perf::now() - start);
 
 		// transmit
-		CDC_Transmit_FS(usbbuf.data.bytes, usbbuf.size);
+		pos = 0;
+		for( i = 0; i < reply_desc.count; i++ ){
+			send(&usbbuf.data.bytes[pos], reply_desc.list[i].offset - pos);
+			send(reply_desc.list[i].data, reply_desc.list[i].len);
+			pos = reply_desc.list[i].offset;
+		}
+		send(&usbbuf.data.bytes[pos], usbbuf.size - pos);
+
+		// the attached buffers belong to the caller again once the last transfer is done
+		wait_tx_ready();
 
 		// reset the buffer
 		usbbuf.size = 0;
+		reply_desc.count = 0;
+		reply_desc.size = 0;
+	}
+}
+
+/*******************************************************************//**
+ * accumulate len bytes in the CRC unit, len is a multiple of 4
+ **********************************************************************/
+uint32_t USB::crc_accumulate(const uint8_t *data, uint32_t len){
+
+	const uint32_t *lword = (const uint32_t *)data;
+
+	// swapping the endianness of each u32 gets the same results as python's:
+	// from crccheck.crc import Crc32Mpeg2
+	for( len >>= 2; len != 0; len-- ){
+		hcrc.Instance->DR = __REV(*(lword++));
 	}
+	return hcrc.Instance->DR;
+}
+
+/*******************************************************************//**
+ * wait for the previous transfer to complete and send len bytes, once a
+ * piece couldn't go out the rest of the reply is dropped so the host never
+ * gets a reply with a hole in it, it times out and resyncs instead
+ * \return false if the reply was aborted
+ **********************************************************************/
+bool USB::send(const uint8_t *data, uint16_t len){
+
+	Perf::Probe probe(Perf::stage_transmit);
+	if( tx_aborted ){
+		return false;
+	}
+	if( len != 0 && (!wait_tx_ready() || CDC_Transmit_FS((uint8_t *)data, len) != USBD_OK) ){
+		tx_aborted = true;
+		return false;
+	}
+	return true;
+}
+
+/*******************************************************************//**
+ * wait until the CDC IN endpoint is idle
+ **********************************************************************/
+bool USB::wait_tx_ready(void){
+
+	uint32_t start_ms = HAL_GetTick();
+	while( CDC_TransmitBusy() ){
+		if( (HAL_GetTick() - start_ms) > TX_TIMEOUT ){
+			return false;
+		}
+	}
+	return true;
 }
 
 /*******************************************************************//**
@@ -119,175 +183,418 @@ uint16_t USB::available(uint32_t timeout_ms, uint16_t bytes_required){
 	return CDC_BytesAvailableTimeout(timeout_ms, bytes_required);
 }
 
+/*******************************************************************//**
+ * size of the CDC receive ring buffer
+ **********************************************************************/
+uint16_t USB::rx_size(void){
+	return CDC_BUFFER_SIZE;
+}
+
+/*******************************************************************//**
+ * highest fill level the CDC receive ring buffer reached
+ **********************************************************************/
+uint16_t USB::rx_high_water(void){
+	return CDC_HighWater();
+}
+
 /*******************************************************************//**
  *
  **********************************************************************/
 void USB::put_header(uint16_t reply){
 	// reset size to 4
 	usbbuf.size = 4;
+	// a new header starts a new reply, drop anything attached to the old one
+	reply_desc.count = 0;
+	reply_desc.size = 0;
+	tx_aborted = false;
 	// acknowledge command
 	usbbuf.data.ack = reply;
 }
 
+/*******************************************************************//**
+ * put a null terminated string in the buffer and pad to uint32_t
+ **********************************************************************/
+uint16_t USB::put(const char *str){
+
+	const char *end = str;
+	while( *end ){
+		end++;
+	}
+	return put(str, (uint16_t)(end - str));
+}
+
+/*******************************************************************//**
+ * put len characters of a string in the buffer and pad to uint32_t
+ **********************************************************************/
+uint16_t USB::put(const char *str, uint16_t len){
+	return out.put(str, len);
+}
+
+/*******************************************************************//**
+ * put a byte in the buffer and pad to uint32_t
+ **********************************************************************/
+uint16_t USB::put(uint8_t byte){
+	return out.put(byte);
+}
+
+/*******************************************************************//**
+ * put a word in the buffer and pad to uint32_t
+ **********************************************************************/
+uint16_t USB::put(uint16_t word){
+	return out.put(word);
+}
+
 /*******************************************************************//**
  *
  **********************************************************************/
-uint16_t USB::put(std::string str){
+uint16_t USB::put(uint32_t lword){
+	return out.put(lword);
+}
+
+/*******************************************************************//**
+ * put len bytes in the buffer and pad to uint32_t
+ **********************************************************************/
+uint16_t USB::put(uint8_t *data, uint16_t len){
+	return out.put(data, len);
+}
+
+/*******************************************************************//**
+ * put len bytes of words in the buffer and pad to uint32_t
+ **********************************************************************/
+uint16_t USB::put(uint16_t *data, uint16_t len){
+	return out.put(data, len);
+}
 
-	uint16_t str_len = str.length();
+/*******************************************************************//**
+ *
+ **********************************************************************/
+uint16_t USB::attach(const uint8_t *data, uint16_t len){
 
 	// only proceed if we're at an lword boundary
-	if( usbbuf.size % 4 != 0 ){
-		return -1;
+	if( usbbuf.size % 4 != 0 || len % 4 != 0 ){
+		return 0;
 	}
 
-	// is there enough room on the buffer for the string?
-	if( usbbuf_enough_room(str_len) ){
+	// descriptor list full or the packet size would overflow
+	if( reply_desc.count == USB_MAX_REPLY_DESC || (usbbuf.size + reply_desc.size + len + 4) > 0xFFFF ){
 		return 0;
-	}else{
-		const char *strp = str.c_str();
-		for( int i = 0; i < str_len ; i++){
-			usbbuf.data.bytes[usbbuf.size++] = *(strp++);
-		}
 	}
 
-	// pad to nearest uint32_t
-	while(str_len % 4 != 0){
-		usbbuf.data.bytes[usbbuf.size++] = 0;
-		str_len++;
+	reply_desc.list[reply_desc.count].data = data;
+	reply_desc.list[reply_desc.count].len = len;
+	reply_desc.list[reply_desc.count].offset = usbbuf.size;
+	reply_desc.count++;
+	reply_desc.size += len;
+	return len;
+}
+
+/*******************************************************************//**
+ * the first 4 bytes were read by the caller, the length and header crc follow
+ **********************************************************************/
+uint8_t USB::ext_rx_start(uint32_t header, uint32_t timeout_ms){
+
+	uint32_t ext[3];
+
+	ext_rx.remaining = 0;
+	ext_rx.chunked = false;
+	ext_rx.error = EXT_OK;
+
+	if( available(timeout_ms, USB_EXT_HEADER_SIZE - sizeof(header)) == 0 ){
+		return EXT_TIMEOUT;
+	}
+	ext[0] = header;
+	get((uint8_t *)&ext[1], USB_EXT_HEADER_SIZE - sizeof(header));
+
+	// the crc covers the command, size and length fields
+	__HAL_CRC_DR_RESET(&hcrc);
+	if( crc_accumulate((uint8_t *)ext, 8) != ext[2] ){
+		return EXT_CRC_ERROR;
+	}
+
+	// the size field of an extended header is the header size, the payload is sent in lwords
+	if( (header >> 16) != USB_EXT_HEADER_SIZE || (ext[1] != USB_EXT_CHUNKED && (ext[1] % 4) != 0) ){
+		return EXT_SIZE_ERROR;
 	}
 
-	return str_len;
+	// a chunked request stays 'remaining' until its 0 length chunk
+	ext_rx.chunked = (ext[1] == USB_EXT_CHUNKED);
+	ext_rx.remaining = ext[1];
+	return EXT_OK;
 }
 
 /*******************************************************************//**
- * put a byte in the buffer and pad to uin32t_t
+ * segments are USB_EXT_SEGMENT_SIZE bytes except for the last one, each
+ * is followed by its crc32. Chunks of a chunked request are preceded by
+ * their length which is part of the crc.
  **********************************************************************/
-uint16_t USB::put(uint8_t byte){
+uint16_t USB::ext_get(uint8_t *data, uint32_t timeout_ms){
 
-	// only proceed if we're at an lword boundary
-	if( usbbuf.size % 4 != 0 ){
-		return -1;
-	}
+	uint32_t crc, chunk_len;
+	uint16_t len;
 
-	// is the buffer full
-	if( usbbuf_enough_room(sizeof(uint32_t)) ){
+	if( ext_rx.remaining == 0 || ext_rx.error != EXT_OK ){
 		return 0;
+	}
+
+	if( ext_rx.chunked ){
+		if( available(timeout_ms, sizeof(chunk_len)) == 0 ){
+			ext_rx.error = EXT_TIMEOUT;
+			return 0;
+		}
+		get((uint8_t *)&chunk_len, sizeof(chunk_len));
+		if( chunk_len == 0 ){
+			ext_rx.remaining = 0;
+			return 0;
+		}
+		if( chunk_len > USB_EXT_CHUNK_MAX || (chunk_len % 4) != 0 ){
+			ext_rx.error = EXT_SIZE_ERROR;
+			return 0;
+		}
+		len = chunk_len;
 	}else{
-		usbbuf.data.bytes[usbbuf.size++] = byte;
-		usbbuf.data.bytes[usbbuf.size++] = 0;
-		usbbuf.data.bytes[usbbuf.size++] = 0;
-		usbbuf.data.bytes[usbbuf.size++] = 0;
+		len = (ext_rx.remaining > USB_EXT_SEGMENT_SIZE) ? USB_EXT_SEGMENT_SIZE : ext_rx.remaining;
+	}
+
+	if( available(timeout_ms, len + sizeof(crc)) == 0 ){
+		ext_rx.error = EXT_TIMEOUT;
+		return 0;
 	}
-	return 4;
+	get(data, len);
+	get((uint8_t *)&crc, sizeof(crc));
+
+	__HAL_CRC_DR_RESET(&hcrc);
+	if( ext_rx.chunked ){
+		crc_accumulate((const uint8_t *)&chunk_len, sizeof(chunk_len));
+	}
+	if( crc_accumulate(data, len) != crc ){
+		ext_rx.error = EXT_CRC_ERROR;
+		return 0;
+	}
+
+	if( !ext_rx.chunked ){
+		ext_rx.remaining -= len;
+	}
+	return len;
 }
 
 /*******************************************************************//**
- * put a word in the buffer and pad to uin32t_t
+ * only looks at the receive buffer, the length of a chunk is peeked so it
+ * stays for ext_get(). A bad length is left for ext_get() to report.
  **********************************************************************/
-uint16_t USB::put(uint16_t word){
+bool USB::ext_ready(void){
 
-	// only proceed if we're at an lword boundary
-	if( usbbuf.size % 4 != 0 ){
-		return -1;
+	uint32_t chunk_len;
+
+	if( ext_rx.remaining == 0 || ext_rx.error != EXT_OK ){
+		return true;
 	}
 
-	// is the buffer full?
-	if( usbbuf_enough_room(sizeof(uint32_t)) ){
-		return 0;
-	}else{
-		// put byte a time in case we're not at an even boundary
-		usbbuf.data.bytes[usbbuf.size++] = (uint8_t)word;
-		usbbuf.data.bytes[usbbuf.size++] = (uint8_t)(word>>8);
-		usbbuf.data.bytes[usbbuf.size++] = 0;
-		usbbuf.data.bytes[usbbuf.size++] = 0;
+	if( !ext_rx.chunked ){
+		chunk_len = (ext_rx.remaining > USB_EXT_SEGMENT_SIZE) ? USB_EXT_SEGMENT_SIZE : ext_rx.remaining;
+		return available() >= chunk_len + sizeof(uint32_t);
+	}
+
+	if( available() < sizeof(chunk_len) ){
+		return false;
 	}
-	return 4;
+	peak((uint8_t *)&chunk_len, sizeof(chunk_len));
+	if( chunk_len > USB_EXT_CHUNK_MAX ){
+		return true;
+	}
+	return available() >= sizeof(chunk_len) + chunk_len + sizeof(uint32_t);
 }
 
 /*******************************************************************//**
- *
+ * read and drop the remaining segments so the next command starts in sync,
+ * after an error the stream can't be trusted and is flushed instead
  **********************************************************************/
-uint16_t USB::put(uint32_t lword){
-
-	// only proceed if we're at an lword boundary
-	if( usbbuf.size % 4 != 0 ){
-		return -1;
+uint8_t USB::ext_rx_finish(uint32_t timeout_ms){
+
+	uint32_t chunk_len;
+	uint8_t error;
+
+	if( ext_rx.error == EXT_OK && ext_rx.remaining != 0 ){
+		if( ext_rx.chunked ){
+			// follow the chunk lengths up to the 0 length
+			while( ext_rx.error == EXT_OK ){
+				if( available(timeout_ms, sizeof(chunk_len)) == 0 ){
+					ext_rx.error = EXT_TIMEOUT;
+					break;
+				}
+				get((uint8_t *)&chunk_len, sizeof(chunk_len));
+				if( chunk_len == 0 ){
+					break;
+				}
+				if( chunk_len > USB_EXT_CHUNK_MAX ){
+					ext_rx.error = EXT_SIZE_ERROR;
+					break;
+				}
+				ext_skip(chunk_len + sizeof(uint32_t), timeout_ms);
+			}
+		}else{
+			ext_skip(ext_rx.remaining + sizeof(uint32_t) * ((ext_rx.remaining + USB_EXT_SEGMENT_SIZE - 1) / USB_EXT_SEGMENT_SIZE), timeout_ms);
+		}
 	}
 
-	// is the buffer full?
-	if( usbbuf_enough_room(sizeof(lword)) ){
-		return 0;
-	}else{
-		// put byte a time in case we're not at an even boundary
-		usbbuf.data.bytes[usbbuf.size++] = (uint8_t)lword;
-		usbbuf.data.bytes[usbbuf.size++] = (uint8_t)(lword>>8);
-		usbbuf.data.bytes[usbbuf.size++] = (uint8_t)(lword>>16);
-		usbbuf.data.bytes[usbbuf.size++] = (uint8_t)(lword>>24);
+	error = ext_rx.error;
+	if( error != EXT_OK ){
+		flush();
 	}
-	return 4;
+	ext_rx.remaining = 0;
+	ext_rx.chunked = false;
+	ext_rx.error = EXT_OK;
+	return error;
 }
 
 /*******************************************************************//**
- *
+ * discard len received bytes
  **********************************************************************/
-uint16_t USB::put(uint8_t *data, uint16_t len){
+void USB::ext_skip(uint32_t len, uint32_t timeout_ms){
 
-	uint16_t room_left = USB_BUFFER_SIZE - usbbuf.size;
+	uint8_t scratch[64];
+	uint16_t n;
 
-	// only proceed if we're at an lword boundary
-	if( usbbuf.size % 4 != 0 ){
-		return -1;
+	while( len != 0 ){
+		n = (len > sizeof(scratch)) ? sizeof(scratch) : len;
+		if( available(timeout_ms, n) == 0 ){
+			ext_rx.error = EXT_TIMEOUT;
+			return;
+		}
+		len -= get(scratch, n);
 	}
+}
 
-	// is there enough room on the buffer for the data
-	if( len > room_left ){
-		return 0;
-	}else{
-		for( int i = 0; i < len ; i++){
-			usbbuf.data.bytes[usbbuf.size++] = *(data++);
-		}
+/*******************************************************************//**
+ * The ack from put_header() gets the extended bit and the header is sent right
+ * away. Anything put in usbbuf before this is dropped, put() is unusable until
+ * ext_tx_end().
+ * usbbuf layout while the reply is active:
+ *   lwords[0..2] header, then the status trailer
+ *   lwords[3]    crc of the last segment
+ *   lwords[4]    length of the next segment of a chunked reply
+ *   bytes[32..]  0 fill for replies that end early
+ **********************************************************************/
+bool USB::ext_tx_start(uint32_t len){
+
+	if( ext_tx.active || (len != USB_EXT_CHUNKED && (len % 4) != 0) ){
+		return false;
+	}
+
+	reply_desc.count = 0;
+	reply_desc.size = 0;
+
+	usbbuf.data.ack |= USB_EXT_FRAME;
+	usbbuf.data.packet_size = USB_EXT_HEADER_SIZE;
+	usbbuf.data.lwords[1] = len;
+	__HAL_CRC_DR_RESET(&hcrc);
+	usbbuf.data.lwords[2] = crc_accumulate(usbbuf.data.bytes, 8);
+	send(usbbuf.data.bytes, USB_EXT_HEADER_SIZE);
+
+	// leave no room so a stray put() can't touch the buffer while it's transmitted
+	usbbuf.size = USB_BUFFER_SIZE - sizeof(uint32_t);
+	ext_tx.active = true;
+	ext_tx.crc_pending = false;
+	ext_tx.chunked = (len == USB_EXT_CHUNKED);
+	ext_tx.remaining = ext_tx.chunked ? 0 : len;
+	return true;
+}
+
+/*******************************************************************//**
+ * The crc of a segment is only sent once the next segment or the end of the
+ * reply comes, so the caller can prepare the next segment while this one is
+ * being transmitted.
+ **********************************************************************/
+bool USB::ext_put(const uint8_t *data, uint16_t len){
+
+	uint32_t crc, chunk_len = len;
+
+	if( !ext_tx.active || tx_aborted || (len % 4) != 0 ){
+		return false;
+	}
+	if( ext_tx.chunked ? (len == 0 || len > USB_EXT_CHUNK_MAX) : (len > USB_EXT_SEGMENT_SIZE || len > ext_tx.remaining) ){
+		return false;
 	}
 
-	// pad to nearest uint32_t
-	while(len % 4 != 0){
-		usbbuf.data.bytes[usbbuf.size++] = 0;
-		len++;
+	// the crc of a chunk covers its length too
+	__HAL_CRC_DR_RESET(&hcrc);
+	if( ext_tx.chunked ){
+		crc_accumulate((const uint8_t *)&chunk_len, sizeof(chunk_len));
 	}
+	crc = crc_accumulate(data, len);
 
-	return len;
+	if( ext_tx.chunked ){
+		// the previous crc and this length go out together
+		usbbuf.data.lwords[4] = chunk_len;
+		send(&usbbuf.data.bytes[ext_tx.crc_pending ? 12 : 16], ext_tx.crc_pending ? 8 : 4);
+		ext_tx.crc_pending = false;
+	}else{
+		ext_send_crc();
+		ext_tx.remaining -= len;
+	}
+	if( !send(data, len) ){
+		return false;
+	}
+	// send() waited for the previous crc to go out, its slot is free
+	usbbuf.data.lwords[3] = crc;
+	ext_tx.crc_pending = true;
+	return true;
 }
 
 /*******************************************************************//**
  *
  **********************************************************************/
-uint16_t USB::put(uint16_t *data, uint16_t len){
+void USB::ext_tx_end(uint32_t status){
 
-	uint16_t room_left = USB_BUFFER_SIZE - usbbuf.size;
+	uint16_t len, i;
 
-	// only proceed if we're at an lword boundary
-	if( usbbuf.size % 4 != 0 ){
-		return -1;
+	if( !ext_tx.active ){
+		return;
 	}
 
-	// is there enough room on the buffer for the string?
-	if( len > room_left ){
-		return 0;
-	}else{
-		for( int i = 0; i < (len>>2) ; i++){
-			// put byte a time in case we're not at an even boundary
-			usbbuf.data.bytes[usbbuf.size++] = (uint8_t)(*(data));
-			usbbuf.data.bytes[usbbuf.size++] = (uint8_t)((*(data++)>>8));
+	if( ext_tx.chunked ){
+		// a 0 length ends a chunked reply
+		wait_tx_ready();
+		usbbuf.data.lwords[4] = 0;
+		send(&usbbuf.data.bytes[ext_tx.crc_pending ? 12 : 16], ext_tx.crc_pending ? 8 : 4);
+		ext_tx.crc_pending = false;
+	}else if( ext_tx.remaining != 0 ){
+		// a reply that ended early is 0 filled so the host stays in sync, the status tells it why
+		for( i = 8; i < 8 + (USB_EXT_SEGMENT_SIZE >> 2); i++ ){
+			usbbuf.data.lwords[i] = 0;
+		}
+		while( ext_tx.remaining != 0 ){
+			len = (ext_tx.remaining > USB_EXT_SEGMENT_SIZE) ? USB_EXT_SEGMENT_SIZE : ext_tx.remaining;
+			if( !ext_put(&usbbuf.data.bytes[32], len) ){
+				break;
+			}
 		}
 	}
+	ext_send_crc();
 
-	// pad to nearest uint32_t
-	while(len % 4 != 0){
-		usbbuf.data.bytes[usbbuf.size++] = 0;
-		len++;
+	// an aborted reply gets no trailer either, the host already lost it
+	if( !tx_aborted ){
+		// trailer, the status and its crc
+		wait_tx_ready();
+		usbbuf.data.lwords[1] = status;
+		__HAL_CRC_DR_RESET(&hcrc);
+		usbbuf.data.lwords[2] = crc_accumulate(&usbbuf.data.bytes[4], sizeof(status));
+		send(&usbbuf.data.bytes[4], 8);
+		wait_tx_ready();
 	}
 
-	return len;
+	usbbuf.size = 0;
+	ext_tx.active = false;
+}
+
+/*******************************************************************//**
+ * send the crc of the last segment if it hasn't been sent yet
+ **********************************************************************/
+void USB::ext_send_crc(void){
+
+	if( ext_tx.crc_pending ){
+		send(&usbbuf.data.bytes[12], sizeof(uint32_t));
+		ext_tx.crc_pending = false;
+	}
 }
 
 /*******************************************************************//**
@@ -305,3 +612,10 @@ uint16_t USB::get(uint8_t* data, uint16_t size){
 	return CDC_ReadBuffer(data, size);
 }
 
+
+/*******************************************************************//**
+ * copy received bytes without consuming them
+ **********************************************************************/
+uint16_t USB::peak(uint8_t* data, uint16_t size){
+	return CDC_PeakBuffer(data, size);
+}
@@ -24,9 +24,16 @@
 #define USB_H_
 
 #include <cstdint>
-#include <string>
+#include "Serializer.h"
 
 #define USB_BUFFER_SIZE 	8192
+#define USB_MAX_REPLY_DESC	4
+
+#define USB_EXT_FRAME			0x2000		///< command / ack bit marking an extended frame
+#define USB_EXT_HEADER_SIZE		12			///< cmd, size, u32 length, u32 header crc
+#define USB_EXT_SEGMENT_SIZE	4096		///< each segment of an extended frame is followed by its own crc
+#define USB_EXT_CHUNKED			0xFFFFFFFF	///< extended frame length when the size isn't known up front
+#define USB_EXT_CHUNK_MAX		(USB_EXT_SEGMENT_SIZE + 16)	///< largest segment of a chunked frame
 
 class USB{
 
@@ -41,32 +48,160 @@ public:
 			};
 			uint8_t		bytes[USB_BUFFER_SIZE];     	///< byte access within dataBuffer
 			uint16_t    words[USB_BUFFER_SIZE/2];   	///< word access within dataBuffer
+			uint32_t    lwords[USB_BUFFER_SIZE/4];   	///< lword access within dataBuffer
 		}data;
 		uint16_t	size;
+		uint16_t	high_water;							///< largest reply transmitted so far
 	} usbbuf;
 
+	/*******************************************************************//**
+	 * \brief reply descriptor
+	 * bulk data attached to a reply, it is CRC'd and transmitted straight from
+	 * the buffer it lives in instead of being copied into usbbuf
+	 **********************************************************************/
+	struct s_reply_desc{
+		const uint8_t	*data;
+		uint16_t		len;
+		uint16_t		offset;								///< position in usbbuf where the data is inserted
+	};
+
+	struct{
+		s_reply_desc	list[USB_MAX_REPLY_DESC];
+		uint8_t			count;
+		uint32_t		size;								///< total bytes attached
+	} reply_desc;
+
 	bool is_full(void);
 	void transmit(void);
 	void flush(void);
 
 	uint16_t available(void);
 	uint16_t available(uint32_t timeout_ms, uint16_t bytes_required);
+	uint16_t rx_size(void);
+	uint16_t rx_high_water(void);
 
 
 	void put_header(uint16_t reply);
-	uint16_t put(std::string str);
+	uint16_t put(const char *str);
+	uint16_t put(const char *str, uint16_t len);
 	uint16_t put(uint8_t byte);
 	uint16_t put(uint16_t word);
 	uint16_t put(uint32_t lword);
 	uint16_t put(uint8_t *data, uint16_t len);
 	uint16_t put(uint16_t *data, uint16_t len);
 
+	/*******************************************************************//**
+	 * \brief reserve room for count elements of T in the reply, the caller
+	 *        fills them in place
+	 * \return span over the reserved space, empty if there isn't enough room
+	 **********************************************************************/
+	template<typename T>
+	Span<T> reserve(uint16_t count){ return out.reserve<T>(count); }
+
+	/*******************************************************************//**
+	 * \brief attach bulk data to the reply without copying it, anything put
+	 *        afterwards is transmitted after the data. The buffer must not be
+	 *        modified until transmit() returns.
+	 * \param data pointer to the data
+	 * \param len length in bytes, must be a multiple of 4
+	 * \return len, or 0 if the data couldn't be attached
+	 **********************************************************************/
+	uint16_t attach(const uint8_t *data, uint16_t len);
+
+	// extended frame receive status
+	enum : uint8_t {
+		EXT_OK = 0,
+		EXT_TIMEOUT,
+		EXT_CRC_ERROR,
+		EXT_SIZE_ERROR,
+	};
+
+	/*******************************************************************//**
+	 * \brief receive the rest of an extended request header and check its crc
+	 * \param header the 4 byte header already received
+	 * \param timeout_ms how long to wait for the rest of the header
+	 * \return EXT_OK or the EXT_xxx error
+	 **********************************************************************/
+	uint8_t ext_rx_start(uint32_t header, uint32_t timeout_ms);
+
+	/*******************************************************************//**
+	 * \brief receive the next segment of an extended request
+	 * \param data destination, at least USB_EXT_SEGMENT_SIZE bytes or
+	 *        USB_EXT_CHUNK_MAX for a chunked request
+	 * \return segment length, 0 once the payload is exhausted or on error
+	 **********************************************************************/
+	uint16_t ext_get(uint8_t *data, uint32_t timeout_ms);
+
+	/*******************************************************************//**
+	 * \brief check without blocking if ext_get() has its next segment at hand
+	 * \return true once ext_get() won't wait, also when it would fail right away
+	 **********************************************************************/
+	bool ext_ready(void);
+
+	/*******************************************************************//**
+	 * \brief discard what the command didn't read of an extended request
+	 * \return EXT_OK, or the first error seen in the request
+	 **********************************************************************/
+	uint8_t ext_rx_finish(uint32_t timeout_ms);
+	uint32_t ext_rx_remaining(void){ return ext_rx.remaining; }
+
+	/*******************************************************************//**
+	 * \brief turn the reply started with put_header() into an extended reply
+	 *        of len bytes and send its header
+	 * \param len payload length in bytes, a multiple of 4, or USB_EXT_CHUNKED
+	 *        when the length isn't known, every segment is then preceded by
+	 *        its length
+	 **********************************************************************/
+	bool ext_tx_start(uint32_t len);
+
+	/*******************************************************************//**
+	 * \brief send the next segment of an extended reply. The data is still being
+	 *        transmitted on return, it must not be modified until the next
+	 *        ext_put() or ext_tx_end() returns.
+	 * \param len a multiple of 4, at most USB_EXT_SEGMENT_SIZE or USB_EXT_CHUNK_MAX
+	 *        for a chunked reply
+	 * \return false if the segment wasn't sent, the reply is then aborted
+	 *         and the command should fail
+	 **********************************************************************/
+	bool ext_put(const uint8_t *data, uint16_t len);
+
+	/*******************************************************************//**
+	 * \brief finish the extended reply, anything not sent yet is 0 filled and
+	 *        followed by the status trailer
+	 **********************************************************************/
+	void ext_tx_end(uint32_t status);
+	bool ext_tx_active(void){ return ext_tx.active; }
+
 	uint8_t  get(void);
 	uint16_t get(uint8_t* data, uint16_t size);
 	uint16_t peak(uint8_t* data, uint16_t size);
 
 private:
-	bool usbbuf_enough_room(uint16_t size);
+	const uint32_t TX_TIMEOUT = 100;
+
+	Serializer out;										///< serializes the puts into usbbuf, the last lword is kept for the CRC
+
+	// extended frames stream through the regular buffers a segment at a time
+	struct{
+		uint32_t	remaining;							///< payload bytes not received yet, USB_EXT_CHUNKED until the last chunk
+		bool		chunked;							///< chunks have a length prefix
+		uint8_t		error;								///< EXT_xxx of the first bad segment
+	} ext_rx;
+
+	struct{
+		bool		active;
+		bool		crc_pending;						///< crc of the last segment is sent with the next one
+		bool		chunked;							///< segments have a length prefix
+		uint32_t	remaining;							///< payload bytes not sent yet
+	} ext_tx;
+
+	bool		tx_aborted;								///< a piece of the reply timed out, the rest isn't sent
+
+	uint32_t crc_accumulate(const uint8_t *data, uint32_t len);
+	bool send(const uint8_t *data, uint16_t len);
+	bool wait_tx_ready(void);
+	void ext_send_crc(void);
+	void ext_skip(uint32_t len, uint32_t timeout_ms);
 
 };
 
@@ -109,6 +109,7 @@ int main(void)
   MX_FATFS_Init();
   MX_USB_DEVICE_Init();
   /* USER CODE BEGIN 2 */
+  trace_init();
 
   /* USER CODE END 2 */
 
@@ -119,7 +120,8 @@ int main(void)
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
-	  UMD UMDapp;
+	  // static so the application's buffers are accounted for in .bss at link time
+	  static UMD UMDapp;
 	  UMDapp.run();
   }
   /* USER CODE END 3 */
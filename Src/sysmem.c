@@ -50,34 +50,21 @@
 #include <errno.h>
 #include <stdio.h>
 
-/* Variables */
-extern int errno;
-register char * stack_ptr asm("sp");
-
 /* Functions */
 
+/**
+ __umd_heap_is_disabled
+ The UMD firmware is statically allocated and never uses the heap. This symbol
+ is deliberately left undefined: _sbrk is discarded at link time unless something
+ pulls malloc into the image, in which case the link fails on this reference.
+**/
+extern caddr_t __umd_heap_is_disabled(int incr);
+
 /**
  _sbrk
  Increase program data space. Malloc and related functions depend on this
 **/
 caddr_t _sbrk(int incr)
 {
-	extern char end asm("end");
-	static char *heap_end;
-	char *prev_heap_end;
-
-	if (heap_end == 0)
-		heap_end = &end;
-
-	prev_heap_end = heap_end;
-	if (heap_end + incr > stack_ptr)
-	{
-		errno = ENOMEM;
-		return (caddr_t) -1;
-	}
-
-	heap_end += incr;
-
-	return (caddr_t) prev_heap_end;
+	return __umd_heap_is_disabled(incr);
 }
-
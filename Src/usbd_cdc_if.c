@@ -23,6 +23,7 @@
 #include "usbd_cdc_if.h"
 
 /* USER CODE BEGIN INCLUDE */
+#include "UMD-App/Trace.h"
 
 /* USER CODE END INCLUDE */
 
@@ -137,6 +138,7 @@ static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len);
 static int8_t CDC_TransmitCplt_FS(uint8_t *pbuf, uint32_t *Len, uint8_t epnum);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
+static void CDC_ResumeReceive(void);
 
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -161,8 +163,11 @@ USBD_CDC_ItfTypeDef USBD_Interface_fops_FS =
 static int8_t CDC_Init_FS(void)
 {
   /* USER CODE BEGIN 3 */
+	// the class arms the OUT endpoint itself after init
+	cdcbuf.rx_paused = 0;
 	CDC_InitBuffer();
 	cdcbuf.packets = 0;
+	cdcbuf.high_water = 0;
   /* Set Application Buffers */
   USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
@@ -293,7 +298,7 @@ static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 	for(i=0; i<(*Len); i++){
 
 		//is the buffer full?
-		if( cdcbuf.op == ( cdcbuf.ip & CDC_BUFFER_MASK ) + 1 ){
+		if( ( ( cdcbuf.ip + 1 ) & CDC_BUFFER_MASK ) == cdcbuf.op ){
 			cdcbuf.status = CDC_RX_FULL;
 		}else{
 			//copy into usbbuf byte buffer
@@ -304,8 +309,21 @@ static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 		}
 	}
 
+	// keep track of the fill level for the memory report
+	if( (( cdcbuf.ip - cdcbuf.op ) & CDC_BUFFER_MASK) > cdcbuf.high_water ){
+		cdcbuf.high_water = ( cdcbuf.ip - cdcbuf.op ) & CDC_BUFFER_MASK;
+	}
+
+	trace(TRACE_USB_RX, *Len, CDC_BytesAvailable());
+
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
-  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+	// only ask for the next packet if it fits, the host is NAK'd until the application catches up
+	if( CDC_BUFFER_MASK - CDC_BytesAvailable() < CDC_DATA_FS_MAX_PACKET_SIZE ){
+		cdcbuf.rx_paused = 1;
+		trace(TRACE_USB_RX_PAUSED, CDC_BytesAvailable(), 0);
+	}else{
+		USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+	}
   return (USBD_OK);
   /* USER CODE END 6 */
 }
@@ -359,6 +377,19 @@ static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
 }
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+/**
+  * @brief  Re-arm the OUT endpoint once a full packet fits in the buffer again
+  */
+static void CDC_ResumeReceive(void){
+
+	if( cdcbuf.rx_paused && ( CDC_BUFFER_MASK - CDC_BytesAvailable() >= CDC_DATA_FS_MAX_PACKET_SIZE ) ){
+		__disable_irq();
+		cdcbuf.rx_paused = 0;
+		USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+		__enable_irq();
+	}
+}
+
 uint8_t CDC_ReadBuffer_Single(void){
 
 	uint8_t data;
@@ -368,6 +399,7 @@ uint8_t CDC_ReadBuffer_Single(void){
 	if( cdcbuf.op == cdcbuf.ip ){
 		cdcbuf.status = CDC_RX_EMPTY;
 	}
+	CDC_ResumeReceive();
 	return data;
 }
 
@@ -382,11 +414,13 @@ uint16_t CDC_ReadBuffer(uint8_t *buf, uint16_t len){
 		cdcbuf.op &= CDC_BUFFER_MASK;
 		// return if all requested bytes were read
 		if( ++count == len ){
+			CDC_ResumeReceive();
 			return count;
 		}
 	}
 	// return early if no more bytes are available
 	cdcbuf.status = CDC_RX_EMPTY;
+	CDC_ResumeReceive();
 	return count;
 }
 
@@ -401,7 +435,7 @@ uint16_t CDC_PeakBuffer(uint8_t *buf, uint16_t len){
 		// wrap buffer
 		pos &= CDC_BUFFER_MASK;
 		// return if all requested bytes were read
-		if( count++ == len ){
+		if( ++count == len ){
 			return count;
 		}
 	}
@@ -426,6 +460,15 @@ uint16_t CDC_BytesAvailableTimeout(uint32_t timeout_ms, uint16_t bytes_required)
 	return 0;
 }
 
+uint8_t CDC_TransmitBusy(void){
+	USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+	return ( hcdc != NULL ) && ( hcdc->TxState != 0 );
+}
+
+uint16_t CDC_HighWater(void){
+	return cdcbuf.high_water;
+}
+
 uint8_t CDC_PeakLast(void){
 	return cdcbuf.data.byte[(cdcbuf.ip - 1) & CDC_BUFFER_MASK];
 }
@@ -438,6 +481,7 @@ void CDC_InitBuffer(void){
 	cdcbuf.ip = 0;
 	cdcbuf.op = 0;
 	cdcbuf.status = CDC_RX_EMPTY;
+	CDC_ResumeReceive();
 }
 
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */